@@ -0,0 +1,92 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// Thread-safe queue to connect the stages of a pipeline. Pushing blocks while the queue is full so
+// a fast producer can't get too far ahead of a slow consumer.
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(std::size_t capacity)
+		: m_capacity(std::max(capacity, std::size_t(1))), m_closed(false)
+	{
+	}
+
+	// Returns false if the queue was closed.
+	bool push(T value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFull.wait(lock, [this]() {return m_closed || m_values.size() < m_capacity;});
+		if (m_closed)
+			return false;
+
+		m_values.push_back(std::move(value));
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	// Returns false once the queue is closed and all values have been popped.
+	bool pop(T& value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmpty.wait(lock, [this]() {return m_closed || !m_values.empty();});
+		if (m_values.empty())
+			return false;
+
+		value = std::move(m_values.front());
+		m_values.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	// Returns false without waiting if no value is ready.
+	bool tryPop(T& value)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_values.empty())
+			return false;
+
+		value = std::move(m_values.front());
+		m_values.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	// Signals that no more values will be pushed.
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+	}
+
+private:
+	std::size_t m_capacity;
+	bool m_closed;
+	std::deque<T> m_values;
+	std::mutex m_mutex;
+	std::condition_variable m_notEmpty;
+	std::condition_variable m_notFull;
+};
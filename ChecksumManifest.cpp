@@ -0,0 +1,126 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ChecksumManifest.h"
+
+#include "FileSystem.h"
+#include "Helpers.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+const char* const ChecksumManifest::cFileName = ".MusicSyncChecksums";
+
+namespace
+{
+
+const char* const cHeader = "#MusicSync checksums ";
+
+const char* getAlgorithmName(Hash::Algorithm algorithm)
+{
+	return algorithm == Hash::Algorithm::Md5 ? "md5" : "xxh64";
+}
+
+} // namespace
+
+ChecksumManifest::ChecksumManifest(FileSystem& songDir, Hash::Algorithm algorithm)
+	: m_songDir(songDir), m_algorithm(algorithm)
+{
+}
+
+bool ChecksumManifest::load()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+
+	FileSystem::FileInfo info;
+	if (!m_songDir.getFileInfo(info, cFileName))
+		return true;
+
+	std::string contents;
+	if (!m_songDir.readFile(contents, cFileName))
+		return false;
+
+	std::istringstream stream(contents);
+
+	// Checksums from a different algorithm can't be compared, so start over.
+	std::string line;
+	std::string header = cHeader;
+	header += getAlgorithmName(m_algorithm);
+	if (!Helpers::readLine(line, stream) || line != header)
+		return true;
+
+	// Each line is the checksum, size, and modified time followed by the path, separated by tabs.
+	while (Helpers::readLine(line, stream))
+	{
+		std::size_t sizeStart = line.find('\t');
+		std::size_t timeStart = sizeStart == std::string::npos ? sizeStart :
+			line.find('\t', sizeStart + 1);
+		std::size_t pathStart = timeStart == std::string::npos ? timeStart :
+			line.find('\t', timeStart + 1);
+		if (pathStart != std::string::npos)
+		{
+			StoredEntry stored;
+			stored.entry.checksum = line.substr(0, sizeStart);
+			stored.entry.size = std::strtoull(line.c_str() + sizeStart + 1, nullptr, 10);
+			stored.entry.modifiedTime = std::strtoll(line.c_str() + timeStart + 1, nullptr, 10);
+			stored.current = false;
+			m_entries[line.substr(pathStart + 1)] = std::move(stored);
+		}
+
+		if (stream.eof())
+			break;
+	}
+
+	return true;
+}
+
+bool ChecksumManifest::save() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::ostringstream stream;
+	stream << cHeader << getAlgorithmName(m_algorithm) << '\n';
+	for (const auto& pathEntry : m_entries)
+	{
+		if (!pathEntry.second.current)
+			continue;
+
+		const Entry& entry = pathEntry.second.entry;
+		stream << entry.checksum << '\t' << entry.size << '\t' << entry.modifiedTime << '\t' <<
+			pathEntry.first << '\n';
+	}
+
+	// Replace the file in one step so an interrupted save keeps the previous manifest.
+	return m_songDir.replaceFile(cFileName, stream.str());
+}
+
+bool ChecksumManifest::find(Entry& entry, const std::string& relativePath) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto foundIter = m_entries.find(relativePath);
+	if (foundIter == m_entries.end())
+		return false;
+
+	entry = foundIter->second.entry;
+	return true;
+}
+
+void ChecksumManifest::set(const std::string& relativePath, Entry entry)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries[relativePath] = StoredEntry{std::move(entry), true};
+}
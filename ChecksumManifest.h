@@ -0,0 +1,68 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Hash.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class FileSystem;
+
+// Checksums of the songs on the device, stored in a file in the song output directory. This allows
+// songs to be verified on later runs without reading the source again.
+//
+// Each entry records the size and modified time of the song when it was verified, so entries for
+// songs that were changed since are ignored. Only entries that were set during this run are saved.
+//
+// All functions are thread-safe.
+class ChecksumManifest
+{
+public:
+	struct Entry
+	{
+		std::string checksum;
+		std::uint64_t size;
+		std::int64_t modifiedTime;
+	};
+
+	// Name of the manifest file relative to the song directory.
+	static const char* const cFileName;
+
+	ChecksumManifest(FileSystem& songDir, Hash::Algorithm algorithm);
+
+	// Returns true if the manifest doesn't exist yet.
+	bool load();
+	bool save() const;
+
+	bool find(Entry& entry, const std::string& relativePath) const;
+	void set(const std::string& relativePath, Entry entry);
+
+private:
+	struct StoredEntry
+	{
+		Entry entry;
+		bool current;
+	};
+
+	FileSystem& m_songDir;
+	Hash::Algorithm m_algorithm;
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, StoredEntry> m_entries;
+};
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ConcurrencyController.h"
+
+namespace
+{
+
+// Long enough to average out the page cache and device buffers absorbing bursts.
+const std::chrono::milliseconds cSampleInterval(2000);
+const double cImprovementThreshold = 0.05;
+const double cDegradationThreshold = 0.1;
+const unsigned int cReadIndex = 0;
+const unsigned int cWriteIndex = 1;
+
+} // namespace
+
+ConcurrencyController::ConcurrencyController(ConcurrencyLimit& readLimit, bool autoRead,
+	ConcurrencyLimit& writeLimit, bool autoWrite, unsigned int maxLimit)
+	: m_limits{&readLimit, &writeLimit}, m_autoLimits{autoRead, autoWrite},
+	m_maxLimit(std::max(maxLimit, 1U)), m_files(0), m_stop(false),
+	m_probeIndex(autoWrite ? cWriteIndex : cReadIndex), m_increased(false),
+	m_lastBytesPerSecond(0)
+{
+	m_bestSettings.readLimit = readLimit.getLimit();
+	m_bestSettings.writeLimit = writeLimit.getLimit();
+}
+
+ConcurrencyController::~ConcurrencyController()
+{
+	stop();
+}
+
+void ConcurrencyController::start()
+{
+	if (isTuning() && !m_thread.joinable())
+		m_thread = std::thread([this]() {run();});
+}
+
+void ConcurrencyController::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+		m_condition.notify_all();
+	}
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+ConcurrencyController::Settings ConcurrencyController::getBestSettings() const
+{
+	std::lock_guard<std::mutex> lock(m_bestMutex);
+	return m_bestSettings;
+}
+
+void ConcurrencyController::run()
+{
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point lastTime = Clock::now();
+	std::uint64_t lastBytes = m_limits[cWriteIndex]->getBytes();
+	std::uint64_t lastFiles = m_files;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_condition.wait_for(lock, cSampleInterval, [this]() {return m_stop;}))
+	{
+		Clock::time_point time = Clock::now();
+		std::uint64_t bytes = m_limits[cWriteIndex]->getBytes();
+		std::uint64_t files = m_files;
+		double seconds = std::chrono::duration<double>(time - lastTime).count();
+
+		// Skip intervals where nothing was copied, such as when all songs are up to date.
+		if (bytes != lastBytes && seconds > 0)
+			update(double(bytes - lastBytes)/seconds, double(files - lastFiles)/seconds);
+
+		lastTime = time;
+		lastBytes = bytes;
+		lastFiles = files;
+	}
+}
+
+void ConcurrencyController::update(double bytesPerSecond, double filesPerSecond)
+{
+	// The measurement is for the current limits, before adjusting for the next interval.
+	{
+		std::lock_guard<std::mutex> lock(m_bestMutex);
+		if (bytesPerSecond > m_bestSettings.bytesPerSecond*(1.0 + cImprovementThreshold))
+		{
+			m_bestSettings.readLimit = m_limits[cReadIndex]->getLimit();
+			m_bestSettings.writeLimit = m_limits[cWriteIndex]->getLimit();
+			m_bestSettings.bytesPerSecond = bytesPerSecond;
+			m_bestSettings.filesPerSecond = filesPerSecond;
+		}
+	}
+
+	if (m_lastBytesPerSecond == 0)
+		m_increased = increase(m_probeIndex);
+	else if (bytesPerSecond >= m_lastBytesPerSecond*(1.0 + cImprovementThreshold))
+	{
+		// Keep increasing while it helps.
+		m_increased = increase(m_probeIndex);
+		if (!m_increased)
+		{
+			switchProbe();
+			m_increased = increase(m_probeIndex);
+		}
+	}
+	else if (bytesPerSecond <= m_lastBytesPerSecond*(1.0 - cDegradationThreshold))
+	{
+		// Back off quickly when more concurrency hurts, then probe the other limit.
+		if (m_increased)
+			decrease(m_probeIndex, true);
+		m_increased = false;
+		switchProbe();
+	}
+	else
+	{
+		// No real difference, so undo the last increase to avoid creeping up for no benefit.
+		if (m_increased)
+		{
+			decrease(m_probeIndex, false);
+			m_increased = false;
+			switchProbe();
+		}
+		else
+			m_increased = increase(m_probeIndex);
+	}
+
+	m_lastBytesPerSecond = bytesPerSecond;
+}
+
+bool ConcurrencyController::increase(unsigned int index)
+{
+	if (!m_autoLimits[index])
+		return false;
+
+	unsigned int limit = m_limits[index]->getLimit();
+	if (limit >= m_maxLimit)
+		return false;
+
+	m_limits[index]->setLimit(limit + 1);
+	return true;
+}
+
+void ConcurrencyController::decrease(unsigned int index, bool multiplicative)
+{
+	if (!m_autoLimits[index])
+		return;
+
+	unsigned int limit = m_limits[index]->getLimit();
+	m_limits[index]->setLimit(multiplicative ? limit/2 : limit - 1);
+}
+
+void ConcurrencyController::switchProbe()
+{
+	unsigned int otherIndex = 1 - m_probeIndex;
+	if (m_autoLimits[otherIndex])
+		m_probeIndex = otherIndex;
+}
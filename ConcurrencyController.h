@@ -0,0 +1,84 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ConcurrencyLimit.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Tunes the read and write concurrency limits for copying songs based on the measured throughput.
+//
+// Limits are probed one at a time with additive increase while throughput improves and
+// multiplicative decrease when it drops, alternating between the read and write limits when
+// throughput levels off. The limits with the best throughput are remembered so they can be
+// reported and pinned for future runs.
+class ConcurrencyController
+{
+public:
+	struct Settings
+	{
+		unsigned int readLimit = 1;
+		unsigned int writeLimit = 1;
+		double bytesPerSecond = 0;
+		double filesPerSecond = 0;
+	};
+
+	// Limits are only tuned when the auto flags are set.
+	ConcurrencyController(ConcurrencyLimit& readLimit, bool autoRead, ConcurrencyLimit& writeLimit,
+		bool autoWrite, unsigned int maxLimit);
+	~ConcurrencyController();
+
+	ConcurrencyController(const ConcurrencyController&) = delete;
+	ConcurrencyController& operator=(const ConcurrencyController&) = delete;
+
+	bool isTuning() const	{return m_autoLimits[0] || m_autoLimits[1];}
+
+	void addFile()	{++m_files;}
+
+	void start();
+	void stop();
+
+	// Returns the limits that gave the best throughput.
+	Settings getBestSettings() const;
+
+private:
+	void run();
+	void update(double bytesPerSecond, double filesPerSecond);
+	bool increase(unsigned int index);
+	void decrease(unsigned int index, bool multiplicative);
+	void switchProbe();
+
+	ConcurrencyLimit* m_limits[2];
+	bool m_autoLimits[2];
+	unsigned int m_maxLimit;
+	std::atomic<std::uint64_t> m_files;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_stop;
+
+	unsigned int m_probeIndex;
+	bool m_increased;
+	double m_lastBytesPerSecond;
+	mutable std::mutex m_bestMutex;
+	Settings m_bestSettings;
+};
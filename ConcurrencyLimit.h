@@ -0,0 +1,71 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Limits the number of operations in flight at once, with a limit that may be changed at any
+// time. The number of bytes transferred by the operations is also tracked.
+class ConcurrencyLimit
+{
+public:
+	explicit ConcurrencyLimit(unsigned int limit)
+		: m_limit(std::max(limit, 1U)), m_active(0), m_bytes(0)
+	{
+	}
+
+	unsigned int getLimit() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_limit;
+	}
+
+	void setLimit(unsigned int limit)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_limit = std::max(limit, 1U);
+		m_condition.notify_all();
+	}
+
+	std::uint64_t getBytes() const	{return m_bytes;}
+
+	void acquire()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_condition.wait(lock, [this]() {return m_active < m_limit;});
+		++m_active;
+	}
+
+	void release(std::uint64_t bytes = 0)
+	{
+		m_bytes += bytes;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		--m_active;
+		m_condition.notify_one();
+	}
+
+private:
+	mutable std::mutex m_mutex;
+	std::condition_variable m_condition;
+	unsigned int m_limit;
+	unsigned int m_active;
+	std::atomic<std::uint64_t> m_bytes;
+};
@@ -0,0 +1,272 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DestinationIndex.h"
+
+#include "FileSystem.h"
+#include "Hash.h"
+#include "Helpers.h"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+const char* const DestinationIndex::cFileName = ".MusicSyncOwners";
+
+namespace
+{
+
+// Increment when the layout of the file changes so old files are ignored.
+const char* const cHeader = "#MusicSync owners 2";
+
+std::string addSuffix(const std::string& path, const std::string& suffix)
+{
+	std::size_t nameStart = path.find_last_of(Helpers::cPathSeparator);
+	nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+	std::size_t extension = path.find_last_of('.');
+	if (extension == std::string::npos || extension <= nameStart)
+		extension = path.size();
+
+	std::string result = path;
+	result.insert(extension, suffix);
+	return result;
+}
+
+// Replaces each directory in a path with the spelling from getSpelling, which is given the case
+// folded path of the directory and its spelling in the path.
+template <typename GetSpellingFunc>
+std::string spellDirectories(const std::string& path, GetSpellingFunc&& getSpelling)
+{
+	std::string finalPath;
+	std::size_t componentStart = 0;
+	do
+	{
+		std::size_t separator = path.find(Helpers::cPathSeparator, componentStart);
+		if (separator == std::string::npos)
+			break;
+
+		std::string directory = finalPath;
+		if (!directory.empty())
+			directory.push_back(Helpers::cPathSeparator);
+		directory.append(path, componentStart, separator - componentStart);
+		finalPath = getSpelling(Helpers::foldCase(directory), directory);
+		componentStart = separator + 1;
+	} while (true);
+
+	if (!finalPath.empty())
+		finalPath.push_back(Helpers::cPathSeparator);
+	finalPath.append(path, componentStart, std::string::npos);
+	return finalPath;
+}
+
+// Base the suffix on the source so it doesn't depend on the other songs.
+std::string getSuffix(const std::string& source)
+{
+	const std::size_t cHashLength = 8;
+	return "~" + Hash::hashString(source, Hash::Algorithm::Md5).substr(0, cHashLength);
+}
+
+} // namespace
+
+bool DestinationIndex::load(FileSystem& songDir)
+{
+	m_previousOwners.clear();
+	m_previousAliases.clear();
+	FileSystem::FileInfo info;
+	if (!songDir.getFileInfo(info, cFileName))
+		return true;
+
+	std::string contents;
+	if (!songDir.readFile(contents, cFileName))
+		return false;
+
+	// Each line is the hash of the source in hex followed by the case folded path, separated by a
+	// tab. Aliases start with '=' and have the path with its original spelling.
+	std::istringstream stream(contents);
+	std::string line;
+	if (!Helpers::readLine(line, stream) || line != cHeader)
+		return true;
+
+	while (Helpers::readLine(line, stream))
+	{
+		bool isAlias = !line.empty() && line.front() == '=';
+		std::size_t separator = line.find('\t');
+		if (separator != std::string::npos)
+		{
+			std::size_t hashStart = isAlias ? 1 : 0;
+			std::uint64_t source = std::strtoull(
+				line.substr(hashStart, separator - hashStart).c_str(), nullptr, 16);
+			if (isAlias)
+				m_previousAliases.emplace(source, line.substr(separator + 1));
+			else
+				m_previousOwners.emplace(line.substr(separator + 1), source);
+		}
+
+		if (stream.eof())
+			break;
+	}
+	return true;
+}
+
+bool DestinationIndex::save(FileSystem& songDir, bool keepPrevious) const
+{
+	std::unordered_map<std::string, std::uint64_t> owners = m_owners;
+	std::unordered_map<std::uint64_t, std::string> aliases = m_aliases;
+	if (keepPrevious)
+	{
+		owners.insert(m_previousOwners.begin(), m_previousOwners.end());
+		aliases.insert(m_previousAliases.begin(), m_previousAliases.end());
+	}
+
+	FileSystem::FileInfo info;
+	bool exists = songDir.getFileInfo(info, cFileName);
+	if (owners.empty() && aliases.empty())
+		return !exists || songDir.removeFile(cFileName);
+
+	// Sort so the file only changes when the owners do.
+	std::vector<std::pair<std::string, std::uint64_t>> sortedOwners(owners.begin(),
+		owners.end());
+	std::sort(sortedOwners.begin(), sortedOwners.end());
+	std::vector<std::pair<std::uint64_t, std::string>> sortedAliases(aliases.begin(),
+		aliases.end());
+	std::sort(sortedAliases.begin(), sortedAliases.end());
+
+	std::ostringstream stream;
+	stream << cHeader << '\n' << std::hex;
+	for (const auto& owner : sortedOwners)
+		stream << owner.second << '\t' << owner.first << '\n';
+	for (const auto& alias : sortedAliases)
+		stream << '=' << alias.first << '\t' << alias.second << '\n';
+
+	std::string contents = stream.str();
+	std::string previousContents;
+	if (exists && songDir.readFile(previousContents, cFileName) && previousContents == contents)
+		return true;
+	return songDir.replaceFile(cFileName, contents);
+}
+
+std::string DestinationIndex::add(bool& isNew, const std::string& source,
+	const std::string& path)
+{
+	// Use the first spelling for each directory.
+	std::string finalPath = spellDirectories(path,
+		[this](std::string foldedDirectory, const std::string& directory)
+		{
+			return m_directories.emplace(std::move(foldedDirectory), directory).first->second;
+		});
+
+	// Paths that collided are recorded along with the source that got them, so they keep the same
+	// owner in later syncs. A path that the source shared with an identical song may be taken over
+	// from that song's source.
+	std::uint64_t sourceHash = Helpers::hashString(source);
+	auto aliasIter = m_previousAliases.find(sourceHash);
+	bool isAlias = aliasIter != m_previousAliases.end() && aliasIter->second == path;
+	auto tryAdd = [this, &isNew, sourceHash, isAlias, &path](const std::string& candidate)
+	{
+		std::string foldedPath = Helpers::foldCase(candidate);
+		auto previousIter = m_previousOwners.find(foldedPath);
+		if (previousIter != m_previousOwners.end() && previousIter->second != sourceHash &&
+			!(isAlias && candidate == path))
+		{
+			return false;
+		}
+
+		auto inserted = m_files.emplace(Helpers::hashString(foldedPath), sourceHash);
+		isNew = inserted.second;
+		if (inserted.second || inserted.first->second == sourceHash)
+		{
+			if (previousIter != m_previousOwners.end())
+				m_owners[foldedPath] = sourceHash;
+			return true;
+		}
+
+		m_owners[foldedPath] = inserted.first->second;
+		return false;
+	};
+
+	if (tryAdd(finalPath))
+		return finalPath;
+
+	// Conflicting file.
+	std::string suffix = getSuffix(source);
+	std::string suffixedPath = addSuffix(finalPath, suffix);
+	for (unsigned int i = 2; !tryAdd(suffixedPath); ++i)
+		suffixedPath = addSuffix(finalPath, suffix + "-" + std::to_string(i));
+	m_owners[Helpers::foldCase(suffixedPath)] = sourceHash;
+	return suffixedPath;
+}
+
+std::string DestinationIndex::getPreviousPath(const std::string& source,
+	const std::string& path) const
+{
+	// Use the spelling of the directories that were already added by this sync.
+	std::string finalPath = spellDirectories(path,
+		[this](const std::string& foldedDirectory, const std::string& directory)
+		{
+			auto foundIter = m_directories.find(foldedDirectory);
+			return foundIter == m_directories.end() ? directory : foundIter->second;
+		});
+
+	// Every path that collided was stored with its owner, including the suffixed paths, so follow
+	// the same steps as when the path was added.
+	std::uint64_t sourceHash = Helpers::hashString(source);
+	auto isOwnedByOther = [this, sourceHash](const std::string& candidate)
+	{
+		auto foundIter = m_previousOwners.find(Helpers::foldCase(candidate));
+		return foundIter != m_previousOwners.end() && foundIter->second != sourceHash;
+	};
+
+	if (!isOwnedByOther(finalPath))
+		return finalPath;
+
+	std::string suffix = getSuffix(source);
+	std::string suffixedPath = addSuffix(finalPath, suffix);
+	for (unsigned int i = 2; isOwnedByOther(suffixedPath); ++i)
+		suffixedPath = addSuffix(finalPath, suffix + "-" + std::to_string(i));
+	return suffixedPath;
+}
+
+void DestinationIndex::addAlias(const std::string& source, const std::string& path)
+{
+	// Songs found again under the same source already own the path.
+	std::uint64_t sourceHash = Helpers::hashString(source);
+	auto foundIter = m_files.find(Helpers::hashString(Helpers::foldCase(path)));
+	if (foundIter == m_files.end() || foundIter->second != sourceHash)
+		m_aliases[sourceHash] = path;
+}
+
+bool DestinationIndex::findAlias(std::string& path, const std::string& source) const
+{
+	auto foundIter = m_previousAliases.find(Helpers::hashString(source));
+	if (foundIter == m_previousAliases.end())
+		return false;
+
+	path = foundIter->second;
+	return true;
+}
+
+bool DestinationIndex::contains(const std::string& path) const
+{
+	return m_files.find(Helpers::hashString(Helpers::foldCase(path))) != m_files.end();
+}
+
+void DestinationIndex::clear()
+{
+	m_directories.clear();
+	m_files.clear();
+	m_owners.clear();
+	m_aliases.clear();
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+class FileSystem;
+
+// Assigns destination paths to songs so that no two songs share a file on file systems that
+// ignore case, such as FAT and exFAT.
+//
+// Directories that only differ by case are merged to use the spelling of the first song that was
+// added. Files that would collide get a suffix based on a hash of the source path. Adding the same
+// song again gives the same result.
+//
+// The first song added for a path keeps it without a suffix, so which song gets the suffix depends
+// on the order they're added. To keep the paths stable when the order changes, such as with a
+// different playlist priority, the source that owns each path that collided is stored in a file in
+// the song directory. Paths that are owned by another source are skipped even if that source
+// hasn't been added yet. Since collisions are rare, only those paths are stored.
+//
+// Identical songs from different sources share the path of whichever was added first, which also
+// depends on the order. Sources that shared another song's path are stored in the same file so they
+// can use that path in the next sync even if they're added first.
+//
+// Files are only stored as 64-bit hashes to keep the memory use small for large libraries.
+class DestinationIndex
+{
+public:
+	// Name of the owners file relative to the song directory.
+	static const char* const cFileName;
+
+	// Loads the owners saved by the last sync.
+	bool load(FileSystem& songDir);
+	// Saves the owners of the paths that collided in this sync. When keepPrevious is true, such as
+	// when some playlists were skipped, the owners saved by the last sync are also kept.
+	bool save(FileSystem& songDir, bool keepPrevious) const;
+
+	// Returns the destination path to use in place of path for the song at source. isNew is set to
+	// false if the song was already added.
+	std::string add(bool& isNew, const std::string& source, const std::string& path);
+
+	// Gets the path that the last sync gave the song at source when its path was the given one,
+	// such as in the previous layout of the songs. This includes the suffix if the path collided.
+	std::string getPreviousPath(const std::string& source, const std::string& path) const;
+
+	// Records that the song at source is identical to the song at path, unless the source already
+	// owns the path.
+	void addAlias(const std::string& source, const std::string& path);
+	// Finds the path of the song that the song at source was identical to in the last sync.
+	bool findAlias(std::string& path, const std::string& source) const;
+
+	bool contains(const std::string& path) const;
+	void clear();
+
+private:
+	// Keyed by the case folded path, holding the chosen spelling.
+	std::unordered_map<std::string, std::string> m_directories;
+	// Hash of the case folded path to hash of the source that owns it.
+	std::unordered_map<std::uint64_t, std::uint64_t> m_files;
+	// Case folded paths that collided to the hash of the source that owns them, as loaded and as
+	// found by this sync.
+	std::unordered_map<std::string, std::uint64_t> m_previousOwners;
+	std::unordered_map<std::string, std::uint64_t> m_owners;
+	// Hash of the source to the path of the identical song, as loaded and as found by this sync.
+	std::unordered_map<std::uint64_t, std::string> m_previousAliases;
+	std::unordered_map<std::uint64_t, std::string> m_aliases;
+};
@@ -0,0 +1,946 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DirectoryCache.h"
+
+#include "Helpers.h"
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#if defined(_WIN32)
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#elif defined(__APPLE__)
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+#endif
+
+namespace
+{
+
+void splitPath(std::string& directory, std::string& name, const std::string& path)
+{
+	std::size_t separator = path.find_last_of(Helpers::cPathSeparator);
+	if (separator == std::string::npos)
+	{
+		directory.clear();
+		name = path;
+	}
+	else
+	{
+		directory = path.substr(0, separator);
+		name = path.substr(separator + 1);
+	}
+
+	// Ignore any leading or duplicate separators.
+	while (!directory.empty() && directory.back() == Helpers::cPathSeparator)
+		directory.pop_back();
+	while (!directory.empty() && directory.front() == Helpers::cPathSeparator)
+		directory.erase(directory.begin());
+}
+
+} // namespace
+
+#if defined(_WIN32)
+
+namespace
+{
+
+// Windows file times are in 100 ns units since 1601.
+const std::int64_t cUnixEpochOffset = 11644473600LL*1000000000LL;
+
+bool getPathInfo(FileSystem::FileInfo& info, const std::filesystem::path& path)
+{
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(path, error))
+		return false;
+
+	info.size = std::filesystem::file_size(path, error);
+	if (error)
+		return false;
+
+	auto fileTime = std::filesystem::last_write_time(path, error);
+	if (error)
+		return false;
+
+	info.modifiedTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		fileTime.time_since_epoch()).count() - cUnixEpochOffset;
+
+	// The volume serial number and file index identify the file through any links. Opening with
+	// no access rights only needs the file to exist, so failing to read it isn't an error.
+	info.device = 0;
+	info.fileId = 0;
+	HANDLE handle = CreateFileW(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE |
+		FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle != INVALID_HANDLE_VALUE)
+	{
+		BY_HANDLE_FILE_INFORMATION fileInfo;
+		if (GetFileInformationByHandle(handle, &fileInfo))
+		{
+			info.device = fileInfo.dwVolumeSerialNumber;
+			info.fileId = (std::uint64_t(fileInfo.nFileIndexHigh) << 32) | fileInfo.nFileIndexLow;
+		}
+		CloseHandle(handle);
+	}
+	return true;
+}
+
+class WindowsReadFile : public FileSystem::ReadFile
+{
+public:
+	WindowsReadFile(std::FILE* file, std::filesystem::path path)
+		: m_file(file), m_path(std::move(path))
+	{
+	}
+
+	~WindowsReadFile() override
+	{
+		std::fclose(m_file);
+	}
+
+	bool getInfo(FileSystem::FileInfo& info) override
+	{
+		return getPathInfo(info, m_path);
+	}
+
+	std::ptrdiff_t read(void* data, std::size_t size) override
+	{
+		std::size_t readSize = std::fread(data, 1, size, m_file);
+		if (readSize == 0 && std::ferror(m_file))
+			return -1;
+		return readSize;
+	}
+
+private:
+	std::FILE* m_file;
+	std::filesystem::path m_path;
+};
+
+class WindowsWriteFile : public FileSystem::WriteFile
+{
+public:
+	WindowsWriteFile(std::FILE* file, std::filesystem::path path)
+		: m_file(file), m_path(std::move(path)), m_setModifiedTime(false)
+	{
+	}
+
+	~WindowsWriteFile() override
+	{
+		if (m_file)
+			std::fclose(m_file);
+	}
+
+	bool write(const void* data, std::size_t size) override
+	{
+		return std::fwrite(data, 1, size, m_file) == size;
+	}
+
+	bool truncate(std::uint64_t size) override
+	{
+		std::error_code error;
+		if (std::fflush(m_file) != 0)
+			return false;
+		std::filesystem::resize_file(m_path, size, error);
+		return !error;
+	}
+
+	bool setModifiedTime(std::int64_t modifiedTime) override
+	{
+		// The time would be updated again when the file is closed, so set it after closing.
+		m_modifiedTime = std::filesystem::file_time_type(
+			std::chrono::duration_cast<std::filesystem::file_time_type::duration>(
+				std::chrono::nanoseconds(modifiedTime + cUnixEpochOffset)));
+		m_setModifiedTime = true;
+		return true;
+	}
+
+	bool close() override
+	{
+		bool success = std::fclose(m_file) == 0;
+		m_file = nullptr;
+		if (success && m_setModifiedTime)
+		{
+			std::error_code error;
+			std::filesystem::last_write_time(m_path, m_modifiedTime, error);
+			success = !error;
+		}
+		return success;
+	}
+
+private:
+	std::FILE* m_file;
+	std::filesystem::path m_path;
+	std::filesystem::file_time_type m_modifiedTime;
+	bool m_setModifiedTime;
+};
+
+} // namespace
+
+struct DirectoryCache::Directory
+{
+	explicit Directory(std::filesystem::path initPath)
+		: path(std::move(initPath)) {}
+
+	std::filesystem::path path;
+};
+
+DirectoryCache::DirectoryCache(const std::string& root, std::size_t maxOpenDirectories)
+	: m_root(root), m_maxOpenDirectories(std::max(maxOpenDirectories, std::size_t(1)))
+{
+	std::error_code error;
+	if (std::filesystem::is_directory(root, error))
+		m_rootDirectory = std::make_shared<Directory>(root);
+}
+
+DirectoryCache::~DirectoryCache() = default;
+
+bool DirectoryCache::getFileInfo(FileInfo& info, const std::string& relativePath)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativePath, false);
+	if (!directory)
+		return false;
+
+	return getPathInfo(info, directory->path/name);
+}
+
+bool DirectoryCache::listDirectory(std::vector<DirectoryEntry>& entries,
+	const std::string& relativeDir)
+{
+	DirectoryPtr directory = getDirectory(relativeDir, false);
+	if (!directory)
+		return false;
+
+	std::error_code error;
+	std::filesystem::directory_iterator iter(directory->path, error);
+	if (error)
+		return false;
+
+	entries.clear();
+	for (; iter != std::filesystem::directory_iterator(); iter.increment(error))
+	{
+		// Match recursive_directory_iterator: don't follow directory symlinks, but treat
+		// symlinks to regular files as files.
+		EntryType type;
+		if (iter->is_regular_file(error))
+			type = EntryType::File;
+		else if (iter->is_directory(error) && !iter->is_symlink(error))
+			type = EntryType::Directory;
+		else
+			type = EntryType::Other;
+		entries.push_back(DirectoryEntry{iter->path().filename().string(), type});
+	}
+	return !error;
+}
+
+bool DirectoryCache::removeFile(const std::string& relativePath)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativePath, false);
+	if (!directory)
+		return false;
+
+	std::error_code error;
+	return std::filesystem::remove(directory->path/name, error);
+}
+
+bool DirectoryCache::removeDirectory(const std::string& relativeDir)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativeDir, false);
+	if (!directory)
+		return false;
+
+	std::error_code error;
+	std::filesystem::path path = directory->path/name;
+	if (!std::filesystem::is_directory(path, error) || !std::filesystem::remove(path, error))
+		return false;
+
+	removeDirectories(relativeDir);
+	return true;
+}
+
+bool DirectoryCache::renameFile(const std::string& fromPath, const std::string& toPath)
+{
+	std::string fromName, toName;
+	DirectoryPtr fromDirectory = getParentDirectory(fromName, fromPath, false);
+	DirectoryPtr toDirectory = getParentDirectory(toName, toPath, false);
+	if (!fromDirectory || !toDirectory)
+		return false;
+
+	std::error_code error;
+	std::filesystem::rename(fromDirectory->path/fromName, toDirectory->path/toName, error);
+	return !error;
+}
+
+std::unique_ptr<FileSystem::ReadFile> DirectoryCache::openRead(const std::string& relativePath,
+	ReadMode)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativePath, false);
+	if (!directory)
+		return nullptr;
+
+	std::filesystem::path path = directory->path/name;
+	std::FILE* file = _wfopen(path.c_str(), L"rb");
+	if (!file)
+		return nullptr;
+	return std::unique_ptr<ReadFile>(new WindowsReadFile(file, std::move(path)));
+}
+
+std::unique_ptr<FileSystem::WriteFile> DirectoryCache::openWrite(const std::string& relativePath)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativePath, false);
+	if (!directory)
+		return nullptr;
+
+	std::filesystem::path path = directory->path/name;
+	std::FILE* file = _wfopen(path.c_str(), L"wb");
+	if (!file)
+		return nullptr;
+	return std::unique_ptr<WriteFile>(new WindowsWriteFile(file, std::move(path)));
+}
+
+FileSystem::FileSystemType DirectoryCache::getFileSystemType() const
+{
+	if (!m_rootDirectory)
+		return FileSystemType::Unknown;
+
+	std::error_code error;
+	std::wstring rootPath =
+		std::filesystem::absolute(m_rootDirectory->path, error).root_path().wstring();
+	wchar_t fileSystemName[MAX_PATH + 1];
+	if (!GetVolumeInformationW(rootPath.c_str(), nullptr, 0, nullptr, nullptr, nullptr,
+			fileSystemName, MAX_PATH + 1))
+	{
+		return FileSystemType::Unknown;
+	}
+
+	if (std::wcsncmp(fileSystemName, L"FAT", 3) == 0)
+		return FileSystemType::Fat;
+	else if (std::wcscmp(fileSystemName, L"exFAT") == 0)
+		return FileSystemType::ExFat;
+	return FileSystemType::Unknown;
+}
+
+bool DirectoryCache::getSpaceInfo(SpaceInfo& info) const
+{
+	if (!m_rootDirectory)
+		return false;
+
+	std::error_code error;
+	std::wstring rootPath =
+		std::filesystem::absolute(m_rootDirectory->path, error).root_path().wstring();
+	ULARGE_INTEGER availableBytes;
+	DWORD sectorsPerCluster, bytesPerSector, freeClusters, totalClusters;
+	if (!GetDiskFreeSpaceExW(m_rootDirectory->path.c_str(), &availableBytes, nullptr, nullptr) ||
+		!GetDiskFreeSpaceW(rootPath.c_str(), &sectorsPerCluster, &bytesPerSector, &freeClusters,
+			&totalClusters))
+	{
+		return false;
+	}
+
+	info.availableBytes = availableBytes.QuadPart;
+	info.blockSize = static_cast<std::uint64_t>(sectorsPerCluster)*bytesPerSector;
+	return true;
+}
+
+bool DirectoryCache::syncFileSystem()
+{
+	if (!m_rootDirectory)
+		return false;
+
+	// Flushing a volume requires administrator rights, so rely on the system to flush removable
+	// devices, which default to having write caching disabled.
+	return true;
+}
+
+DirectoryCache::DirectoryPtr DirectoryCache::getDirectory(const std::string& relativeDir,
+	bool create)
+{
+	if (relativeDir.empty() || !m_rootDirectory)
+		return m_rootDirectory;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto foundIter = m_directories.find(relativeDir);
+		if (foundIter != m_directories.end())
+		{
+			m_lru.splice(m_lru.begin(), m_lru, foundIter->second.lruIter);
+			return foundIter->second.directory;
+		}
+	}
+
+	std::string name;
+	DirectoryPtr parent = getParentDirectory(name, relativeDir, create);
+	if (!parent)
+		return nullptr;
+
+	std::error_code error;
+	std::filesystem::path path = parent->path/name;
+	if (!std::filesystem::is_directory(path, error))
+	{
+		if (!create || !std::filesystem::create_directory(path, error))
+			return nullptr;
+	}
+
+	DirectoryPtr directory = std::make_shared<Directory>(std::move(path));
+	addDirectory(relativeDir, directory);
+	return directory;
+}
+
+#else
+
+namespace
+{
+
+void getStatInfo(FileSystem::FileInfo& info, const struct stat& fileStat)
+{
+	info.size = fileStat.st_size;
+#if defined(__APPLE__)
+	const timespec& modifiedTime = fileStat.st_mtimespec;
+#else
+	const timespec& modifiedTime = fileStat.st_mtim;
+#endif
+	info.modifiedTime = std::int64_t(modifiedTime.tv_sec)*1000000000LL + modifiedTime.tv_nsec;
+	info.device = fileStat.st_dev;
+	info.fileId = fileStat.st_ino;
+}
+
+class PosixReadFile : public FileSystem::ReadFile
+{
+public:
+	explicit PosixReadFile(int fd)
+		: m_fd(fd)
+	{
+	}
+
+	~PosixReadFile() override
+	{
+		close(m_fd);
+	}
+
+	bool getInfo(FileSystem::FileInfo& info) override
+	{
+		struct stat fileStat;
+		if (fstat(m_fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+			return false;
+
+		getStatInfo(info, fileStat);
+		return true;
+	}
+
+	std::ptrdiff_t read(void* data, std::size_t size) override
+	{
+		ssize_t readSize;
+		do
+		{
+			readSize = ::read(m_fd, data, size);
+		} while (readSize < 0 && errno == EINTR);
+		return readSize;
+	}
+
+private:
+	int m_fd;
+};
+
+class PosixWriteFile : public FileSystem::WriteFile
+{
+public:
+	explicit PosixWriteFile(int fd)
+		: m_fd(fd), m_offset(0), m_writebackOffset(0)
+	{
+	}
+
+	~PosixWriteFile() override
+	{
+		if (m_fd >= 0)
+			::close(m_fd);
+	}
+
+	bool write(const void* data, std::size_t size) override
+	{
+		const char* bytes = reinterpret_cast<const char*>(data);
+		while (size > 0)
+		{
+			ssize_t writeSize = ::write(m_fd, bytes, size);
+			if (writeSize < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			bytes += writeSize;
+			size -= writeSize;
+			m_offset += writeSize;
+		}
+		return true;
+	}
+
+	bool truncate(std::uint64_t size) override
+	{
+		return ftruncate(m_fd, size) == 0;
+	}
+
+	bool setModifiedTime(std::int64_t modifiedTime) override
+	{
+		timespec times[2];
+		times[0].tv_sec = 0;
+		times[0].tv_nsec = UTIME_OMIT;
+		times[1].tv_sec = modifiedTime/1000000000LL;
+		times[1].tv_nsec = modifiedTime % 1000000000LL;
+		if (times[1].tv_nsec < 0)
+		{
+			--times[1].tv_sec;
+			times[1].tv_nsec += 1000000000LL;
+		}
+		return futimens(m_fd, times) == 0;
+	}
+
+	bool close() override
+	{
+		bool success = ::close(m_fd) == 0;
+		m_fd = -1;
+		return success;
+	}
+
+	void preallocate(std::uint64_t size) override
+	{
+		// This is only an optimization, so errors are ignored. Keep the size so a failed copy
+		// doesn't leave zeros at the end of the file, and so the file can be truncated if the
+		// source shrinks.
+#if defined(__linux__)
+		fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, size);
+#elif defined(__APPLE__)
+		fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, off_t(size), 0};
+		if (fcntl(m_fd, F_PREALLOCATE, &store) == -1)
+		{
+			store.fst_flags = F_ALLOCATEALL;
+			fcntl(m_fd, F_PREALLOCATE, &store);
+		}
+#else
+		(void)size;
+#endif
+	}
+
+	void startWriteback() override
+	{
+		// This is only a hint, so errors are ignored.
+#if defined(__linux__)
+		sync_file_range(m_fd, m_writebackOffset, m_offset - m_writebackOffset,
+			SYNC_FILE_RANGE_WRITE);
+#endif
+		m_writebackOffset = m_offset;
+	}
+
+private:
+	int m_fd;
+	off_t m_offset;
+	off_t m_writebackOffset;
+};
+
+} // namespace
+
+struct DirectoryCache::Directory
+{
+	explicit Directory(int initFd)
+		: fd(initFd) {}
+	~Directory()
+	{
+		close(fd);
+	}
+
+	int fd;
+};
+
+DirectoryCache::DirectoryCache(const std::string& root, std::size_t maxOpenDirectories)
+	: m_root(root), m_maxOpenDirectories(std::max(maxOpenDirectories, std::size_t(1)))
+{
+	int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd >= 0)
+		m_rootDirectory = std::make_shared<Directory>(fd);
+}
+
+DirectoryCache::~DirectoryCache() = default;
+
+bool DirectoryCache::getFileInfo(FileInfo& info, const std::string& relativePath)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativePath, false);
+	if (!directory)
+		return false;
+
+	struct stat fileStat;
+	if (fstatat(directory->fd, name.c_str(), &fileStat, 0) != 0 || !S_ISREG(fileStat.st_mode))
+		return false;
+
+	getStatInfo(info, fileStat);
+	return true;
+}
+
+bool DirectoryCache::listDirectory(std::vector<DirectoryEntry>& entries,
+	const std::string& relativeDir)
+{
+	DirectoryPtr directory = getDirectory(relativeDir, false);
+	if (!directory)
+		return false;
+
+	// Re-open the directory rather than duplicating the handle, since duplicates share the read
+	// position with the cached handle.
+	int fd = openat(directory->fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	DIR* dir = fdopendir(fd);
+	if (!dir)
+	{
+		close(fd);
+		return false;
+	}
+
+	entries.clear();
+	while (const dirent* entry = readdir(dir))
+	{
+		const char* name = entry->d_name;
+		if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0)
+			continue;
+
+		// Match recursive_directory_iterator: don't follow directory symlinks, but treat
+		// symlinks to regular files as files.
+		unsigned char type = entry->d_type;
+		struct stat info;
+		if (type == DT_UNKNOWN)
+		{
+			if (fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+				type = DT_UNKNOWN;
+			else if (S_ISDIR(info.st_mode))
+				type = DT_DIR;
+			else if (S_ISLNK(info.st_mode))
+				type = DT_LNK;
+			else if (S_ISREG(info.st_mode))
+				type = DT_REG;
+		}
+		if (type == DT_LNK)
+		{
+			if (fstatat(fd, name, &info, 0) == 0 && S_ISREG(info.st_mode))
+				type = DT_REG;
+		}
+
+		EntryType entryType;
+		if (type == DT_REG)
+			entryType = EntryType::File;
+		else if (type == DT_DIR)
+			entryType = EntryType::Directory;
+		else
+			entryType = EntryType::Other;
+		entries.push_back(DirectoryEntry{name, entryType});
+	}
+
+	closedir(dir);
+	return true;
+}
+
+bool DirectoryCache::removeFile(const std::string& relativePath)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativePath, false);
+	if (!directory)
+		return false;
+
+	return unlinkat(directory->fd, name.c_str(), 0) == 0;
+}
+
+bool DirectoryCache::removeDirectory(const std::string& relativeDir)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativeDir, false);
+	if (!directory || unlinkat(directory->fd, name.c_str(), AT_REMOVEDIR) != 0)
+		return false;
+
+	removeDirectories(relativeDir);
+	return true;
+}
+
+bool DirectoryCache::renameFile(const std::string& fromPath, const std::string& toPath)
+{
+	std::string fromName, toName;
+	DirectoryPtr fromDirectory = getParentDirectory(fromName, fromPath, false);
+	DirectoryPtr toDirectory = getParentDirectory(toName, toPath, false);
+	if (!fromDirectory || !toDirectory)
+		return false;
+
+	return renameat(fromDirectory->fd, fromName.c_str(), toDirectory->fd, toName.c_str()) == 0;
+}
+
+std::unique_ptr<FileSystem::ReadFile> DirectoryCache::openRead(const std::string& relativePath,
+	ReadMode mode)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativePath, false);
+	if (!directory)
+		return nullptr;
+
+	int fd = openat(directory->fd, name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+
+	switch (mode)
+	{
+		case ReadMode::Normal:
+			break;
+		case ReadMode::Sequential:
+#if defined(__linux__)
+			posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+			break;
+		case ReadMode::FromDevice:
+			// Dirty pages can't be dropped, so they need to be written first.
+#if defined(__linux__)
+			fdatasync(fd);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#elif defined(__APPLE__)
+			fsync(fd);
+			fcntl(fd, F_NOCACHE, 1);
+#endif
+			break;
+	}
+
+	return std::unique_ptr<ReadFile>(new PosixReadFile(fd));
+}
+
+std::unique_ptr<FileSystem::WriteFile> DirectoryCache::openWrite(const std::string& relativePath)
+{
+	std::string name;
+	DirectoryPtr directory = getParentDirectory(name, relativePath, false);
+	if (!directory)
+		return nullptr;
+
+	int fd = openat(directory->fd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+		return nullptr;
+	return std::unique_ptr<WriteFile>(new PosixWriteFile(fd));
+}
+
+FileSystem::FileSystemType DirectoryCache::getFileSystemType() const
+{
+	if (!m_rootDirectory)
+		return FileSystemType::Unknown;
+
+	struct statfs fileSystemStat;
+	if (fstatfs(m_rootDirectory->fd, &fileSystemStat) != 0)
+		return FileSystemType::Unknown;
+
+#if defined(__linux__)
+	const long cMsdosMagic = 0x4D44;
+	const long cExFatMagic = 0x2011BAB0;
+	const long cFuseMagic = 0x65735546;
+	switch (fileSystemStat.f_type)
+	{
+		case cMsdosMagic:
+			return FileSystemType::Fat;
+		case cExFatMagic:
+			return FileSystemType::ExFat;
+		case cFuseMagic:
+			return FileSystemType::Fuse;
+		default:
+			return FileSystemType::Unknown;
+	}
+#elif defined(__APPLE__)
+	if (std::strcmp(fileSystemStat.f_fstypename, "msdos") == 0)
+		return FileSystemType::Fat;
+	else if (std::strcmp(fileSystemStat.f_fstypename, "exfat") == 0)
+		return FileSystemType::ExFat;
+	else if (std::strncmp(fileSystemStat.f_fstypename, "fuse", 4) == 0 ||
+		std::strncmp(fileSystemStat.f_fstypename, "osxfuse", 7) == 0 ||
+		std::strncmp(fileSystemStat.f_fstypename, "macfuse", 7) == 0)
+	{
+		return FileSystemType::Fuse;
+	}
+	return FileSystemType::Unknown;
+#else
+	return FileSystemType::Unknown;
+#endif
+}
+
+bool DirectoryCache::getSpaceInfo(SpaceInfo& info) const
+{
+	if (!m_rootDirectory)
+		return false;
+
+	struct statvfs fileSystemStat;
+	if (fstatvfs(m_rootDirectory->fd, &fileSystemStat) != 0)
+		return false;
+
+	std::uint64_t blockSize = fileSystemStat.f_frsize ? fileSystemStat.f_frsize :
+		fileSystemStat.f_bsize;
+	info.availableBytes = static_cast<std::uint64_t>(fileSystemStat.f_bavail)*blockSize;
+	info.blockSize = blockSize;
+	return true;
+}
+
+bool DirectoryCache::syncFileSystem()
+{
+	if (!m_rootDirectory)
+		return false;
+
+#if defined(__linux__)
+	return syncfs(m_rootDirectory->fd) == 0;
+#elif defined(__APPLE__)
+	// F_FULLFSYNC flushes the drive's cache for the whole device, not just the file.
+	sync();
+	return fcntl(m_rootDirectory->fd, F_FULLFSYNC) != -1 || fsync(m_rootDirectory->fd) == 0;
+#else
+	sync();
+	return true;
+#endif
+}
+
+DirectoryCache::DirectoryPtr DirectoryCache::getDirectory(const std::string& relativeDir,
+	bool create)
+{
+	if (relativeDir.empty() || !m_rootDirectory)
+		return m_rootDirectory;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto foundIter = m_directories.find(relativeDir);
+		if (foundIter != m_directories.end())
+		{
+			m_lru.splice(m_lru.begin(), m_lru, foundIter->second.lruIter);
+			return foundIter->second.directory;
+		}
+	}
+
+	// Open relative to the parent so only a single path component is resolved. This also caches
+	// the parent for the next sibling.
+	std::string name;
+	DirectoryPtr parent = getParentDirectory(name, relativeDir, create);
+	if (!parent)
+		return nullptr;
+
+	const int cOpenFlags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+	int fd = openat(parent->fd, name.c_str(), cOpenFlags);
+	if (fd < 0)
+	{
+		if (errno != ENOENT || !create)
+			return nullptr;
+
+		if (mkdirat(parent->fd, name.c_str(), 0777) != 0 && errno != EEXIST)
+			return nullptr;
+
+		fd = openat(parent->fd, name.c_str(), cOpenFlags);
+		if (fd < 0)
+			return nullptr;
+	}
+
+	DirectoryPtr directory = std::make_shared<Directory>(fd);
+	addDirectory(relativeDir, directory);
+	return directory;
+}
+
+#endif
+
+FileSystem::Opener DirectoryCache::getOpener()
+{
+	return [](const std::string& root, bool create) -> std::unique_ptr<FileSystem>
+	{
+		if (create)
+		{
+			std::error_code error;
+			std::filesystem::create_directories(root, error);
+		}
+
+		std::unique_ptr<DirectoryCache> directory(new DirectoryCache(root));
+		if (!directory->isOpen())
+			return nullptr;
+		return directory;
+	};
+}
+
+bool DirectoryCache::isOpen() const
+{
+	return m_rootDirectory != nullptr;
+}
+
+bool DirectoryCache::createParentDirectories(const std::string& relativePath)
+{
+	std::string name;
+	return getParentDirectory(name, relativePath, true) != nullptr;
+}
+
+DirectoryCache::DirectoryPtr DirectoryCache::getParentDirectory(std::string& name,
+	const std::string& relativePath, bool create)
+{
+	std::string relativeDir;
+	splitPath(relativeDir, name, relativePath);
+	return getDirectory(relativeDir, create);
+}
+
+void DirectoryCache::addDirectory(const std::string& relativeDir, const DirectoryPtr& directory)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_directories.find(relativeDir) != m_directories.end())
+		return;
+
+	// Handles that are evicted stay open until any thread currently using them is done.
+	while (m_directories.size() >= m_maxOpenDirectories)
+	{
+		assert(!m_lru.empty());
+		m_directories.erase(m_lru.back());
+		m_lru.pop_back();
+	}
+
+	m_lru.push_front(relativeDir);
+	m_directories.emplace(relativeDir, CacheEntry{directory, m_lru.begin()});
+}
+
+void DirectoryCache::removeDirectories(const std::string& relativeDir)
+{
+	// Forget the directory and everything under it so a directory created later with the same
+	// name isn't accessed through a stale handle.
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto iter = m_directories.begin(); iter != m_directories.end();)
+	{
+		const std::string& path = iter->first;
+		if (path.compare(0, relativeDir.size(), relativeDir) == 0 &&
+			(path.size() == relativeDir.size() ||
+				path[relativeDir.size()] == Helpers::cPathSeparator))
+		{
+			m_lru.erase(iter->second.lruIter);
+			iter = m_directories.erase(iter);
+		}
+		else
+			++iter;
+	}
+}
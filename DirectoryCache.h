@@ -0,0 +1,93 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "FileSystem.h"
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// File system that performs operations on the real file system relative to a root directory,
+// keeping handles to recently used directories open.
+//
+// Operations are performed relative to the handle of the file's parent directory, so the kernel
+// only needs to resolve the final path component rather than the full path from the root.
+// Directories that are known to exist are never checked or created again.
+class DirectoryCache : public FileSystem
+{
+public:
+	static const std::size_t cDefaultMaxOpenDirectories = 64;
+
+	explicit DirectoryCache(const std::string& root,
+		std::size_t maxOpenDirectories = cDefaultMaxOpenDirectories);
+	~DirectoryCache() override;
+
+	DirectoryCache(const DirectoryCache&) = delete;
+	DirectoryCache& operator=(const DirectoryCache&) = delete;
+
+	// Opens directories on the real file system.
+	static Opener getOpener();
+
+	bool isOpen() const;
+
+	const std::string& getRoot() const override	{return m_root;}
+	FileSystemType getFileSystemType() const override;
+	bool getSpaceInfo(SpaceInfo& info) const override;
+
+	bool getFileInfo(FileInfo& info, const std::string& relativePath) override;
+	bool listDirectory(std::vector<DirectoryEntry>& entries,
+		const std::string& relativeDir) override;
+	bool createParentDirectories(const std::string& relativePath) override;
+	bool removeFile(const std::string& relativePath) override;
+	bool removeDirectory(const std::string& relativeDir) override;
+	bool renameFile(const std::string& fromPath, const std::string& toPath) override;
+
+	std::unique_ptr<ReadFile> openRead(const std::string& relativePath,
+		ReadMode mode = ReadMode::Normal) override;
+	std::unique_ptr<WriteFile> openWrite(const std::string& relativePath) override;
+
+	// Waits for all data written to the file system containing the root to reach the device.
+	bool syncFileSystem() override;
+
+private:
+	struct Directory;
+	using DirectoryPtr = std::shared_ptr<Directory>;
+	using LruList = std::list<std::string>;
+
+	struct CacheEntry
+	{
+		DirectoryPtr directory;
+		LruList::iterator lruIter;
+	};
+
+	DirectoryPtr getDirectory(const std::string& relativeDir, bool create);
+	DirectoryPtr getParentDirectory(std::string& name, const std::string& relativePath,
+		bool create);
+	void addDirectory(const std::string& relativeDir, const DirectoryPtr& directory);
+	void removeDirectories(const std::string& relativeDir);
+
+	std::string m_root;
+	std::size_t m_maxOpenDirectories;
+	DirectoryPtr m_rootDirectory;
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, CacheEntry> m_directories;
+	LruList m_lru;
+};
@@ -0,0 +1,268 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DirectoryWalker.h"
+
+#include "FileSystem.h"
+#include "Helpers.h"
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+class WorkQueues
+{
+public:
+	explicit WorkQueues(unsigned int count)
+		: m_queues(count), m_queued(0), m_pending(0)
+	{
+	}
+
+	void push(unsigned int index, std::string directory)
+	{
+		++m_pending;
+		{
+			std::lock_guard<std::mutex> lock(m_queues[index].mutex);
+			m_queues[index].directories.push_back(std::move(directory));
+		}
+		++m_queued;
+
+		std::lock_guard<std::mutex> lock(m_waitMutex);
+		m_condition.notify_one();
+	}
+
+	bool pop(unsigned int index, std::string& directory)
+	{
+		do
+		{
+			if (tryPop(index, directory))
+				return true;
+
+			std::unique_lock<std::mutex> lock(m_waitMutex);
+			m_condition.wait(lock, [this]() {return m_queued > 0 || m_pending == 0;});
+			if (m_pending == 0)
+				return false;
+		} while (true);
+	}
+
+	// Called once a popped directory has been fully processed, including pushing its children.
+	void finish()
+	{
+		if (--m_pending == 0)
+		{
+			std::lock_guard<std::mutex> lock(m_waitMutex);
+			m_condition.notify_all();
+		}
+	}
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<std::string> directories;
+	};
+
+	bool tryPop(unsigned int index, std::string& directory)
+	{
+		// Take the most recent directory from our own queue to go depth-first, then fall back to
+		// stealing the oldest directory from the other queues, which is likely the biggest subtree.
+		{
+			Queue& queue = m_queues[index];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.directories.empty())
+			{
+				directory = std::move(queue.directories.back());
+				queue.directories.pop_back();
+				--m_queued;
+				return true;
+			}
+		}
+
+		for (std::size_t i = 1; i < m_queues.size(); ++i)
+		{
+			Queue& queue = m_queues[(index + i) % m_queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.directories.empty())
+			{
+				directory = std::move(queue.directories.front());
+				queue.directories.pop_front();
+				--m_queued;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	std::vector<Queue> m_queues;
+	std::atomic<std::size_t> m_queued;
+	std::atomic<std::size_t> m_pending;
+	std::mutex m_waitMutex;
+	std::condition_variable m_condition;
+};
+
+struct ThreadState
+{
+	DirectoryWalker::Result result;
+	std::vector<std::string> emptyDirectories;
+};
+
+std::string joinPath(const std::string& directory, const char* name)
+{
+	if (directory.empty())
+		return name;
+
+	std::string path = directory;
+	path.push_back(Helpers::cPathSeparator);
+	path += name;
+	return path;
+}
+
+std::size_t getDepth(const std::string& path)
+{
+	return std::count(path.begin(), path.end(), Helpers::cPathSeparator);
+}
+
+bool scanDirectory(ThreadState& state, WorkQueues& queues, unsigned int index,
+	FileSystem& fileSystem, const std::string& directory,
+	const DirectoryWalker::KeepFunction& keep)
+{
+	std::vector<FileSystem::DirectoryEntry> entries;
+	if (!fileSystem.listDirectory(entries, directory))
+		return false;
+
+	bool hasEntries = false;
+	std::vector<std::string> removePaths;
+	for (const FileSystem::DirectoryEntry& entry : entries)
+	{
+		if (entry.type == FileSystem::EntryType::Directory)
+		{
+			queues.push(index, joinPath(directory, entry.name.c_str()));
+			continue;
+		}
+		else if (entry.type != FileSystem::EntryType::File)
+		{
+			hasEntries = true;
+			continue;
+		}
+
+		++state.result.filesScanned;
+		std::string path = joinPath(directory, entry.name.c_str());
+		if (keep(path))
+			hasEntries = true;
+		else
+			removePaths.push_back(std::move(path));
+	}
+
+	for (const std::string& path : removePaths)
+	{
+		if (fileSystem.removeFile(path))
+			++state.result.filesRemoved;
+		else
+		{
+			Log::error("Error: Couldn't remove file '%s'.\n",
+				fileSystem.getPath(path).c_str());
+			++state.result.errors;
+			hasEntries = true;
+		}
+	}
+
+	if (!hasEntries && !directory.empty())
+		state.emptyDirectories.push_back(directory);
+	return true;
+}
+
+} // namespace
+
+DirectoryWalker::DirectoryWalker(unsigned int threadCount)
+	: m_threadCount(std::max(threadCount, 1U))
+{
+}
+
+bool DirectoryWalker::removeFiles(Result& result, FileSystem& fileSystem,
+	const KeepFunction& keep) const
+{
+	result = Result();
+
+	WorkQueues queues(m_threadCount);
+	std::vector<ThreadState> threadStates(m_threadCount);
+	queues.push(0, std::string());
+
+	auto threadFunc = [&](unsigned int index)
+	{
+		ThreadState& state = threadStates[index];
+		std::string directory;
+		while (queues.pop(index, directory))
+		{
+			if (!scanDirectory(state, queues, index, fileSystem, directory, keep))
+			{
+				Log::error("Error: Couldn't read directory '%s'.\n",
+					fileSystem.getPath(directory).c_str());
+				++state.result.errors;
+			}
+			queues.finish();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < m_threadCount; ++i)
+		threads.emplace_back(threadFunc, i);
+	threadFunc(0);
+	for (std::thread& thread : threads)
+		thread.join();
+
+	// Directories that only contained other directories may become empty once their children are
+	// removed, so remove the deepest directories first. Directories that still have contents will
+	// simply fail to be removed.
+	for (ThreadState& state : threadStates)
+	{
+		result.filesScanned += state.result.filesScanned;
+		result.filesRemoved += state.result.filesRemoved;
+		result.errors += state.result.errors;
+		result.emptyDirectories.insert(result.emptyDirectories.end(),
+			state.emptyDirectories.begin(), state.emptyDirectories.end());
+	}
+
+	std::sort(result.emptyDirectories.begin(), result.emptyDirectories.end(),
+		[](const std::string& left, const std::string& right)
+		{
+			return getDepth(left) > getDepth(right);
+		});
+
+	return result.errors == 0;
+}
+
+void DirectoryWalker::removeEmptyDirectories(Result& result, FileSystem& fileSystem)
+{
+	for (const std::string& directory : result.emptyDirectories)
+	{
+		if (fileSystem.removeDirectory(directory))
+		{
+			Log::verbose("Removing empty directory '%s'.\n", directory.c_str());
+			++result.directoriesRemoved;
+		}
+	}
+
+	result.emptyDirectories.clear();
+}
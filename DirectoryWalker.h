@@ -0,0 +1,62 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+class FileSystem;
+
+// Walks a directory tree with multiple threads, removing the files that are rejected by a filter.
+//
+// Each thread owns a queue of directories to scan. Subdirectories are pushed to the back of the
+// queue for the thread that found them, and idle threads steal from the front of other threads'
+// queues. This keeps all threads busy when the tree is unbalanced, which matters for targets where
+// every directory read is a round trip. (e.g. network mounts)
+//
+// Files are removed in batches once each directory has been read. Directories that are left empty
+// are collected so they can be removed once nothing else may add to them.
+class DirectoryWalker
+{
+public:
+	struct Result
+	{
+		std::size_t filesScanned = 0;
+		std::size_t filesRemoved = 0;
+		std::size_t directoriesRemoved = 0;
+		std::size_t errors = 0;
+		// Directories that were left empty, with the deepest directories first.
+		std::vector<std::string> emptyDirectories;
+	};
+
+	// Returns true to keep the file. The path is relative to the root with '/' separators. This
+	// will be called concurrently from multiple threads.
+	using KeepFunction = std::function<bool(const std::string& relativePath)>;
+
+	explicit DirectoryWalker(unsigned int threadCount);
+
+	bool removeFiles(Result& result, FileSystem& fileSystem, const KeepFunction& keep) const;
+
+	// Removes the empty directories found by removeFiles(). Directories that have since had files
+	// added to them are kept.
+	static void removeEmptyDirectories(Result& result, FileSystem& fileSystem);
+
+private:
+	unsigned int m_threadCount;
+};
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ExternalSorter.h"
+
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <system_error>
+
+namespace
+{
+
+std::string getRunPath()
+{
+	static std::atomic<unsigned int> runIndex(0);
+	static const unsigned int processId = std::random_device()();
+
+	std::error_code error;
+	std::filesystem::path path = std::filesystem::temp_directory_path(error);
+	path /= "MusicSync-" + std::to_string(processId) + "-" + std::to_string(runIndex++) + ".run";
+	return path.string();
+}
+
+std::size_t getMemoryUsage(const std::string& value)
+{
+	return sizeof(std::string) + value.capacity();
+}
+
+} // namespace
+
+ExternalSorter::ExternalSorter(std::size_t memoryLimit)
+	: m_memoryLimit(memoryLimit), m_memoryUsed(0), m_nextValue(0), m_hasLastValue(false),
+	m_error(false)
+{
+}
+
+ExternalSorter::~ExternalSorter()
+{
+	for (const std::unique_ptr<Run>& run : m_runs)
+	{
+		run->stream.close();
+		std::error_code error;
+		std::filesystem::remove(run->path, error);
+	}
+}
+
+bool ExternalSorter::add(std::string value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_error)
+		return false;
+
+	m_memoryUsed += getMemoryUsage(value);
+	m_values.push_back(std::move(value));
+	if (m_memoryUsed > m_memoryLimit)
+		return spill();
+	return true;
+}
+
+bool ExternalSorter::finish()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_error)
+		return false;
+
+	// Keep the final values in memory if nothing else was spilled.
+	if (m_runs.empty())
+	{
+		std::sort(m_values.begin(), m_values.end());
+		return true;
+	}
+
+	if (!m_values.empty() && !spill())
+		return false;
+
+	auto compare = [this](std::size_t left, std::size_t right)
+	{
+		return m_runs[left]->current > m_runs[right]->current;
+	};
+	for (std::size_t i = 0; i < m_runs.size(); ++i)
+	{
+		Run& run = *m_runs[i];
+		run.stream.open(run.path, std::ios::binary);
+		if (!run.stream)
+		{
+			Log::error("Error: Couldn't read temporary file '%s'.\n", run.path.c_str());
+			m_error = true;
+			return false;
+		}
+
+		if (readRecord(run.stream, run.current))
+			m_heap.push_back(i);
+	}
+	std::make_heap(m_heap.begin(), m_heap.end(), compare);
+	return true;
+}
+
+bool ExternalSorter::next(std::string& value)
+{
+	do
+	{
+		if (m_error)
+			return false;
+
+		if (m_runs.empty())
+		{
+			if (m_nextValue >= m_values.size())
+				return false;
+			value = std::move(m_values[m_nextValue++]);
+		}
+		else
+		{
+			if (m_heap.empty())
+				return false;
+
+			auto compare = [this](std::size_t left, std::size_t right)
+			{
+				return m_runs[left]->current > m_runs[right]->current;
+			};
+			std::pop_heap(m_heap.begin(), m_heap.end(), compare);
+			Run& run = *m_runs[m_heap.back()];
+			value = run.current;
+			if (readRecord(run.stream, run.current))
+				std::push_heap(m_heap.begin(), m_heap.end(), compare);
+			else
+			{
+				if (!run.stream.eof())
+					m_error = true;
+				m_heap.pop_back();
+			}
+		}
+
+		if (!m_hasLastValue || value != m_lastValue)
+		{
+			m_lastValue = value;
+			m_hasLastValue = true;
+			return true;
+		}
+	} while (true);
+}
+
+bool ExternalSorter::spill()
+{
+	std::sort(m_values.begin(), m_values.end());
+
+	std::unique_ptr<Run> run(new Run);
+	run->path = getRunPath();
+	std::ofstream stream(run->path, std::ios::binary);
+	for (std::size_t i = 0; i < m_values.size(); ++i)
+	{
+		const std::string& value = m_values[i];
+		if (i > 0 && value == m_values[i - 1])
+			continue;
+
+		std::uint32_t length = static_cast<std::uint32_t>(value.size());
+		stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		stream.write(value.data(), value.size());
+	}
+	stream.close();
+
+	m_runs.push_back(std::move(run));
+	if (!stream)
+	{
+		Log::error("Error: Couldn't write temporary file '%s'.\n",
+			m_runs.back()->path.c_str());
+		m_error = true;
+		return false;
+	}
+
+	m_values.clear();
+	m_values.shrink_to_fit();
+	m_memoryUsed = 0;
+	return true;
+}
+
+bool ExternalSorter::readRecord(std::ifstream& stream, std::string& value)
+{
+	std::uint32_t length;
+	if (!stream.read(reinterpret_cast<char*>(&length), sizeof(length)))
+		return false;
+
+	value.resize(length);
+	return static_cast<bool>(stream.read(&value[0], length));
+}
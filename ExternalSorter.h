@@ -0,0 +1,74 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Sorts strings with a bounded amount of memory.
+//
+// Strings are buffered in memory until the memory limit is reached, at which point they are sorted
+// and spilled to a run file in the temporary directory. Once all strings are added, the runs are
+// merged to read back the strings in sorted order with duplicates removed.
+//
+// Adding strings is thread-safe, while reading them back must be done from a single thread.
+class ExternalSorter
+{
+public:
+	explicit ExternalSorter(std::size_t memoryLimit);
+	~ExternalSorter();
+
+	ExternalSorter(const ExternalSorter&) = delete;
+	ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+	bool add(std::string value);
+
+	// Finishes adding strings and prepares for reading them back.
+	bool finish();
+
+	// Gets the next string in sorted order, returning false once all strings are read or on error.
+	bool next(std::string& value);
+
+	bool hasError() const	{return m_error;}
+
+private:
+	struct Run
+	{
+		std::string path;
+		std::ifstream stream;
+		std::string current;
+	};
+
+	bool spill();
+	static bool readRecord(std::ifstream& stream, std::string& value);
+
+	std::size_t m_memoryLimit;
+	std::size_t m_memoryUsed;
+	std::vector<std::string> m_values;
+	std::mutex m_mutex;
+
+	std::vector<std::unique_ptr<Run>> m_runs;
+	std::vector<std::size_t> m_heap;
+	std::size_t m_nextValue;
+	std::string m_lastValue;
+	bool m_hasLastValue;
+	bool m_error;
+};
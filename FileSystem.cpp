@@ -0,0 +1,279 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FileSystem.h"
+
+#include "ConcurrencyLimit.h"
+#include "Helpers.h"
+#include "MetadataStripper.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+const std::size_t cReadBufferSize = 1024*1024;
+const char* const cTempExtension = ".tmp";
+
+std::ptrdiff_t readChunk(FileSystem::ReadFile& file, char* data, std::size_t size,
+	ConcurrencyLimit* limit)
+{
+	if (limit)
+		limit->acquire();
+	std::ptrdiff_t readSize = file.read(data, size);
+	if (limit)
+		limit->release(std::max(readSize, std::ptrdiff_t(0)));
+	return readSize;
+}
+
+// Reads until the buffer is full or the end of the file is reached so writes stay aligned.
+std::ptrdiff_t readFullChunk(FileSystem::ReadFile& file, char* data, std::size_t size,
+	ConcurrencyLimit* limit)
+{
+	std::size_t totalSize = 0;
+	while (totalSize < size)
+	{
+		std::ptrdiff_t readSize = readChunk(file, data + totalSize, size - totalSize, limit);
+		if (readSize < 0)
+			return readSize;
+		else if (readSize == 0)
+			break;
+		totalSize += readSize;
+	}
+	return totalSize;
+}
+
+bool writeChunk(FileSystem::WriteFile& file, const char* data, std::size_t size,
+	ConcurrencyLimit* limit)
+{
+	if (limit)
+		limit->acquire();
+	bool success = file.write(data, size);
+	if (limit)
+		limit->release(success ? size : 0);
+	return success;
+}
+
+// Reads a file for Hash::hashStreams().
+class HashStream : public Hash::Stream
+{
+public:
+	HashStream(std::unique_ptr<FileSystem::ReadFile> file, ConcurrencyLimit* limit)
+		: m_file(std::move(file)), m_limit(limit)
+	{
+	}
+
+	std::ptrdiff_t read(void* data, std::size_t size) override
+	{
+		return readChunk(*m_file, reinterpret_cast<char*>(data), size, m_limit);
+	}
+
+private:
+	std::unique_ptr<FileSystem::ReadFile> m_file;
+	ConcurrencyLimit* m_limit;
+};
+
+} // namespace
+
+std::string FileSystem::getPath(const std::string& relativePath) const
+{
+	const std::string& root = getRoot();
+	if (relativePath.empty())
+		return root;
+	else if (!root.empty() && root.back() == Helpers::cPathSeparator)
+		return root + relativePath;
+	return root + Helpers::cPathSeparator + relativePath;
+}
+
+bool FileSystem::readFile(std::string& contents, const std::string& relativePath)
+{
+	std::unique_ptr<ReadFile> file = openRead(relativePath, ReadMode::Sequential);
+	if (!file)
+		return false;
+
+	contents.clear();
+	std::vector<char> buffer(cReadBufferSize);
+	std::ptrdiff_t readSize;
+	while ((readSize = file->read(buffer.data(), buffer.size())) > 0)
+		contents.append(buffer.data(), readSize);
+	return readSize == 0;
+}
+
+bool FileSystem::replaceFile(const std::string& relativePath, const std::string& contents)
+{
+	std::string tempPath = getTempPath(relativePath);
+	std::unique_ptr<WriteFile> file = openWrite(tempPath);
+	if (!file)
+		return false;
+
+	bool success = file->write(contents.data(), contents.size());
+	success = file->close() && success;
+	if (!success || !renameFile(tempPath, relativePath))
+	{
+		removeFile(tempPath);
+		return false;
+	}
+	return true;
+}
+
+std::string FileSystem::getTempPath(const std::string& relativePath)
+{
+	return relativePath + cTempExtension;
+}
+
+bool FileSystem::hashFile(std::string& checksum, const std::string& relativePath,
+	Hash::Algorithm algorithm, ConcurrencyLimit* limit, bool fromDevice)
+{
+	std::unique_ptr<ReadFile> file = openRead(relativePath,
+		fromDevice ? ReadMode::FromDevice : ReadMode::Sequential);
+	if (!file)
+		return false;
+
+	Hash::Hasher hasher(algorithm);
+	std::vector<char> buffer(cReadBufferSize);
+	std::ptrdiff_t readSize;
+	while ((readSize = readChunk(*file, buffer.data(), buffer.size(), limit)) > 0)
+		hasher.update(buffer.data(), readSize);
+	if (readSize < 0)
+		return false;
+
+	checksum = hasher.finish();
+	return true;
+}
+
+std::vector<std::string> FileSystem::hashFiles(const std::vector<HashRequest>& files,
+	Hash::Algorithm algorithm)
+{
+	return Hash::hashStreams(files.size(), [&files](std::size_t index)
+		{
+			const HashRequest& request = files[index];
+			std::unique_ptr<ReadFile> file = request.fileSystem->openRead(request.relativePath,
+				request.fromDevice ? ReadMode::FromDevice : ReadMode::Sequential);
+			if (!file)
+				return std::unique_ptr<Hash::Stream>();
+			return std::unique_ptr<Hash::Stream>(new HashStream(std::move(file), request.limit));
+		}, algorithm);
+}
+
+bool FileSystem::copyFile(FileSystem& srcFileSystem, const std::string& srcPath,
+	FileSystem& dstFileSystem, const std::string& dstPath, const CopyOptions& options)
+{
+	std::unique_ptr<ReadFile> srcFile = srcFileSystem.openRead(srcPath, ReadMode::Sequential);
+	FileInfo srcInfo;
+	if (!srcFile || !srcFile->getInfo(srcInfo))
+		return false;
+
+	std::unique_ptr<WriteFile> dstFile = dstFileSystem.openWrite(dstPath);
+	if (!dstFile)
+		return false;
+
+	if (options.preallocate && srcInfo.size > 0)
+		dstFile->preallocate(srcInfo.size);
+
+	std::vector<char> buffer(std::max(options.writeSize, std::size_t(1)));
+	std::unique_ptr<Hash::Hasher> hasher;
+	if (options.checksum)
+		hasher.reset(new Hash::Hasher(options.checksumAlgorithm));
+	std::uint64_t writeSize = 0;
+	auto writeData = [&dstFile, &hasher, &writeSize, &options](const char* data, std::size_t size)
+		{
+			if (!writeChunk(*dstFile, data, size, options.writeLimit))
+				return false;
+			writeSize += size;
+
+			// Hash the data that was written rather than reading the source again.
+			if (hasher)
+				hasher->update(data, size);
+
+			// Queue the chunk that was just written so the device is busy while reading the next
+			// chunk.
+			if (options.startWriteback)
+				dstFile->startWriteback();
+			return true;
+		};
+
+	// Stripped metadata starts the first chunk, with any whole chunks written on their own, so
+	// the following writes stay aligned.
+	bool success = true;
+	std::size_t bufferStart = 0;
+	if (options.stripArtwork)
+	{
+		std::string metadata;
+		success = MetadataStripper::strip(metadata,
+			[&srcFile, &options](char* data, std::size_t size)
+			{
+				return readFullChunk(*srcFile, data, size, options.readLimit);
+			});
+
+		std::size_t wholeSize = metadata.size() - metadata.size() % buffer.size();
+		if (success && wholeSize > 0)
+			success = writeData(metadata.data(), wholeSize);
+		bufferStart = metadata.size() - wholeSize;
+		std::memcpy(buffer.data(), metadata.data() + wholeSize, bufferStart);
+	}
+
+	while (success)
+	{
+		if (options.cancel && *options.cancel)
+		{
+			success = false;
+			break;
+		}
+
+		std::ptrdiff_t readSize = readFullChunk(*srcFile, buffer.data() + bufferStart,
+			buffer.size() - bufferStart, options.readLimit);
+		if (readSize < 0)
+		{
+			success = false;
+			break;
+		}
+
+		std::size_t chunkSize = bufferStart + readSize;
+		bufferStart = 0;
+		if (chunkSize == 0)
+			break;
+		success = writeData(buffer.data(), chunkSize);
+	}
+	srcFile.reset();
+
+	// Release any space that was preallocated past the end if the source shrank while copying.
+	if (success && options.preallocate && writeSize < srcInfo.size)
+		success = dstFile->truncate(writeSize);
+
+	// Set the time last since truncating would modify it.
+	if (success && options.preserveModifiedTime)
+		success = dstFile->setModifiedTime(srcInfo.modifiedTime);
+
+	if (!success)
+	{
+		// Release the preallocated space in case the partial file can't be removed.
+		dstFile->truncate(0);
+		dstFile->close();
+		dstFileSystem.removeFile(dstPath);
+		return false;
+	}
+
+	if (!dstFile->close())
+	{
+		dstFileSystem.removeFile(dstPath);
+		return false;
+	}
+
+	if (hasher)
+		*options.checksum = hasher->finish();
+	return true;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "Hash.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ConcurrencyLimit;
+
+// Interface for the file operations used to synchronize music. This allows the real file system to
+// be replaced with one in memory or a simulated slow device for benchmarks.
+//
+// A file system is opened on a root directory, and paths are relative to the root with '/'
+// separators. All functions are thread-safe, though individual files may only be used by one
+// thread at a time.
+class FileSystem
+{
+public:
+	struct FileInfo
+	{
+		std::uint64_t size;
+		// Nanoseconds since the Unix epoch.
+		std::int64_t modifiedTime;
+		// Identifies the file the path resolves to, so links to the same file have the same device
+		// and file ID. Both are 0 when unknown.
+		std::uint64_t device = 0;
+		std::uint64_t fileId = 0;
+	};
+
+	enum class FileSystemType
+	{
+		Unknown,
+		Fat,   // FAT12/16/32, which has 2 second precision and stores local time.
+		ExFat, // May store local time depending on the driver that wrote it.
+		Fuse   // Often used to mount FAT or exFAT, but the underlying type is unknown.
+	};
+
+	struct SpaceInfo
+	{
+		// Free space that can be used without special privileges.
+		std::uint64_t availableBytes;
+		// Files take up a whole number of blocks, such as the cluster size for FAT.
+		std::uint64_t blockSize;
+	};
+
+	enum class EntryType
+	{
+		File,
+		Directory,
+		Other
+	};
+
+	struct DirectoryEntry
+	{
+		std::string name;
+		// Symlinks to files are treated as files, while symlinks to directories are other entries
+		// so they aren't followed.
+		EntryType type;
+	};
+
+	enum class ReadMode
+	{
+		Normal,
+		Sequential, // The whole file will be read in order.
+		FromDevice  // Bypass any cached data so the data is read back from the device.
+	};
+
+	class ReadFile
+	{
+	public:
+		virtual ~ReadFile() = default;
+		virtual bool getInfo(FileInfo& info) = 0;
+		// Returns the number of bytes read, 0 at the end of the file, or -1 on error.
+		virtual std::ptrdiff_t read(void* data, std::size_t size) = 0;
+	};
+
+	class WriteFile
+	{
+	public:
+		virtual ~WriteFile() = default;
+		virtual bool write(const void* data, std::size_t size) = 0;
+		virtual bool truncate(std::uint64_t size) = 0;
+		virtual bool setModifiedTime(std::int64_t modifiedTime) = 0;
+		virtual bool close() = 0;
+
+		// Hints that may be ignored.
+		// Reserves space for the final size without changing the size of the file.
+		virtual void preallocate(std::uint64_t)	{}
+		// Starts writing the data written so far to the device without waiting for it.
+		virtual void startWriteback()	{}
+	};
+
+	// Common erase block size for SD cards and USB flash drives.
+	static const std::size_t cDefaultWriteSize = 4*1024*1024;
+
+	struct CopyOptions
+	{
+		// Give the destination the same modified time as the source, subject to the precision of
+		// the destination file system.
+		bool preserveModifiedTime = false;
+		// Start writing data back to the device while copying rather than leaving it all in the
+		// page cache. This doesn't wait for the data to be written, see syncFileSystem().
+		bool startWriteback = false;
+		// Limits for the number of reads and writes in flight across all threads.
+		ConcurrencyLimit* readLimit = nullptr;
+		ConcurrencyLimit* writeLimit = nullptr;
+		// Reserve the full size of the destination up front so the file system can allocate it in
+		// one piece rather than growing the allocation with each write.
+		bool preallocate = true;
+		// Size of each write. Writes are aligned to this size, so when it's a multiple of the
+		// erase block size of a flash device each write covers whole blocks.
+		std::size_t writeSize = cDefaultWriteSize;
+		// Receives the checksum of the data as it's copied if set.
+		std::string* checksum = nullptr;
+		Hash::Algorithm checksumAlgorithm = Hash::Algorithm::Md5;
+		// Remove embedded pictures and padding from the metadata of songs while copying them, see
+		// MetadataStripper. The destination may be smaller than the source.
+		bool stripArtwork = false;
+		// Stops the copy between chunks when set, removing the partial file.
+		const std::atomic<bool>* cancel = nullptr;
+	};
+
+	// A file to hash with hashFiles().
+	struct HashRequest
+	{
+		FileSystem* fileSystem;
+		std::string relativePath;
+		ConcurrencyLimit* limit;
+		// Read back from the device rather than any cache where supported, as with hashFile().
+		bool fromDevice;
+	};
+
+	// Opens a file system on a root directory, creating the root first if create is true. Returns
+	// null if the root couldn't be opened.
+	using Opener = std::function<std::unique_ptr<FileSystem>(const std::string& root,
+		bool create)>;
+
+	virtual ~FileSystem() = default;
+
+	virtual const std::string& getRoot() const = 0;
+	virtual FileSystemType getFileSystemType() const = 0;
+	// Returns false if the free space of the file system containing the root isn't known.
+	virtual bool getSpaceInfo(SpaceInfo& info) const = 0;
+
+	// Returns false if the file doesn't exist or isn't a regular file.
+	virtual bool getFileInfo(FileInfo& info, const std::string& relativePath) = 0;
+	virtual bool listDirectory(std::vector<DirectoryEntry>& entries,
+		const std::string& relativeDir) = 0;
+	virtual bool createParentDirectories(const std::string& relativePath) = 0;
+	virtual bool removeFile(const std::string& relativePath) = 0;
+	// Only removes empty directories.
+	virtual bool removeDirectory(const std::string& relativeDir) = 0;
+	// Replaces the destination if it exists.
+	virtual bool renameFile(const std::string& fromPath, const std::string& toPath) = 0;
+
+	virtual std::unique_ptr<ReadFile> openRead(const std::string& relativePath,
+		ReadMode mode = ReadMode::Normal) = 0;
+	// Creates the file or truncates it if it exists. The parent directory must exist.
+	virtual std::unique_ptr<WriteFile> openWrite(const std::string& relativePath) = 0;
+
+	// Waits for all data written to the file system to reach the device.
+	virtual bool syncFileSystem() = 0;
+
+	// Gets the full path for messages.
+	std::string getPath(const std::string& relativePath) const;
+
+	bool readFile(std::string& contents, const std::string& relativePath);
+	// Writes to a temporary file first so an interrupted write keeps the previous contents.
+	bool replaceFile(const std::string& relativePath, const std::string& contents);
+	// The temporary file used to replace a file.
+	static std::string getTempPath(const std::string& relativePath);
+
+	// Computes the checksum of a file. When fromDevice is true, the data is read back from the
+	// device rather than any cache where supported.
+	bool hashFile(std::string& checksum, const std::string& relativePath,
+		Hash::Algorithm algorithm, ConcurrencyLimit* limit, bool fromDevice);
+
+	// Hashes multiple files, which may be on different file systems. Returns the checksum for each
+	// file, which is empty if it couldn't be read. MD5 hashes several files at once on CPUs with
+	// AVX2, see Hash::hashStreams().
+	static std::vector<std::string> hashFiles(const std::vector<HashRequest>& files,
+		Hash::Algorithm algorithm);
+
+	// Copies a file, overwriting the destination if it exists. The destination directory must
+	// exist. A partially written destination is removed on failure.
+	static bool copyFile(FileSystem& srcFileSystem, const std::string& srcPath,
+		FileSystem& dstFileSystem, const std::string& dstPath, const CopyOptions& options);
+};
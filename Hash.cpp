@@ -0,0 +1,675 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Hash.h"
+
+#include "HashKernels.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#if MUSICSYNC_HAS_AVX2 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// MD5 and XXH64 both read little endian words, which can be loaded directly on little endian CPUs.
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define MUSICSYNC_LITTLE_ENDIAN 1
+#else
+#define MUSICSYNC_LITTLE_ENDIAN 0
+#endif
+
+namespace HashKernels
+{
+
+namespace
+{
+
+struct F
+{
+	static std::uint32_t apply(std::uint32_t b, std::uint32_t c, std::uint32_t d)
+	{
+		return d ^ (b & (c ^ d));
+	}
+};
+
+struct G
+{
+	static std::uint32_t apply(std::uint32_t b, std::uint32_t c, std::uint32_t d)
+	{
+		return c ^ (d & (b ^ c));
+	}
+};
+
+struct H
+{
+	static std::uint32_t apply(std::uint32_t b, std::uint32_t c, std::uint32_t d)
+	{
+		return b ^ c ^ d;
+	}
+};
+
+struct I
+{
+	static std::uint32_t apply(std::uint32_t b, std::uint32_t c, std::uint32_t d)
+	{
+		return c ^ (b | ~d);
+	}
+};
+
+// The scalar version is fully unrolled so the registers are rotated by the compiler rather than
+// moved each step.
+template <typename Function>
+inline void step(std::uint32_t& a, std::uint32_t b, std::uint32_t c, std::uint32_t d,
+	std::uint32_t word, std::uint32_t constant, unsigned int shift)
+{
+	a += Function::apply(b, c, d) + word + constant;
+	a = ((a << shift) | (a >> (32 - shift))) + b;
+}
+
+} // namespace
+
+void md5Blocks(std::uint32_t state[4], const std::uint8_t* data, std::size_t blockCount)
+{
+	std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	for (std::size_t block = 0; block < blockCount; ++block, data += cMd5BlockSize)
+	{
+		std::uint32_t words[16];
+#if MUSICSYNC_LITTLE_ENDIAN
+		std::memcpy(words, data, sizeof(words));
+#else
+		for (unsigned int i = 0; i < 16; ++i)
+		{
+			const std::uint8_t* word = data + i*4;
+			words[i] = word[0] | (word[1] << 8) | (word[2] << 16) |
+				(static_cast<std::uint32_t>(word[3]) << 24);
+		}
+#endif
+
+		std::uint32_t origA = a, origB = b, origC = c, origD = d;
+		step<F>(a, b, c, d, words[0], 0xD76AA478, 7);
+		step<F>(d, a, b, c, words[1], 0xE8C7B756, 12);
+		step<F>(c, d, a, b, words[2], 0x242070DB, 17);
+		step<F>(b, c, d, a, words[3], 0xC1BDCEEE, 22);
+		step<F>(a, b, c, d, words[4], 0xF57C0FAF, 7);
+		step<F>(d, a, b, c, words[5], 0x4787C62A, 12);
+		step<F>(c, d, a, b, words[6], 0xA8304613, 17);
+		step<F>(b, c, d, a, words[7], 0xFD469501, 22);
+		step<F>(a, b, c, d, words[8], 0x698098D8, 7);
+		step<F>(d, a, b, c, words[9], 0x8B44F7AF, 12);
+		step<F>(c, d, a, b, words[10], 0xFFFF5BB1, 17);
+		step<F>(b, c, d, a, words[11], 0x895CD7BE, 22);
+		step<F>(a, b, c, d, words[12], 0x6B901122, 7);
+		step<F>(d, a, b, c, words[13], 0xFD987193, 12);
+		step<F>(c, d, a, b, words[14], 0xA679438E, 17);
+		step<F>(b, c, d, a, words[15], 0x49B40821, 22);
+
+		step<G>(a, b, c, d, words[1], 0xF61E2562, 5);
+		step<G>(d, a, b, c, words[6], 0xC040B340, 9);
+		step<G>(c, d, a, b, words[11], 0x265E5A51, 14);
+		step<G>(b, c, d, a, words[0], 0xE9B6C7AA, 20);
+		step<G>(a, b, c, d, words[5], 0xD62F105D, 5);
+		step<G>(d, a, b, c, words[10], 0x02441453, 9);
+		step<G>(c, d, a, b, words[15], 0xD8A1E681, 14);
+		step<G>(b, c, d, a, words[4], 0xE7D3FBC8, 20);
+		step<G>(a, b, c, d, words[9], 0x21E1CDE6, 5);
+		step<G>(d, a, b, c, words[14], 0xC33707D6, 9);
+		step<G>(c, d, a, b, words[3], 0xF4D50D87, 14);
+		step<G>(b, c, d, a, words[8], 0x455A14ED, 20);
+		step<G>(a, b, c, d, words[13], 0xA9E3E905, 5);
+		step<G>(d, a, b, c, words[2], 0xFCEFA3F8, 9);
+		step<G>(c, d, a, b, words[7], 0x676F02D9, 14);
+		step<G>(b, c, d, a, words[12], 0x8D2A4C8A, 20);
+
+		step<H>(a, b, c, d, words[5], 0xFFFA3942, 4);
+		step<H>(d, a, b, c, words[8], 0x8771F681, 11);
+		step<H>(c, d, a, b, words[11], 0x6D9D6122, 16);
+		step<H>(b, c, d, a, words[14], 0xFDE5380C, 23);
+		step<H>(a, b, c, d, words[1], 0xA4BEEA44, 4);
+		step<H>(d, a, b, c, words[4], 0x4BDECFA9, 11);
+		step<H>(c, d, a, b, words[7], 0xF6BB4B60, 16);
+		step<H>(b, c, d, a, words[10], 0xBEBFBC70, 23);
+		step<H>(a, b, c, d, words[13], 0x289B7EC6, 4);
+		step<H>(d, a, b, c, words[0], 0xEAA127FA, 11);
+		step<H>(c, d, a, b, words[3], 0xD4EF3085, 16);
+		step<H>(b, c, d, a, words[6], 0x04881D05, 23);
+		step<H>(a, b, c, d, words[9], 0xD9D4D039, 4);
+		step<H>(d, a, b, c, words[12], 0xE6DB99E5, 11);
+		step<H>(c, d, a, b, words[15], 0x1FA27CF8, 16);
+		step<H>(b, c, d, a, words[2], 0xC4AC5665, 23);
+
+		step<I>(a, b, c, d, words[0], 0xF4292244, 6);
+		step<I>(d, a, b, c, words[7], 0x432AFF97, 10);
+		step<I>(c, d, a, b, words[14], 0xAB9423A7, 15);
+		step<I>(b, c, d, a, words[5], 0xFC93A039, 21);
+		step<I>(a, b, c, d, words[12], 0x655B59C3, 6);
+		step<I>(d, a, b, c, words[3], 0x8F0CCC92, 10);
+		step<I>(c, d, a, b, words[10], 0xFFEFF47D, 15);
+		step<I>(b, c, d, a, words[1], 0x85845DD1, 21);
+		step<I>(a, b, c, d, words[8], 0x6FA87E4F, 6);
+		step<I>(d, a, b, c, words[15], 0xFE2CE6E0, 10);
+		step<I>(c, d, a, b, words[6], 0xA3014314, 15);
+		step<I>(b, c, d, a, words[13], 0x4E0811A1, 21);
+		step<I>(a, b, c, d, words[4], 0xF7537E82, 6);
+		step<I>(d, a, b, c, words[11], 0xBD3AF235, 10);
+		step<I>(c, d, a, b, words[2], 0x2AD7D2BB, 15);
+		step<I>(b, c, d, a, words[9], 0xEB86D391, 21);
+
+		a += origA;
+		b += origB;
+		c += origC;
+		d += origD;
+	}
+
+	state[0] = a;
+	state[1] = b;
+	state[2] = c;
+	state[3] = d;
+}
+
+} // namespace HashKernels
+
+namespace Hash
+{
+
+namespace
+{
+
+const std::uint32_t cMd5Init[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+
+const std::uint64_t cXXH64Prime1 = 0x9E3779B185EBCA87ULL;
+const std::uint64_t cXXH64Prime2 = 0xC2B2AE3D27D4EB4FULL;
+const std::uint64_t cXXH64Prime3 = 0x165667B19E3779F9ULL;
+const std::uint64_t cXXH64Prime4 = 0x85EBCA77C2B2AE63ULL;
+const std::uint64_t cXXH64Prime5 = 0x27D4EB2F165667C5ULL;
+const std::size_t cXXH64StripeSize = 32;
+
+const std::size_t cFileBufferSize = 256*1024;
+
+// The multi-buffer MD5 takes about as long for a few streams as for 8, so it's only faster than
+// hashing the streams one at a time once there are at least 3.
+const std::size_t cMinMultiBufferStreams = 3;
+
+inline std::uint64_t rotateLeft(std::uint64_t value, unsigned int shift)
+{
+	return (value << shift) | (value >> (64 - shift));
+}
+
+inline std::uint64_t read64(const std::uint8_t* data)
+{
+	std::uint64_t value = 0;
+#if MUSICSYNC_LITTLE_ENDIAN
+	std::memcpy(&value, data, sizeof(value));
+#else
+	for (unsigned int i = 0; i < 8; ++i)
+		value |= static_cast<std::uint64_t>(data[i]) << (i*8);
+#endif
+	return value;
+}
+
+inline std::uint32_t read32(const std::uint8_t* data)
+{
+#if MUSICSYNC_LITTLE_ENDIAN
+	std::uint32_t value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+#else
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<std::uint32_t>(data[3]) << 24);
+#endif
+}
+
+inline std::uint64_t xxh64Round(std::uint64_t accumulator, std::uint64_t input)
+{
+	accumulator += input*cXXH64Prime2;
+	accumulator = rotateLeft(accumulator, 31);
+	return accumulator*cXXH64Prime1;
+}
+
+inline std::uint64_t xxh64Merge(std::uint64_t accumulator, std::uint64_t value)
+{
+	accumulator ^= xxh64Round(0, value);
+	return accumulator*cXXH64Prime1 + cXXH64Prime4;
+}
+
+void xxh64Stripes(std::uint64_t state[4], const std::uint8_t* data, std::size_t stripeCount)
+{
+	for (std::size_t i = 0; i < stripeCount; ++i, data += cXXH64StripeSize)
+	{
+		state[0] = xxh64Round(state[0], read64(data));
+		state[1] = xxh64Round(state[1], read64(data + 8));
+		state[2] = xxh64Round(state[2], read64(data + 16));
+		state[3] = xxh64Round(state[3], read64(data + 24));
+	}
+}
+
+std::string toHex(const std::uint8_t* bytes, std::size_t size)
+{
+	const char* cDigits = "0123456789abcdef";
+	std::string hex;
+	hex.reserve(size*2);
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		hex.push_back(cDigits[bytes[i] >> 4]);
+		hex.push_back(cDigits[bytes[i] & 0xF]);
+	}
+	return hex;
+}
+
+std::string finishMd5(std::uint32_t state[4], const std::uint8_t* tail, std::size_t tailSize,
+	std::uint64_t length)
+{
+	// Pad with a 1 bit, zeros, and the length in bits so the final block is a multiple of 64
+	// bytes.
+	std::uint8_t padding[HashKernels::cMd5BlockSize*2] = {};
+	std::memcpy(padding, tail, tailSize);
+	padding[tailSize] = 0x80;
+	std::size_t paddedSize = tailSize < 56 ? 64 : 128;
+	std::uint64_t bitLength = length*8;
+	for (unsigned int i = 0; i < 8; ++i)
+		padding[paddedSize - 8 + i] = static_cast<std::uint8_t>(bitLength >> (i*8));
+	HashKernels::md5Blocks(state, padding, paddedSize/HashKernels::cMd5BlockSize);
+
+	std::uint8_t digest[16];
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		for (unsigned int j = 0; j < 4; ++j)
+			digest[i*4 + j] = static_cast<std::uint8_t>(state[i] >> (j*8));
+	}
+	return toHex(digest, sizeof(digest));
+}
+
+std::string finishXXH64(const std::uint64_t state[4], const std::uint8_t* tail,
+	std::size_t tailSize, std::uint64_t length)
+{
+	std::uint64_t hash;
+	if (length >= cXXH64StripeSize)
+	{
+		hash = rotateLeft(state[0], 1) + rotateLeft(state[1], 7) + rotateLeft(state[2], 12) +
+			rotateLeft(state[3], 18);
+		for (unsigned int i = 0; i < 4; ++i)
+			hash = xxh64Merge(hash, state[i]);
+	}
+	else
+		hash = cXXH64Prime5;
+	hash += length;
+
+	for (; tailSize >= 8; tail += 8, tailSize -= 8)
+	{
+		hash ^= xxh64Round(0, read64(tail));
+		hash = rotateLeft(hash, 27)*cXXH64Prime1 + cXXH64Prime4;
+	}
+	if (tailSize >= 4)
+	{
+		hash ^= read32(tail)*cXXH64Prime1;
+		hash = rotateLeft(hash, 23)*cXXH64Prime2 + cXXH64Prime3;
+		tail += 4;
+		tailSize -= 4;
+	}
+	for (; tailSize > 0; ++tail, --tailSize)
+	{
+		hash ^= *tail*cXXH64Prime5;
+		hash = rotateLeft(hash, 11)*cXXH64Prime1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= cXXH64Prime2;
+	hash ^= hash >> 29;
+	hash *= cXXH64Prime3;
+	hash ^= hash >> 32;
+
+	// Canonical form is big endian.
+	std::uint8_t digest[8];
+	for (unsigned int i = 0; i < 8; ++i)
+		digest[i] = static_cast<std::uint8_t>(hash >> ((7 - i)*8));
+	return toHex(digest, sizeof(digest));
+}
+
+bool hasAvx2()
+{
+#if MUSICSYNC_HAS_AVX2
+#if defined(_MSC_VER)
+	// Check for both CPU support and OS support for saving the YMM registers.
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	const int cOsxSave = 1 << 27;
+	if (!(info[2] & cOsxSave) || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	const int cAvx2 = 1 << 5;
+	return (info[1] & cAvx2) != 0;
+#else
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+#else
+	return false;
+#endif
+}
+
+#if MUSICSYNC_HAS_AVX2
+
+// Hashes streams in parallel, with a SIMD lane for each stream. Lanes are refilled with the next
+// stream as soon as they finish so streams with different sizes keep all lanes busy.
+class Md5MultiBuffer
+{
+public:
+	Md5MultiBuffer(std::size_t count, const StreamOpener& open, std::vector<std::string>& digests)
+		: m_count(count), m_open(open), m_digests(digests), m_nextStream(0),
+		m_emptyBuffer(new std::uint8_t[cFileBufferSize]())
+	{
+	}
+
+	void run()
+	{
+		for (std::size_t i = 0; i < HashKernels::cMd5Lanes; ++i)
+			startLane(i);
+
+		do
+		{
+			std::size_t activeLanes = 0;
+			std::size_t blockCount = cFileBufferSize/HashKernels::cMd5BlockSize;
+			for (std::size_t i = 0; i < HashKernels::cMd5Lanes; ++i)
+			{
+				Lane& lane = m_lanes[i];
+				while (lane.active && lane.size < HashKernels::cMd5BlockSize)
+				{
+					if (lane.endOfStream)
+					{
+						finishLane(i);
+						startLane(i);
+					}
+					else if (!fillLane(i))
+						startLane(i);
+				}
+
+				if (lane.active)
+				{
+					++activeLanes;
+					blockCount = std::min(blockCount, lane.size/HashKernels::cMd5BlockSize);
+				}
+			}
+
+			if (activeLanes == 0)
+				break;
+
+			const std::uint8_t* data[HashKernels::cMd5Lanes];
+			for (std::size_t i = 0; i < HashKernels::cMd5Lanes; ++i)
+			{
+				const Lane& lane = m_lanes[i];
+				data[i] = lane.active ? lane.buffer.get() + lane.offset : m_emptyBuffer.get();
+			}
+			HashKernels::md5BlocksAvx2(m_state, data, blockCount);
+
+			std::size_t consumed = blockCount*HashKernels::cMd5BlockSize;
+			for (Lane& lane : m_lanes)
+			{
+				if (lane.active)
+				{
+					lane.offset += consumed;
+					lane.size -= consumed;
+				}
+			}
+		} while (true);
+	}
+
+private:
+	struct Lane
+	{
+		std::size_t index = 0;
+		std::unique_ptr<Stream> stream;
+		std::unique_ptr<std::uint8_t[]> buffer;
+		std::size_t offset = 0;
+		std::size_t size = 0;
+		std::uint64_t length = 0;
+		bool active = false;
+		bool endOfStream = false;
+	};
+
+	void startLane(std::size_t laneIndex)
+	{
+		Lane& lane = m_lanes[laneIndex];
+		lane.stream.reset();
+		lane.active = false;
+		while (m_nextStream < m_count)
+		{
+			std::size_t index = m_nextStream++;
+			lane.stream = m_open(index);
+			if (!lane.stream)
+				continue;
+
+			if (!lane.buffer)
+				lane.buffer.reset(new std::uint8_t[cFileBufferSize]);
+			lane.index = index;
+			lane.offset = 0;
+			lane.size = 0;
+			lane.length = 0;
+			lane.active = true;
+			lane.endOfStream = false;
+			m_state.a[laneIndex] = cMd5Init[0];
+			m_state.b[laneIndex] = cMd5Init[1];
+			m_state.c[laneIndex] = cMd5Init[2];
+			m_state.d[laneIndex] = cMd5Init[3];
+			return;
+		}
+	}
+
+	// Returns false if the stream couldn't be read, leaving its digest empty.
+	bool fillLane(std::size_t laneIndex)
+	{
+		Lane& lane = m_lanes[laneIndex];
+		std::memmove(lane.buffer.get(), lane.buffer.get() + lane.offset, lane.size);
+		lane.offset = 0;
+		std::ptrdiff_t readSize = lane.stream->read(lane.buffer.get() + lane.size,
+			cFileBufferSize - lane.size);
+		if (readSize < 0)
+			return false;
+		else if (readSize == 0)
+			lane.endOfStream = true;
+
+		lane.size += readSize;
+		lane.length += readSize;
+		return true;
+	}
+
+	void finishLane(std::size_t laneIndex)
+	{
+		Lane& lane = m_lanes[laneIndex];
+		std::uint32_t state[4] = {m_state.a[laneIndex], m_state.b[laneIndex],
+			m_state.c[laneIndex], m_state.d[laneIndex]};
+		m_digests[lane.index] = finishMd5(state, lane.buffer.get() + lane.offset, lane.size,
+			lane.length);
+	}
+
+	std::size_t m_count;
+	const StreamOpener& m_open;
+	std::vector<std::string>& m_digests;
+	std::size_t m_nextStream;
+	HashKernels::Md5Lanes m_state;
+	Lane m_lanes[HashKernels::cMd5Lanes];
+	std::unique_ptr<std::uint8_t[]> m_emptyBuffer;
+};
+
+#endif // MUSICSYNC_HAS_AVX2
+
+// Reads a file with the standard library for hashFile() and hashFiles().
+class FileStream : public Stream
+{
+public:
+	explicit FileStream(const std::string& path)
+		: m_stream(path, std::ios::binary)
+	{
+	}
+
+	bool isOpen() const
+	{
+		return m_stream.is_open();
+	}
+
+	std::ptrdiff_t read(void* data, std::size_t size) override
+	{
+		m_stream.read(reinterpret_cast<char*>(data), size);
+		if (m_stream.bad())
+			return -1;
+		return static_cast<std::ptrdiff_t>(m_stream.gcount());
+	}
+
+private:
+	std::ifstream m_stream;
+};
+
+} // namespace
+
+Hasher::Hasher(Algorithm algorithm)
+	: m_algorithm(algorithm)
+{
+	reset();
+}
+
+void Hasher::update(const void* data, std::size_t size)
+{
+	const std::uint8_t* bytes = reinterpret_cast<const std::uint8_t*>(data);
+	m_length += size;
+
+	// MD5 blocks are 64 bytes and XXH64 stripes are 32 bytes, so process 64 bytes at a time for
+	// both.
+	if (m_bufferSize > 0)
+	{
+		std::size_t copySize = std::min(size, cBlockSize - m_bufferSize);
+		std::memcpy(m_buffer + m_bufferSize, bytes, copySize);
+		m_bufferSize += copySize;
+		bytes += copySize;
+		size -= copySize;
+		if (m_bufferSize < cBlockSize)
+			return;
+
+		if (m_algorithm == Algorithm::Md5)
+			HashKernels::md5Blocks(m_md5State, m_buffer, 1);
+		else
+			xxh64Stripes(m_xxh64State, m_buffer, cBlockSize/cXXH64StripeSize);
+		m_bufferSize = 0;
+	}
+
+	std::size_t blockCount = size/cBlockSize;
+	if (m_algorithm == Algorithm::Md5)
+		HashKernels::md5Blocks(m_md5State, bytes, blockCount);
+	else
+		xxh64Stripes(m_xxh64State, bytes, blockCount*cBlockSize/cXXH64StripeSize);
+
+	std::size_t processedSize = blockCount*cBlockSize;
+	std::memcpy(m_buffer, bytes + processedSize, size - processedSize);
+	m_bufferSize = size - processedSize;
+}
+
+std::string Hasher::finish()
+{
+	if (m_algorithm == Algorithm::Md5)
+		return finishMd5(m_md5State, m_buffer, m_bufferSize, m_length);
+
+	// XXH64 works with 32 byte stripes, so the buffer may still hold one.
+	const std::uint8_t* tail = m_buffer;
+	std::size_t tailSize = m_bufferSize;
+	if (tailSize >= cXXH64StripeSize)
+	{
+		xxh64Stripes(m_xxh64State, tail, 1);
+		tail += cXXH64StripeSize;
+		tailSize -= cXXH64StripeSize;
+	}
+	return finishXXH64(m_xxh64State, tail, tailSize, m_length);
+}
+
+void Hasher::reset()
+{
+	std::memcpy(m_md5State, cMd5Init, sizeof(m_md5State));
+	m_xxh64State[0] = cXXH64Prime1 + cXXH64Prime2;
+	m_xxh64State[1] = cXXH64Prime2;
+	m_xxh64State[2] = 0;
+	m_xxh64State[3] = 0 - cXXH64Prime1;
+	m_length = 0;
+	m_bufferSize = 0;
+}
+
+std::string hashString(const std::string& string, Algorithm algorithm)
+{
+	Hasher hasher(algorithm);
+	hasher.update(string.data(), string.size());
+	return hasher.finish();
+}
+
+bool hashStream(std::string& digest, Stream& stream, Algorithm algorithm)
+{
+	Hasher hasher(algorithm);
+	std::unique_ptr<std::uint8_t[]> buffer(new std::uint8_t[cFileBufferSize]);
+	std::ptrdiff_t readSize;
+	while ((readSize = stream.read(buffer.get(), cFileBufferSize)) > 0)
+		hasher.update(buffer.get(), readSize);
+	if (readSize < 0)
+		return false;
+
+	digest = hasher.finish();
+	return true;
+}
+
+bool hashFile(std::string& digest, const std::string& path, Algorithm algorithm)
+{
+	FileStream stream(path);
+	return stream.isOpen() && hashStream(digest, stream, algorithm);
+}
+
+std::vector<std::string> hashStreams(std::size_t count, const StreamOpener& open,
+	Algorithm algorithm)
+{
+	std::vector<std::string> digests(count);
+#if MUSICSYNC_HAS_AVX2
+	static const bool cUseAvx2 = hasAvx2();
+	if (algorithm == Algorithm::Md5 && cUseAvx2 && count >= cMinMultiBufferStreams)
+	{
+		Md5MultiBuffer(count, open, digests).run();
+		return digests;
+	}
+#endif
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		std::unique_ptr<Stream> stream = open(i);
+		if (stream && !hashStream(digests[i], *stream, algorithm))
+			digests[i].clear();
+	}
+	return digests;
+}
+
+std::vector<std::string> hashFiles(const std::vector<std::string>& paths, Algorithm algorithm)
+{
+	return hashStreams(paths.size(), [&paths](std::size_t index)
+		{
+			std::unique_ptr<FileStream> stream(new FileStream(paths[index]));
+			if (!stream->isOpen())
+				stream.reset();
+			return std::unique_ptr<Stream>(std::move(stream));
+		}, algorithm);
+}
+
+const char* getMd5Implementation()
+{
+	return hasAvx2() ? "AVX2 x8" : "scalar";
+}
+
+} // namespace Hash
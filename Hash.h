@@ -0,0 +1,91 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Hashes strings and files. Digests are returned as lowercase hex strings.
+//
+// MD5 matches the RFC 1321 digest, so it can be used for names that must stay the same between
+// versions. When hashing 3 or more streams with MD5 on a CPU with AVX2, up to 8 streams are hashed
+// in parallel using one SIMD lane for each stream. XXH64 is much faster for a single stream, but
+// only has 64 bits.
+namespace Hash
+{
+
+enum class Algorithm
+{
+	Md5,
+	XXH64
+};
+
+// Incrementally hashes a stream of data.
+class Hasher
+{
+public:
+	explicit Hasher(Algorithm algorithm);
+
+	void update(const void* data, std::size_t size);
+	// Returns the digest. The hasher must be reset before adding more data.
+	std::string finish();
+	void reset();
+
+private:
+	static const std::size_t cBlockSize = 64;
+
+	Algorithm m_algorithm;
+	std::uint32_t m_md5State[4];
+	std::uint64_t m_xxh64State[4];
+	std::uint64_t m_length;
+	std::uint8_t m_buffer[cBlockSize];
+	std::size_t m_bufferSize;
+};
+
+// Source of the data for hashStreams().
+class Stream
+{
+public:
+	virtual ~Stream() = default;
+
+	// Returns the number of bytes read, 0 at the end of the stream, or -1 on error.
+	virtual std::ptrdiff_t read(void* data, std::size_t size) = 0;
+};
+
+// Opens the stream with an index, returning null if it couldn't be opened. Streams are opened in
+// order as earlier streams finish, so only a few are open at a time.
+using StreamOpener = std::function<std::unique_ptr<Stream>(std::size_t index)>;
+
+std::string hashString(const std::string& string, Algorithm algorithm);
+bool hashStream(std::string& digest, Stream& stream, Algorithm algorithm);
+bool hashFile(std::string& digest, const std::string& path, Algorithm algorithm);
+
+// Hashes multiple streams, returning the digest for each. The digest is empty for streams that
+// couldn't be opened or read.
+std::vector<std::string> hashStreams(std::size_t count, const StreamOpener& open,
+	Algorithm algorithm);
+// Hashes multiple files on disk with hashStreams().
+std::vector<std::string> hashFiles(const std::vector<std::string>& paths, Algorithm algorithm);
+
+// Returns the name of the MD5 implementation used by hashStreams().
+const char* getMd5Implementation();
+
+} // namespace Hash
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Internal kernels for Hash.cpp. The AVX2 kernels are in a separate file since they are compiled
+// with different flags, and are only called once the CPU is known to support them.
+namespace HashKernels
+{
+
+const std::size_t cMd5BlockSize = 64;
+const std::size_t cMd5Lanes = 8;
+
+const std::uint32_t cMd5Constants[64] =
+{
+	0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A,
+	0xA8304613, 0xFD469501, 0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE,
+	0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821, 0xF61E2562, 0xC040B340,
+	0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+	0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8,
+	0x676F02D9, 0x8D2A4C8A, 0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C,
+	0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70, 0x289B7EC6, 0xEAA127FA,
+	0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+	0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92,
+	0xFFEFF47D, 0x85845DD1, 0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1,
+	0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391
+};
+
+const unsigned int cMd5Shifts[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+// Index of the message word used for each step.
+inline unsigned int getMd5MessageIndex(unsigned int step)
+{
+	switch (step/16)
+	{
+		case 0:
+			return step;
+		case 1:
+			return (5*step + 1) % 16;
+		case 2:
+			return (3*step + 5) % 16;
+		default:
+			return (7*step) % 16;
+	}
+}
+
+inline unsigned int getMd5Shift(unsigned int step)
+{
+	return cMd5Shifts[(step/16)*4 + step % 4];
+}
+
+// MD5 state for each lane, stored by component so each can be loaded as a single vector.
+struct Md5Lanes
+{
+	alignas(32) std::uint32_t a[cMd5Lanes];
+	alignas(32) std::uint32_t b[cMd5Lanes];
+	alignas(32) std::uint32_t c[cMd5Lanes];
+	alignas(32) std::uint32_t d[cMd5Lanes];
+};
+
+void md5Blocks(std::uint32_t state[4], const std::uint8_t* data, std::size_t blockCount);
+
+#if MUSICSYNC_HAS_AVX2
+// Processes blockCount blocks for every lane. Every lane must have a valid pointer.
+void md5BlocksAvx2(Md5Lanes& lanes, const std::uint8_t* const data[cMd5Lanes],
+	std::size_t blockCount);
+#endif
+
+} // namespace HashKernels
@@ -16,9 +16,10 @@
 
 #include "Helpers.h"
 
-#include "md5.h"
+#include "Hash.h"
 #include <cassert>
 #include <cctype>
+#include <cstdint>
 #include <cstdio>
 #include <filesystem>
 
@@ -44,11 +45,21 @@ bool readLine(std::string& line, std::istream& stream)
 }
 
 bool getRelativePath(std::string& finalPath, const std::string& path,
-	const std::string& trimFront)
+	const std::vector<std::string>& trimFronts)
 {
-	if (!trimFront.empty() && path.find(trimFront) != 0)
+	const std::string* trimFront = nullptr;
+	for (const std::string& prefix : trimFronts)
+	{
+		if (path.compare(0, prefix.size(), prefix) == 0 &&
+			(!trimFront || prefix.size() > trimFront->size()))
+		{
+			trimFront = &prefix;
+		}
+	}
+
+	if (!trimFronts.empty() && !trimFront)
 		return false;
-	finalPath = path.substr(trimFront.size());
+	finalPath = path.substr(trimFront ? trimFront->size() : 0);
 	while (!finalPath.empty() && finalPath.front() == cPathSeparator)
 		finalPath.erase(finalPath.begin());
 	return true;
@@ -97,10 +108,149 @@ std::string repairFilename(const std::string& path, bool noUnicode)
 		}
 	}
 	else
-		fileName = MD5(path).hexdigest() + origPath.extension().string();
+		fileName = Hash::hashString(path, Hash::Algorithm::Md5) + origPath.extension().string();
 	return (origPath.parent_path()/fileName).string();
 }
 
+static std::uint32_t foldCodePoint(std::uint32_t c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c + 0x20;
+	else if (c < 0x80)
+		return c;
+
+	// Latin-1 Supplement, excluding the multiplication sign.
+	if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+		return c + 0x20;
+
+	// Latin Extended-A mostly alternates between upper and lower case.
+	if ((c >= 0x100 && c <= 0x137 && c != 0x130) || (c >= 0x14A && c <= 0x177))
+		return c | 1;
+	else if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+		return c & 1 ? c + 1 : c;
+	else if (c == 0x178)
+		return 0xFF;
+
+	// Greek and Cyrillic.
+	if (c >= 0x391 && c <= 0x3AB && c != 0x3A2)
+		return c + 0x20;
+	else if (c >= 0x410 && c <= 0x42F)
+		return c + 0x20;
+	else if (c >= 0x400 && c <= 0x40F)
+		return c + 0x50;
+	return c;
+}
+
+static void trimComponentEnd(std::string& path, std::size_t componentStart)
+{
+	// Don't trim components that are only made of periods, such as "..".
+	std::size_t end = path.size();
+	while (end > componentStart && (path[end - 1] == '.' || path[end - 1] == ' '))
+		--end;
+	if (end > componentStart)
+		path.resize(end);
+}
+
+std::string foldCase(const std::string& path)
+{
+	std::string foldedPath;
+	foldedPath.reserve(path.size());
+	std::size_t componentStart = 0;
+	for (std::size_t i = 0; i < path.size(); ++i)
+	{
+		unsigned char c = static_cast<unsigned char>(path[i]);
+		if (c == cPathSeparator)
+		{
+			trimComponentEnd(foldedPath, componentStart);
+			foldedPath.push_back(cPathSeparator);
+			componentStart = foldedPath.size();
+		}
+		else if (c < 0x80)
+			foldedPath.push_back(static_cast<char>(foldCodePoint(c)));
+		else if (c >= 0xC2 && c <= 0xDF && i + 1 < path.size() &&
+			(static_cast<unsigned char>(path[i + 1]) & 0xC0) == 0x80)
+		{
+			// All of the code points that are folded are encoded in 2 bytes with UTF-8.
+			std::uint32_t codePoint = ((c & 0x1F) << 6) |
+				(static_cast<unsigned char>(path[i + 1]) & 0x3F);
+			codePoint = foldCodePoint(codePoint);
+			foldedPath.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+			foldedPath.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+			++i;
+		}
+		else
+			foldedPath.push_back(static_cast<char>(c));
+	}
+	trimComponentEnd(foldedPath, componentStart);
+	return foldedPath;
+}
+
+std::uint64_t hashString(const std::string& string)
+{
+	const std::uint64_t cOffsetBasis = 0xCBF29CE484222325ULL;
+	const std::uint64_t cPrime = 0x100000001B3ULL;
+
+	std::uint64_t hash = cOffsetBasis;
+	for (char c : string)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= cPrime;
+	}
+	return hash;
+}
+
+static char lowerAscii(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return static_cast<char>(c - 'A' + 'a');
+	return c;
+}
+
+static bool isContinuationByte(char c)
+{
+	return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+bool matchGlob(const std::string& pattern, const std::string& name)
+{
+	// Only the last '*' needs to be retried, matching one more character each time, since any
+	// earlier '*' could only match less.
+	std::size_t patternIndex = 0, nameIndex = 0;
+	std::size_t starIndex = std::string::npos, starNameIndex = 0;
+	while (nameIndex < name.size())
+	{
+		if (patternIndex < pattern.size() && pattern[patternIndex] == '*')
+		{
+			starIndex = patternIndex++;
+			starNameIndex = nameIndex;
+		}
+		else if (patternIndex < pattern.size() && pattern[patternIndex] == '?')
+		{
+			++patternIndex;
+			++nameIndex;
+			while (nameIndex < name.size() && isContinuationByte(name[nameIndex]))
+				++nameIndex;
+		}
+		else if (patternIndex < pattern.size() &&
+			lowerAscii(pattern[patternIndex]) == lowerAscii(name[nameIndex]))
+		{
+			++patternIndex;
+			++nameIndex;
+		}
+		else if (starIndex != std::string::npos)
+		{
+			patternIndex = starIndex + 1;
+			nameIndex = ++starNameIndex;
+		}
+		else
+			return false;
+	}
+
+	while (patternIndex < pattern.size() && pattern[patternIndex] == '*')
+		++patternIndex;
+	return patternIndex == pattern.size();
+}
+
 std::string getPlaylistSongPath(const std::string& relativePath, const std::string& prefix,
 	bool windowsSeparators)
 {
@@ -16,8 +16,10 @@
 
 #pragma once
 
+#include <cstdint>
 #include <istream>
 #include <string>
+#include <vector>
 
 namespace Helpers
 {
@@ -25,8 +27,19 @@ namespace Helpers
 static const char cPathSeparator = '/';
 static const char cWindowsPathSeparator = '\\';
 bool readLine(std::string& line, std::istream& stream);
-bool getRelativePath(std::string& finalPath, const std::string& path, const std::string& trimFront);
+// Trims the longest prefix in trimFronts that path starts with. Returns false if there are
+// prefixes but none match.
+bool getRelativePath(std::string& finalPath, const std::string& path,
+	const std::vector<std::string>& trimFronts);
 std::string repairFilename(const std::string& path, bool noUnicode);
+// Folds the case of a path to match how FAT and exFAT compare file names. Trailing spaces and
+// periods are also removed from each path component since they are ignored by those file systems.
+std::string foldCase(const std::string& path);
+// Stable 64-bit hash of a string. (FNV-1a)
+std::uint64_t hashString(const std::string& string);
+// Matches a file name against a pattern where '*' matches any text and '?' matches any single
+// character. ASCII letters are compared ignoring case.
+bool matchGlob(const std::string& pattern, const std::string& name);
 std::string getPlaylistSongPath(const std::string& relativePath, const std::string& prefix,
 	bool windowsSeparators);
 
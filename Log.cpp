@@ -0,0 +1,469 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Log.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+// Messages that can be queued by each thread before verbose messages are dropped and others wait.
+const std::size_t cBufferSize = 256;
+const auto cWriteInterval = std::chrono::milliseconds(20);
+const auto cProgressInterval = std::chrono::milliseconds(250);
+// Rates are measured over a window so the ETA follows changes in speed without jumping around.
+const auto cRateWindow = std::chrono::seconds(5);
+
+using Clock = std::chrono::steady_clock;
+
+struct Message
+{
+	std::uint64_t sequence;
+	Log::Level level;
+	std::string text;
+};
+
+// Queue of messages from a single thread to the writer thread.
+class MessageBuffer
+{
+public:
+	MessageBuffer()
+		: m_head(0), m_tail(0), dropped(0)
+	{
+	}
+
+	// Called from the thread that owns the buffer. Only the writer thread removes messages, so a
+	// message can always be pushed once this returns false.
+	bool isFull() const
+	{
+		return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire) ==
+			cBufferSize;
+	}
+
+	// Called from the thread that owns the buffer, which must not be full.
+	void push(Message& message)
+	{
+		std::size_t tail = m_tail.load(std::memory_order_relaxed);
+		m_messages[tail % cBufferSize] = std::move(message);
+		m_tail.store(tail + 1, std::memory_order_release);
+	}
+
+	// Called from the writer thread.
+	Message* front()
+	{
+		std::size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return nullptr;
+		return m_messages + head % cBufferSize;
+	}
+
+	void pop()
+	{
+		std::size_t head = m_head.load(std::memory_order_relaxed);
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+private:
+	Message m_messages[cBufferSize];
+	std::atomic<std::size_t> m_head;
+	std::atomic<std::size_t> m_tail;
+
+public:
+	// Verbose messages that were dropped because the buffer was full.
+	std::atomic<std::size_t> dropped;
+};
+
+struct ProgressSample
+{
+	Clock::time_point time;
+	std::size_t filesDone;
+	std::uint64_t bytesCopied;
+};
+
+std::atomic<Log::Level> gLevel(Log::Level::Info);
+std::atomic<bool> gRunning(false);
+std::atomic<bool> gStopping(false);
+// The next sequence, which is only advanced once the message with the previous sequence is queued.
+// Taking a sequence and queuing the message is done under the mutex so messages are queued in
+// order across threads, and the writer only writes messages up to the sequence it saw last.
+std::mutex gSequenceMutex;
+std::atomic<std::uint64_t> gSequence(0);
+std::thread gWriterThread;
+
+std::mutex gBuffersMutex;
+std::vector<std::shared_ptr<MessageBuffer>> gBuffers;
+thread_local std::shared_ptr<MessageBuffer> tBuffer;
+
+// Serializes writing to the console between the writer thread and immediate messages.
+std::mutex gOutputMutex;
+
+std::mutex gProgressMutex;
+Log::Progress gProgress;
+bool gHasProgress = false;
+
+// Only accessed by the writer thread.
+bool gShowProgress = false;
+std::string gProgressLine;
+bool gProgressVisible = false;
+std::deque<ProgressSample> gProgressSamples;
+
+bool isTerminal(std::FILE* stream)
+{
+#if defined(_WIN32)
+	return _isatty(_fileno(stream)) != 0;
+#else
+	return isatty(fileno(stream)) != 0;
+#endif
+}
+
+std::string formatMessage(const char* format, std::va_list args)
+{
+	std::va_list sizeArgs;
+	va_copy(sizeArgs, args);
+	int length = std::vsnprintf(nullptr, 0, format, sizeArgs);
+	va_end(sizeArgs);
+	if (length <= 0)
+		return std::string();
+
+	std::string text(length, 0);
+	std::vsnprintf(&text[0], length + 1, format, args);
+	return text;
+}
+
+void hideProgressLine()
+{
+	if (!gProgressVisible)
+		return;
+
+	// Overwrite with spaces rather than relying on terminal escape sequences.
+	std::fprintf(stdout, "\r%s\r", std::string(gProgressLine.size(), ' ').c_str());
+	gProgressVisible = false;
+}
+
+void showProgressLine()
+{
+	if (gProgressVisible || gProgressLine.empty())
+		return;
+
+	std::fputs(gProgressLine.c_str(), stdout);
+	std::fflush(stdout);
+	gProgressVisible = true;
+}
+
+void writeText(Log::Level level, const std::string& text)
+{
+	if (level == Log::Level::Error)
+	{
+		// Make sure the progress line is cleared before writing to the other stream.
+		if (gProgressVisible)
+		{
+			hideProgressLine();
+			std::fflush(stdout);
+		}
+		std::fputs(text.c_str(), stderr);
+	}
+	else
+	{
+		hideProgressLine();
+		std::fputs(text.c_str(), stdout);
+	}
+}
+
+std::string formatDuration(double seconds)
+{
+	unsigned long totalSeconds = static_cast<unsigned long>(seconds + 0.5);
+	char buffer[32];
+	if (totalSeconds >= 3600)
+	{
+		std::snprintf(buffer, sizeof(buffer), "%lu:%02lu:%02lu", totalSeconds/3600,
+			totalSeconds/60 % 60, totalSeconds % 60);
+	}
+	else
+		std::snprintf(buffer, sizeof(buffer), "%lu:%02lu", totalSeconds/60, totalSeconds % 60);
+	return buffer;
+}
+
+void updateProgressLine(Clock::time_point now)
+{
+	Log::Progress progress;
+	{
+		std::lock_guard<std::mutex> lock(gProgressMutex);
+		if (!gHasProgress)
+			return;
+		progress = gProgress;
+	}
+
+	gProgressSamples.push_back(ProgressSample{now, progress.filesDone, progress.bytesCopied});
+	while (gProgressSamples.size() > 2 && now - gProgressSamples[1].time >= cRateWindow)
+		gProgressSamples.pop_front();
+
+	const ProgressSample& first = gProgressSamples.front();
+	double seconds = std::chrono::duration<double>(now - first.time).count();
+	double filesPerSecond = 0, bytesPerSecond = 0;
+	if (seconds > 0)
+	{
+		filesPerSecond = (progress.filesDone - first.filesDone)/seconds;
+		bytesPerSecond = (progress.bytesCopied - first.bytesCopied)/seconds;
+	}
+
+	std::string eta = "--:--";
+	if (progress.totalKnown && filesPerSecond > 0)
+		eta = formatDuration((progress.filesTotal - progress.filesDone)/filesPerSecond);
+
+	const double cMegabyte = 1024.0*1024.0;
+	char buffer[128];
+	std::snprintf(buffer, sizeof(buffer), "%zu/%zu%s songs | %.1f files/s | %.1f MB/s | ETA %s",
+		progress.filesDone, progress.filesTotal, progress.totalKnown ? "" : "+", filesPerSecond,
+		bytesPerSecond/cMegabyte, eta.c_str());
+
+	// Pad to cover the end of a longer line that was shown before.
+	std::string line = std::string("\r") + buffer;
+	if (gProgressVisible && line.size() < gProgressLine.size())
+		line.append(gProgressLine.size() - line.size(), ' ');
+	std::fputs(line.c_str(), stdout);
+	std::fflush(stdout);
+	gProgressLine = std::move(line);
+	gProgressVisible = true;
+}
+
+// Writes all queued messages, merging the buffers in the order the messages were logged.
+void writeMessages()
+{
+	// Every message before the end sequence is already queued, so none can be written before an
+	// earlier message that's still being queued by another thread. It's read before the buffers so
+	// the buffer of each of these messages is included.
+	std::uint64_t endSequence = gSequence.load(std::memory_order_acquire);
+	std::vector<std::shared_ptr<MessageBuffer>> buffers;
+	{
+		std::lock_guard<std::mutex> lock(gBuffersMutex);
+		buffers = gBuffers;
+	}
+
+	std::lock_guard<std::mutex> lock(gOutputMutex);
+	bool wrote = false;
+	while (true)
+	{
+		MessageBuffer* nextBuffer = nullptr;
+		Message* nextMessage = nullptr;
+		for (const std::shared_ptr<MessageBuffer>& buffer : buffers)
+		{
+			Message* message = buffer->front();
+			if (message && message->sequence < endSequence &&
+				(!nextMessage || message->sequence < nextMessage->sequence))
+			{
+				nextBuffer = buffer.get();
+				nextMessage = message;
+			}
+		}
+
+		if (!nextMessage)
+			break;
+
+		writeText(nextMessage->level, nextMessage->text);
+		nextMessage->text.clear();
+		nextBuffer->pop();
+		wrote = true;
+	}
+
+	std::size_t dropped = 0;
+	for (const std::shared_ptr<MessageBuffer>& buffer : buffers)
+		dropped += buffer->dropped.exchange(0);
+	if (dropped > 0)
+	{
+		writeText(Log::Level::Info, "Skipped " + std::to_string(dropped) +
+			" messages to keep up with the sync.\n");
+		wrote = true;
+	}
+
+	if (wrote)
+	{
+		std::fflush(stdout);
+		std::fflush(stderr);
+		showProgressLine();
+	}
+}
+
+// Drops the buffers of threads that exited once they're empty.
+void removeUnusedBuffers()
+{
+	std::lock_guard<std::mutex> lock(gBuffersMutex);
+	for (auto iter = gBuffers.begin(); iter != gBuffers.end();)
+	{
+		if (iter->use_count() == 1 && !(*iter)->front())
+			iter = gBuffers.erase(iter);
+		else
+			++iter;
+	}
+}
+
+void runWriter()
+{
+	Clock::time_point nextProgress = Clock::now();
+	while (!gStopping)
+	{
+		writeMessages();
+		removeUnusedBuffers();
+
+		Clock::time_point now = Clock::now();
+		if (gShowProgress && now >= nextProgress)
+		{
+			std::lock_guard<std::mutex> lock(gOutputMutex);
+			updateProgressLine(now);
+			nextProgress = now + cProgressInterval;
+		}
+
+		std::this_thread::sleep_for(cWriteInterval);
+	}
+
+	writeMessages();
+	std::lock_guard<std::mutex> lock(gOutputMutex);
+	hideProgressLine();
+	std::fflush(stdout);
+}
+
+void writeMessage(Log::Level level, const char* format, std::va_list args)
+{
+	if (!Log::isEnabled(level))
+		return;
+
+	Message message{0, level, formatMessage(format, args)};
+	if (!gRunning)
+	{
+		std::lock_guard<std::mutex> lock(gOutputMutex);
+		writeText(level, message.text);
+		std::fflush(level == Log::Level::Error ? stderr : stdout);
+		return;
+	}
+
+	if (!tBuffer)
+	{
+		tBuffer = std::make_shared<MessageBuffer>();
+		std::lock_guard<std::mutex> lock(gBuffersMutex);
+		gBuffers.push_back(tBuffer);
+	}
+
+	// Verbose messages are dropped when the buffer is full, while others wait for the writer
+	// thread to catch up. The lock isn't held while waiting so other threads can still log.
+	while (tBuffer->isFull())
+	{
+		if (level == Log::Level::Verbose)
+		{
+			++tBuffer->dropped;
+			return;
+		}
+		else if (gStopping)
+			return;
+		std::this_thread::yield();
+	}
+
+	std::lock_guard<std::mutex> lock(gSequenceMutex);
+	message.sequence = gSequence.load(std::memory_order_relaxed);
+	tBuffer->push(message);
+	gSequence.store(message.sequence + 1, std::memory_order_release);
+}
+
+} // namespace
+
+namespace Log
+{
+
+void setLevel(Level level)
+{
+	gLevel = level;
+}
+
+bool isEnabled(Level level)
+{
+	return level <= gLevel.load(std::memory_order_relaxed);
+}
+
+void start(bool showProgress)
+{
+	assert(!gRunning);
+	gShowProgress = showProgress && isTerminal(stdout);
+	gProgressLine.clear();
+	gProgressVisible = false;
+	gProgressSamples.clear();
+	{
+		std::lock_guard<std::mutex> lock(gProgressMutex);
+		gProgress = Progress();
+		gHasProgress = false;
+	}
+
+	gStopping = false;
+	gRunning = true;
+	gWriterThread = std::thread(&runWriter);
+}
+
+void stop()
+{
+	if (!gRunning)
+		return;
+
+	gStopping = true;
+	gWriterThread.join();
+	gRunning = false;
+}
+
+void setProgress(const Progress& progress)
+{
+	std::lock_guard<std::mutex> lock(gProgressMutex);
+	gProgress = progress;
+	gHasProgress = true;
+}
+
+void error(const char* format, ...)
+{
+	std::va_list args;
+	va_start(args, format);
+	writeMessage(Level::Error, format, args);
+	va_end(args);
+}
+
+void info(const char* format, ...)
+{
+	std::va_list args;
+	va_start(args, format);
+	writeMessage(Level::Info, format, args);
+	va_end(args);
+}
+
+void verbose(const char* format, ...)
+{
+	std::va_list args;
+	va_start(args, format);
+	writeMessage(Level::Verbose, format, args);
+	va_end(args);
+}
+
+} // namespace Log
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__)
+#define LOG_PRINTF_FORMAT(formatIndex, firstArg) \
+	__attribute__((format(printf, formatIndex, firstArg)))
+#else
+#define LOG_PRINTF_FORMAT(formatIndex, firstArg)
+#endif
+
+// Messages for the user. While started, messages are written by a separate thread so threads
+// that copy songs never wait on a slow console. Each thread queues messages in its own ring
+// buffer, and the writer thread merges them in the order they were logged. Verbose messages are
+// dropped when a thread's buffer is full, while other messages wait for space. Otherwise messages
+// are written immediately.
+//
+// Messages are printf formatted and include the trailing newline. Errors are written to stderr,
+// everything else to stdout.
+namespace Log
+{
+
+enum class Level
+{
+	Error,  // Only errors.
+	Info,   // Overall status of the sync. (default)
+	Verbose // Each playlist and song that is changed.
+};
+
+struct Progress
+{
+	std::size_t filesDone = 0;
+	// Keeps growing until totalKnown is set.
+	std::size_t filesTotal = 0;
+	bool totalKnown = false;
+	std::uint64_t bytesCopied = 0;
+};
+
+void setLevel(Level level);
+bool isEnabled(Level level);
+
+// Starts the writer thread. When showProgress is set and stdout is a terminal, a progress line is
+// kept below the messages and refreshed at a fixed rate.
+void start(bool showProgress);
+
+// Writes the remaining messages and stops the writer thread. This must not be called while other
+// threads may still log.
+void stop();
+
+// Updates the progress line. This is cheap enough to call for every file.
+void setProgress(const Progress& progress);
+
+void error(const char* format, ...) LOG_PRINTF_FORMAT(1, 2);
+void info(const char* format, ...) LOG_PRINTF_FORMAT(1, 2);
+void verbose(const char* format, ...) LOG_PRINTF_FORMAT(1, 2);
+
+} // namespace Log
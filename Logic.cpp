@@ -16,294 +16,1941 @@
 
 #include "Logic.h"
 
+#include "BoundedQueue.h"
+#include "ChecksumManifest.h"
+#include "ConcurrencyController.h"
+#include "ConcurrencyLimit.h"
+#include "DestinationIndex.h"
+#include "DirectoryWalker.h"
+#include "ExternalSorter.h"
+#include "FileSystem.h"
 #include "Helpers.h"
+#include "Log.h"
+#include "Metrics.h"
 #include "Options.h"
 #include "Playlist.h"
+#include "PlaylistRecord.h"
+#include "PlaylistScheduler.h"
+#include "PlaylistSnapshot.h"
+#include "SessionState.h"
+#include "SongLayout.h"
+#include "SourceFileSystems.h"
+#include "SourceIndex.h"
+#include "SourceManifest.h"
+#include "SpacePlan.h"
+#include "SyncStamp.h"
 
-#include <cstdio>
+#include <algorithm>
 #include <cassert>
-#include <list>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <filesystem>
-#include <system_error>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
 namespace
 {
 
-using SongMap = std::unordered_map<std::string, std::string>;
+const std::size_t cPlaylistQueueSize = 4;
+const std::size_t cSongQueueSize = 256;
+const std::size_t cDeviceQueueSize = 64;
+const unsigned int cMaxAutoConcurrency = 8;
+// Songs already on the device are verified together so MD5 can hash them in parallel.
+const std::size_t cVerifyBatchSize = 8;
+
+struct SongJob
+{
+	std::string source;
+	std::string destination;
+	// Device the source is stored on, or 0 if unknown.
+	std::uint64_t device;
+	// Path of the song in the previous layout of the device when it changed, see SongLayout.
+	std::string previousDestination;
+};
+
+// Songs waiting to be read from a single source device, along with the threads that copy them.
+struct DeviceQueue
+{
+	explicit DeviceQueue(unsigned int initReadLimit)
+		: readLimit(initReadLimit), songs(cDeviceQueueSize)
+	{
+	}
+
+	ConcurrencyLimit readLimit;
+	BoundedQueue<SongJob> songs;
+	std::vector<std::thread> threads;
+};
+
+struct PlannedPlaylist
+{
+	std::string fileName;
+	// Scheduler ID of the playlist when it's written.
+	std::size_t id;
+	bool written;
+	// Index of the first song that was added by the playlist.
+	std::size_t firstSong;
+};
+
+// Songs held back from copying until the space they need on the device has been checked.
+struct PlannedSongs
+{
+	PlannedSongs(FileSystem& initSongDir, std::uint64_t blockSize)
+		: songDir(initSongDir), space(blockSize)
+	{
+	}
+
+	FileSystem& songDir;
+	SpacePlan space;
+	std::vector<PlannedPlaylist> playlists;
+	std::vector<SongJob> songs;
+};
+
+// Old songs found before the space check, so the space they free is counted before deciding what
+// to copy. They're only removed once the playlists that are cancelled are known, since songs that
+// those playlists still refer to on the device are kept.
+struct RemovalCandidates
+{
+	std::mutex mutex;
+	// Hash of the case folded path to the space the song takes on the device.
+	std::unordered_map<std::uint64_t, std::uint64_t> songs;
+	// Set when the songs to keep aren't known, so nothing may be removed.
+	bool keepAll = false;
+};
 
 struct PlaylistInfo
 {
-	Playlist playlist;
+	// The playlist is read from the session cache if set, then the snapshot, otherwise it's
+	// streamed from the file.
+	std::shared_ptr<const Playlist> playlist;
+	std::unique_ptr<PlaylistSnapshot> snapshot;
 	std::string fileName;
-	std::time_t modifiedTime;
+	FileSystem::FileInfo info;
+};
+
+struct FileSystems
+{
+	std::unique_ptr<FileSystem> playlistInput;
+	std::unique_ptr<FileSystem> playlistOutput;
+	std::unique_ptr<FileSystem> songOutput;
+	std::unique_ptr<SourceFileSystems> sources;
 };
 
-bool validateLocations(const Options& options)
+bool openFileSystems(FileSystems& fileSystems, const FileSystem::Opener& openFileSystem,
+	const Options& options)
 {
-	if (!std::filesystem::is_directory(options.playlistInput))
+	fileSystems.playlistInput = openFileSystem(options.playlistInput, false);
+	if (!fileSystems.playlistInput)
 	{
-		std::fprintf(stderr,
+		Log::error(
 			"Error: Couldn't open playlist input directory '%s'.\n",
 			options.playlistInput.c_str());
 		return false;
 	}
 
-	if (!std::filesystem::is_directory(options.playlistOutput) &&
-		!std::filesystem::create_directories(options.playlistOutput))
+	fileSystems.playlistOutput = openFileSystem(options.playlistOutput, true);
+	if (!fileSystems.playlistOutput)
 	{
-		std::fprintf(stderr,
+		Log::error(
 			"Error: Couldn't open playlist output directory '%s'.\n",
 			options.playlistOutput.c_str());
 		return false;
 	}
 
-	if (!std::filesystem::is_directory(options.songOutput) &&
-		!std::filesystem::create_directories(options.songOutput))
+	fileSystems.songOutput = openFileSystem(options.songOutput, true);
+	if (!fileSystems.songOutput)
 	{
-		std::fprintf(stderr,
+		Log::error(
 			"Error: Couldn't open song output directory '%s'.\n",
-			options.playlistOutput.c_str());
+			options.songOutput.c_str());
 		return false;
 	}
 
+	fileSystems.sources.reset(new SourceFileSystems(openFileSystem,
+		*fileSystems.playlistInput));
 	return true;
 }
 
-bool isPlaylist(const std::filesystem::directory_entry& entry)
+bool isPlaylist(const FileSystem::DirectoryEntry& entry)
 {
-	if (entry.status().type() != std::filesystem::file_type::regular)
+	if (entry.type != FileSystem::EntryType::File)
 		return false;
-	return entry.path().extension() == Playlist::cExtension;
+	return Playlist::isPlaylistFile(entry.name);
+}
+
+bool hasPlaylistFilter(const Options& options)
+{
+	return !options.includePlaylists.empty() || !options.excludePlaylists.empty();
+}
+
+// Returns whether a playlist is part of the sync based on the include and exclude patterns.
+bool isPlaylistSelected(const std::string& fileName, const Options& options)
+{
+	const std::vector<std::string>& includes = options.includePlaylists;
+	const std::vector<std::string>& excludes = options.excludePlaylists;
+	auto matches = [&fileName](const std::string& pattern)
+		{
+			return Helpers::matchGlob(pattern, fileName);
+		};
+	return (includes.empty() || std::any_of(includes.begin(), includes.end(), matches)) &&
+		std::none_of(excludes.begin(), excludes.end(), matches);
 }
 
-void readPlaylists(std::list<PlaylistInfo>& playlists, const Options& options)
+bool readPlaylistPriorities(std::unordered_map<std::string, std::size_t>& priorities,
+	const Options& options)
 {
-	std::printf("Reading playlists...\n");
+	if (options.playlistPriorityFile.empty())
+		return true;
 
-	for (std::filesystem::directory_iterator iter(options.playlistInput);
-		iter != std::filesystem::directory_iterator(); ++iter)
+	std::ifstream stream(options.playlistPriorityFile);
+	if (!stream)
 	{
-		if (!isPlaylist(*iter))
-			continue;
+		Log::error("Error: Couldn't open file '%s'.\n",
+			options.playlistPriorityFile.c_str());
+		return false;
+	}
 
-		playlists.push_back(PlaylistInfo());
-		if (!playlists.back().playlist.load(iter->path().string()))
-		{
-			playlists.pop_back();
-			continue;
-		}
+	std::string line;
+	while (Helpers::readLine(line, stream))
+	{
+		if (!line.empty())
+			priorities.emplace(line, priorities.size());
+		if (stream.eof())
+			break;
+	}
+	return true;
+}
+
+void sortPlaylists(std::vector<std::string>& fileNames, FileSystem& playlistDir,
+	const std::unordered_map<std::string, std::size_t>& priorities, const Options& options)
+{
+	struct SortInfo
+	{
+		std::string fileName;
+		std::size_t priority;
+		std::int64_t modifiedTime;
+	};
 
-		playlists.back().fileName = iter->path().filename().string();
-		playlists.back().modifiedTime =
-			std::filesystem::last_write_time(iter->path()).time_since_epoch().count();
+	std::vector<SortInfo> sortInfos;
+	sortInfos.reserve(fileNames.size());
+	for (std::string& fileName : fileNames)
+	{
+		auto foundIter = priorities.find(fileName);
+		std::size_t priority = foundIter == priorities.end() ? priorities.size() :
+			foundIter->second;
+
+		FileSystem::FileInfo info = {0, 0};
+		if (options.playlistOrder == Options::PlaylistOrder::Modified)
+			playlistDir.getFileInfo(info, fileName);
+		sortInfos.push_back(SortInfo{std::move(fileName), priority, info.modifiedTime});
 	}
 
-	std::printf("Done.\n");
+	// Fall back to the name to keep a consistent order so songs that conflict are resolved the
+	// same way each time.
+	std::sort(sortInfos.begin(), sortInfos.end(),
+		[](const SortInfo& left, const SortInfo& right)
+		{
+			if (left.priority != right.priority)
+				return left.priority < right.priority;
+			if (left.modifiedTime != right.modifiedTime)
+				return left.modifiedTime > right.modifiedTime;
+			return left.fileName < right.fileName;
+		});
+
+	for (std::size_t i = 0; i < fileNames.size(); ++i)
+		fileNames[i] = std::move(sortInfos[i].fileName);
 }
 
-void getSongPaths(SongMap& songs, const std::list<PlaylistInfo>& playlists, const Options& options)
+void readPlaylists(BoundedQueue<PlaylistInfo>& playlists, FileSystem& playlistDir,
+	SessionState& state, const std::unordered_map<std::string, std::size_t>& priorities,
+	const Options& options)
 {
-	std::string finalPath;
-	for (const PlaylistInfo& playlistInfo : playlists)
+	std::vector<FileSystem::DirectoryEntry> entries;
+	if (!playlistDir.listDirectory(entries, std::string()))
+	{
+		Log::error("Error: Couldn't read directory '%s'.\n",
+			playlistDir.getRoot().c_str());
+	}
+
+	std::vector<std::string> fileNames;
+	for (FileSystem::DirectoryEntry& entry : entries)
 	{
-		for (const Playlist::Entry& entry : playlistInfo.playlist.getEntries())
+		if (isPlaylist(entry) && isPlaylistSelected(entry.name, options))
+			fileNames.push_back(std::move(entry.name));
+	}
+	sortPlaylists(fileNames, playlistDir, priorities, options);
+
+	for (std::string& fileName : fileNames)
+	{
+		if (state.isCancelled())
+			break;
+
+		PlaylistInfo playlistInfo;
+		FileSystem::FileInfo info;
+		if (!playlistDir.getFileInfo(info, fileName))
+			continue;
+
+		// When caching, playlists are loaded here so they don't need to be read again if they
+		// haven't changed by the next sync in the session. Otherwise they are streamed while
+		// adding the songs so large playlists are never held in memory. Either way, snapshots
+		// saved by earlier syncs avoid parsing playlists that haven't changed.
+		std::string path = playlistDir.getPath(fileName);
+		const std::string& cacheDir = options.playlistCache;
+		if (state.isCaching())
 		{
-			if (Helpers::getRelativePath(finalPath, entry.song, options.pathTrim))
+			playlistInfo.playlist = state.findPlaylist(path, info);
+			if (!playlistInfo.playlist)
 			{
-				finalPath = Helpers::repairFilename(finalPath, options.noUnicode);
-				songs.emplace(entry.song, finalPath);
+				auto playlist = std::make_shared<Playlist>();
+				PlaylistSnapshot snapshot;
+				if (!cacheDir.empty() && snapshot.open(cacheDir, path, info))
+				{
+					snapshot.load(*playlist);
+					Log::verbose("Loaded playlist '%s' from the cache.\n", path.c_str());
+				}
+				else
+				{
+					if (!playlist->load(playlistDir, fileName))
+						continue;
+					if (!cacheDir.empty())
+						PlaylistSnapshot::save(cacheDir, path, info, *playlist);
+				}
+				playlistInfo.playlist = playlist;
+				state.addPlaylist(path, info, playlist);
 			}
+		}
+		else if (!cacheDir.empty())
+		{
+			playlistInfo.snapshot.reset(new PlaylistSnapshot);
+			if (playlistInfo.snapshot->open(cacheDir, path, info))
+				Log::verbose("Loaded playlist '%s' from the cache.\n", path.c_str());
 			else
-				std::fprintf(stderr, "Error: Error processing song '%s'.\n", entry.song.c_str());
+				playlistInfo.snapshot.reset();
 		}
+
+		playlistInfo.fileName = std::move(fileName);
+		playlistInfo.info = info;
+		if (!playlists.push(std::move(playlistInfo)))
+			break;
+		state.updateProgress([](SyncSession::Progress& progress) {++progress.playlistsRead;});
 	}
+
+	playlists.close();
 }
 
-void writePlaylists(std::list<PlaylistInfo>& playlists, const SongMap& songs,
-	const Options& options)
+// Reads the entries of a playlist from the session cache or a snapshot, or streams them from the
+// file. Streamed playlists are saved as snapshots for the next sync when there's a cache
+// directory.
+class PlaylistEntries
 {
-	std::printf("Writing modified playlists...\n");
-
-	std::string songPath;
-	std::filesystem::path playlistPath;
-	for (const PlaylistInfo& playlistInfo : playlists)
+public:
+	PlaylistEntries(FileSystem& playlistDir, const PlaylistInfo& playlistInfo,
+		const Options& options)
+		: m_playlist(playlistInfo.playlist.get()), m_snapshot(playlistInfo.snapshot.get()),
+		m_index(0)
 	{
-		playlistPath = options.playlistOutput;
-		playlistPath /= playlistInfo.fileName;
+		// The entries may be read more than once.
+		if (m_snapshot)
+			m_snapshot->rewind();
+		if (m_playlist || m_snapshot)
+			return;
 
-		//See if it's already up to date.
-		std::error_code error;
-		std::time_t timeStamp =
-			std::filesystem::last_write_time(playlistPath, error).time_since_epoch().count();
-		if (!error && timeStamp >= playlistInfo.modifiedTime)
-			continue;
+		if (m_reader.open(playlistDir, playlistInfo.fileName) && !options.playlistCache.empty())
+		{
+			m_snapshotWriter.open(options.playlistCache,
+				playlistDir.getPath(playlistInfo.fileName), playlistInfo.info);
+		}
+	}
 
-		Playlist newPlaylist;
-		for (const Playlist::Entry& entry : playlistInfo.playlist.getEntries())
+	bool next(std::string_view& song, std::string_view& info)
+	{
+		if (m_playlist)
 		{
-			SongMap::const_iterator foundIter = songs.find(entry.song);
-			if (foundIter == songs.end())
-				continue;
+			const std::vector<Playlist::Entry>& entries = m_playlist->getEntries();
+			if (m_index >= entries.size())
+				return false;
+
+			song = entries[m_index].song;
+			info = entries[m_index].info;
+			++m_index;
+			return true;
+		}
+		else if (m_snapshot)
+			return m_snapshot->next(song, info);
 
-			songPath = Helpers::getPlaylistSongPath(foundIter->second, options.pathPrefix,
-				options.windowsSeparators);
-			newPlaylist.addSong(songPath, entry.info);
+		if (!m_reader.next(m_entry))
+		{
+			// Only keep the snapshot if the whole playlist was read.
+			if (m_snapshotWriter.isOpen() && !m_reader.hasError())
+				m_snapshotWriter.close();
+			return false;
 		}
-		newPlaylist.save(playlistPath.string());
+
+		m_snapshotWriter.addSong(m_entry.song, m_entry.info);
+		song = m_entry.song;
+		info = m_entry.info;
+		return true;
+	}
+
+	bool hasError() const
+	{
+		return !m_playlist && !m_snapshot && m_reader.hasError();
+	}
+
+private:
+	const Playlist* m_playlist;
+	PlaylistSnapshot* m_snapshot;
+	std::size_t m_index;
+	Playlist::Reader m_reader;
+	Playlist::Entry m_entry;
+	PlaylistSnapshot::Writer m_snapshotWriter;
+};
+
+// Gets the destination for a song, which is false for songs that can't be synchronized. Songs
+// that haven't been seen before are queued to be copied, or added to plannedSongs if it's set,
+// and also added to wantedSongs if it's set. Songs are tracked by destination since identical
+// songs from different sources share the same destination.
+bool addSong(std::string& destination, SourceIndex& sources, DestinationIndex& destinations,
+	SongLayout& layout, PlaylistScheduler& scheduler, BoundedQueue<SongJob>& newSongs,
+	PlannedSongs* plannedSongs, ExternalSorter* wantedSongs, SessionState& state,
+	const std::string& song, const Options& options)
+{
+	SourceIndex::Identity identity;
+	if (sources.find(destination, identity, song))
+	{
+		destinations.addAlias(song, destination);
+		return true;
+	}
+
+	// Playlists often refer to songs that were since deleted, so they're left out of the playlist
+	// rather than keeping it from being written.
+	if (!identity.valid)
+	{
+		Log::error("Error: Couldn't read file '%s'.\n", song.c_str());
+		Metrics::addError(Metrics::Error::Read);
+		return false;
+	}
+
+	std::string relativePath;
+	if (!state.findSongPath(relativePath, song))
+	{
+		if (Helpers::getRelativePath(relativePath, song, options.pathTrims))
+			relativePath = Helpers::repairFilename(relativePath, options.noUnicode);
+		else
+			relativePath.clear();
+		state.addSongPath(song, relativePath);
+	}
+
+	if (relativePath.empty())
+	{
+		Log::error("Error: Error processing song '%s'.\n", song.c_str());
+		return false;
+	}
+
+	// Songs that were identical to another song in the last sync keep sharing its path so the
+	// shared copy doesn't depend on which was added first.
+	bool isNew;
+	std::string layoutPath = layout.getPath(relativePath);
+	std::string aliasPath;
+	if (!layout.isMoving() && destinations.findAlias(aliasPath, song))
+		layoutPath = aliasPath;
+	destination = destinations.add(isNew, song, layoutPath);
+	if (!isNew)
+		return true;
+
+	layout.addSong(relativePath);
+	sources.add(identity, song, destination);
+	if (wantedSongs)
+		wantedSongs->add(Helpers::foldCase(destination));
+	scheduler.addSong(destination);
+	SongJob job{song, destination, identity.id.device, std::string()};
+
+	// Songs at their previous path are kept until they're moved. The previous path has the same
+	// suffix as when it was added, so songs that collided move their own file.
+	if (layout.isMoving())
+	{
+		job.previousDestination = destinations.getPreviousPath(song,
+			layout.getPreviousPath(relativePath));
+		if (job.previousDestination == destination)
+			job.previousDestination.clear();
+		else if (wantedSongs)
+			wantedSongs->add(Helpers::foldCase(job.previousDestination));
+		else
+			layout.keepPreviousPath(job.previousDestination);
 	}
 
-	std::printf("Done.\n");
+	if (plannedSongs)
+	{
+		// Songs that are moved replace the file at their previous path.
+		FileSystem::FileInfo replacedInfo;
+		if (!plannedSongs->songDir.getFileInfo(replacedInfo, destination) &&
+			(job.previousDestination.empty() ||
+				!plannedSongs->songDir.getFileInfo(replacedInfo, job.previousDestination)))
+		{
+			replacedInfo.size = 0;
+		}
+		plannedSongs->space.addSong(identity.size, replacedInfo.size);
+		plannedSongs->songs.push_back(std::move(job));
+	}
+	else
+		newSongs.push(std::move(job));
+	state.updateProgress([](SyncSession::Progress& progress) {++progress.songsFound;});
+	return true;
 }
 
-static void removeDeletedPlaylists(std::list<PlaylistInfo>& playlists,
-	const Options& options)
+// Queues the songs in a playlist to be copied one entry at a time. Unless the playlist on the
+// device is already up to date, the new playlist is written to a temporary file along the way,
+// which replaces the playlist once all of its songs have been copied. Returns false if the
+// playlist couldn't be read.
+bool addPlaylist(SourceIndex& sources, DestinationIndex& destinations, SongLayout& layout,
+	PlaylistScheduler& scheduler, BoundedQueue<SongJob>& newSongs, PlannedSongs* plannedSongs,
+	ExternalSorter* wantedSongs, SessionState& state, const FileSystems& fileSystems,
+	const PlaylistInfo& playlistInfo, const Options& options)
 {
-	std::printf("Removing deleted playlists...\n");
+	FileSystem& playlistOutput = *fileSystems.playlistOutput;
+	FileSystem& songOutput = *fileSystems.songOutput;
+	const std::string& fileName = playlistInfo.fileName;
+
+	//See if it's already up to date. Playlists from before songs were recorded are written again
+	// so they can be kept by later syncs that skip them, as are all playlists when songs are
+	// moved to a new layout.
+	FileSystem::FileInfo info;
+	bool writePlaylist = !playlistOutput.getFileInfo(info, fileName) ||
+		info.modifiedTime < playlistInfo.info.modifiedTime ||
+		!PlaylistRecord::exists(songOutput, fileName) || layout.isMoving();
+	if (plannedSongs)
+	{
+		plannedSongs->playlists.push_back(
+			PlannedPlaylist{fileName, 0, false, plannedSongs->songs.size()});
+		plannedSongs->space.beginPlaylist();
+	}
 
-	std::vector<std::filesystem::path> removeFiles;
+	std::string_view songView, songInfo;
+	std::string song, destination;
 
-	for (std::filesystem::directory_iterator dIter(options.playlistOutput);
-		dIter != std::filesystem::directory_iterator(); ++dIter)
+	// A playlist that's up to date is still written again when the destinations of its songs
+	// differ from its record, such as when the path of a song changed owner. Songs are only added
+	// once, so reading the entries again only finds their destinations.
+	if (!writePlaylist)
 	{
-		if (!isPlaylist(*dIter))
-			continue;
-		bool found = false;
-		for (const PlaylistInfo& playlistInfo : playlists)
+		PlaylistRecord::Reader recordReader;
+		writePlaylist = !recordReader.open(songOutput, fileName);
+		PlaylistEntries entries(*fileSystems.playlistInput, playlistInfo, options);
+		std::string recordedDestination;
+		while (!writePlaylist && entries.next(songView, songInfo))
 		{
-			if (playlistInfo.fileName == dIter->path().filename())
+			song.assign(songView);
+			if (addSong(destination, sources, destinations, layout, scheduler, newSongs,
+					plannedSongs, wantedSongs, state, song, options))
 			{
-				found = true;
-				break;
+				writePlaylist = !recordReader.next(recordedDestination) ||
+					recordedDestination != destination;
 			}
 		}
-		if (found)
-			continue;
 
-		std::printf("Removing file '%s'.\n", dIter->path().string().c_str());
-		removeFiles.emplace_back(dIter->path());
-	}
+		if (entries.hasError())
+			return false;
 
-	for (const std::filesystem::path& path : removeFiles)
-		std::filesystem::remove(path);
+		if (!writePlaylist && !recordReader.next(recordedDestination) &&
+			!recordReader.hasError())
+		{
+			return true;
+		}
 
-	std::printf("Done.\n");
-}
+		Log::verbose("Songs in playlist '%s' changed paths.\n",
+			playlistOutput.getPath(fileName).c_str());
+	}
 
-static void syncSongs(const SongMap& songs, const Options& options)
-{
-	std::printf("Synchronizing songs...\n");
+	Playlist::Writer writer;
+	PlaylistRecord record;
+	writePlaylist = writer.open(playlistOutput, fileName) && record.open(songOutput, fileName);
+	std::size_t playlistId = writePlaylist ? scheduler.beginPlaylist(fileName) : 0;
+	if (plannedSongs)
+	{
+		plannedSongs->playlists.back().id = playlistId;
+		plannedSongs->playlists.back().written = writePlaylist;
+	}
 
-	std::filesystem::path srcBase = options.playlistInput;
-	std::filesystem::path dstBase = options.songOutput;
-	for (const SongMap::value_type& songInfo : songs)
+	PlaylistEntries entries(*fileSystems.playlistInput, playlistInfo, options);
+	while (entries.next(songView, songInfo))
 	{
-		std::filesystem::path srcPath = songInfo.first;
-		//Assume it's reative to the playlist input if it's not absolute.
-		if (!srcPath.is_absolute())
-			srcPath = srcBase/srcPath;
+		song.assign(songView);
+		if (!addSong(destination, sources, destinations, layout, scheduler, newSongs,
+				plannedSongs, wantedSongs, state, song, options) || !writePlaylist)
+		{
+			continue;
+		}
+
+		writer.addSong(Helpers::getPlaylistSongPath(destination, options.pathPrefix,
+			options.windowsSeparators), songInfo);
+		record.addSong(destination);
+		scheduler.addPlaylistSong(playlistId, destination);
+	}
 
-		std::filesystem::path dstPath = dstBase/songInfo.second;
+	if (entries.hasError())
+	{
+		if (writePlaylist)
+			scheduler.cancelPlaylist(playlistId);
+		if (plannedSongs)
+			plannedSongs->playlists.back().written = false;
+		return false;
+	}
 
-		std::error_code error;
-		std::time_t srcTimeStamp =
-			std::filesystem::last_write_time(srcPath, error).time_since_epoch().count();
-		if (error)
+	if (writePlaylist)
+	{
+		// The scheduler may write the playlist as soon as it's finished, so the temporary files
+		// must be complete first.
+		bool playlistClosed = writer.close();
+		bool recordClosed = record.close();
+		if (playlistClosed && recordClosed)
+			scheduler.finishPlaylist(playlistId);
+		else
 		{
-			std::fprintf(stderr, "Error: Couldn't read file '%s'.\n",
-				srcPath.string().c_str());
-			continue;
+			scheduler.cancelPlaylist(playlistId);
+			Playlist::Writer::discard(playlistOutput, fileName);
+			PlaylistRecord::discard(songOutput, fileName);
+			if (plannedSongs)
+				plannedSongs->playlists.back().written = false;
 		}
-		std::time_t dstTimeStamp =
-			std::filesystem::last_write_time(dstPath, error).time_since_epoch().count();
-		if (!error)
+	}
+	return true;
+}
+
+class PlaylistWriter
+{
+public:
+	PlaylistWriter(FileSystem& playlistDir, FileSystem& songDir, const Options& options)
+		: m_playlistDir(playlistDir), m_songDir(songDir), m_durable(options.durable)
+	{
+	}
+
+	void write(const std::string& fileName)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Make sure the songs are on the device before the playlist that references them. This
+		// flushes all songs copied so far, so it's cheap when multiple playlists are ready at once.
+		if (m_durable && !m_songDir.syncFileSystem())
 		{
-			//See if it's already up to date.
-			if (srcTimeStamp <= dstTimeStamp)
-				continue;
+			Log::error("Error: Couldn't flush '%s' to the device.\n",
+				m_songDir.getRoot().c_str());
+			Metrics::addError(Metrics::Error::PlaylistWrite);
+			Playlist::Writer::discard(m_playlistDir, fileName);
+			PlaylistRecord::discard(m_songDir, fileName);
+			return;
 		}
 
-		std::filesystem::create_directories(dstPath.parent_path());
-		std::filesystem::copy_file(srcPath, dstPath,
-			std::filesystem::copy_options::overwrite_existing, error);
-		if (error)
+		// Without a record the songs of the playlist can't be kept when it's skipped, but the
+		// playlist itself is still the most important part to update.
+		if (!PlaylistRecord::commit(m_songDir, fileName))
+			PlaylistRecord::remove(m_songDir, fileName);
+		if (Playlist::Writer::commit(m_playlistDir, fileName))
 		{
-			std::fprintf(stderr, "Error: Couldn't copy song '%s' to '%s'.\n",
-				songInfo.first.c_str(), songInfo.second.c_str());
+			Metrics::add(Metrics::Counter::PlaylistsWritten);
+			Log::verbose("Saved playlist '%s'.\n", m_playlistDir.getPath(fileName).c_str());
 		}
 		else
-			std::printf("Copied song to '%s'.\n", songInfo.second.c_str());
+			Metrics::addError(Metrics::Error::PlaylistWrite);
+	}
+
+	// Keeps the playlist on the device as it was when some of its songs couldn't be synchronized.
+	void discard(const std::string& fileName)
+	{
+		Log::info("Playlist '%s' wasn't written since some of its songs couldn't be "
+			"synchronized.\n", m_playlistDir.getPath(fileName).c_str());
+		Playlist::Writer::discard(m_playlistDir, fileName);
+		PlaylistRecord::discard(m_songDir, fileName);
+	}
+
+private:
+	std::mutex m_mutex;
+	FileSystem& m_playlistDir;
+	FileSystem& m_songDir;
+	bool m_durable;
+};
+
+// Only playlists that are selected are removed, along with their records, so playlists skipped
+// by the sync are left alone.
+static void removeDeletedPlaylists(FileSystem& playlistDir, FileSystem& songDir,
+	const std::unordered_set<std::string>& playlists, const Options& options)
+{
+	std::vector<FileSystem::DirectoryEntry> entries;
+	if (!playlistDir.listDirectory(entries, std::string()))
+	{
+		Log::error("Error: Couldn't read directory '%s'.\n",
+			playlistDir.getRoot().c_str());
+		return;
+	}
+
+	for (const FileSystem::DirectoryEntry& entry : entries)
+	{
+		if (!isPlaylist(entry) || !isPlaylistSelected(entry.name, options))
+			continue;
+		if (playlists.find(entry.name) != playlists.end())
+			continue;
+
+		Log::verbose("Removing file '%s'.\n", playlistDir.getPath(entry.name).c_str());
+		if (playlistDir.removeFile(entry.name))
+			PlaylistRecord::remove(songDir, entry.name);
 	}
+}
+
+struct TimestampTolerance
+{
+	std::int64_t tolerance;
+	// Whether the times may be offset by a time zone difference.
+	bool timeZoneOffset;
+};
 
-	std::printf("Done.\n");
+static TimestampTolerance getTimestampTolerance(const FileSystem& dstDir)
+{
+	const std::int64_t cSecond = 1000000000LL;
+	switch (dstDir.getFileSystemType())
+	{
+		case FileSystem::FileSystemType::Fat:
+		case FileSystem::FileSystemType::ExFat:
+		case FileSystem::FileSystemType::Fuse:
+			return TimestampTolerance{2*cSecond, true};
+		default:
+			// Allow for file systems that only store seconds. (e.g. HFS+ and many network shares)
+			return TimestampTolerance{cSecond, false};
+	}
 }
 
-static void removeDeletedSongs(const SongMap& songs, const Options& options)
+static bool isSongUpToDate(const FileSystem::FileInfo& srcInfo,
+	const FileSystem::FileInfo& dstInfo, const TimestampTolerance& tolerance,
+	const Options& options)
 {
-	std::printf("Removing deleted songs...\n");
+	if (options.compareMode == Options::CompareMode::Newer)
+		return srcInfo.modifiedTime <= dstInfo.modifiedTime;
 
-	std::unordered_set<std::string> relativePaths;
-	for (const SongMap::value_type& songInfo : songs)
-		relativePaths.insert(songInfo.second);
+	if (srcInfo.size != dstInfo.size)
+		return false;
+
+	std::int64_t difference = std::abs(srcInfo.modifiedTime - dstInfo.modifiedTime);
+	if (difference <= tolerance.tolerance)
+		return true;
+	else if (!tolerance.timeZoneOffset)
+		return false;
+
+	// FAT stores local time, so the times will appear shifted when the time zone changes. Time
+	// zones are offset in multiples of 15 minutes, and never more than 26 hours apart.
+	const std::int64_t cTimeZoneIncrement = 15*60*1000000000LL;
+	const std::int64_t cMaxTimeZoneOffset = 26*60*60*1000000000LL;
+	if (difference > cMaxTimeZoneOffset + tolerance.tolerance)
+		return false;
 
-	std::vector<std::filesystem::path> removeFiles;
+	std::int64_t remainder = difference % cTimeZoneIncrement;
+	return remainder <= tolerance.tolerance ||
+		cTimeZoneIncrement - remainder <= tolerance.tolerance;
+}
 
-	for (std::filesystem::recursive_directory_iterator dIter(options.songOutput);
-		dIter != std::filesystem::recursive_directory_iterator(); ++dIter)
+class SongSyncer
+{
+public:
+	SongSyncer(const Options& options, const FileSystems& fileSystems, SessionState& state,
+		ConcurrencyLimit& writeLimit, ConcurrencyController& controller,
+		ChecksumManifest* manifest, SourceManifest* sourceManifest)
+		: m_options(options), m_srcDirs(*fileSystems.sources), m_dstDir(*fileSystems.songOutput),
+		m_state(state), m_tolerance(getTimestampTolerance(m_dstDir)), m_writeLimit(writeLimit),
+		m_controller(controller), m_manifest(manifest), m_sourceManifest(sourceManifest)
 	{
-		if (dIter->status().type() != std::filesystem::file_type::regular)
-			continue;
-		std::string relativePath;
-		if (!Helpers::getRelativePath(relativePath, dIter->path().string(), options.songOutput))
+		m_copyOptions.preserveModifiedTime =
+			options.compareMode == Options::CompareMode::Fingerprint;
+		m_copyOptions.startWriteback = options.durable;
+		m_copyOptions.writeLimit = &writeLimit;
+		m_copyOptions.checksumAlgorithm = options.hashAlgorithm;
+		m_copyOptions.stripArtwork = options.stripArtwork;
+		m_copyOptions.cancel = &state.getCancelled();
+	}
+
+	enum class Result
+	{
+		Synced,
+		Failed,
+		Verifying // Added to the verifications to check with verify().
+	};
+
+	// A song that's already on the device and needs to be checked against its checksum.
+	struct Verification
+	{
+		SongJob song;
+		FileSystem* srcDir;
+		std::string srcPath;
+		FileSystem::FileInfo srcInfo;
+		FileSystem::FileInfo dstInfo;
+		// Empty until the source is hashed when there's no stored checksum.
+		std::string checksum;
+		// Set by verify().
+		bool synced = false;
+	};
+
+	// Reads from the source are limited by the read limit for its device. Songs that are already
+	// on the device and need to be verified are added to verifications so several can be checked
+	// together.
+	Result sync(const SongJob& song, ConcurrencyLimit& readLimit,
+		std::vector<Verification>& verifications)
+	{
+		std::string srcPath;
+		FileSystem* srcDir = m_srcDirs.get(srcPath, song.source);
+		if (!srcDir)
 		{
-			assert(false);
-			continue;
+			Log::error("Error: Couldn't read file '%s'.\n", song.source.c_str());
+			Metrics::addError(Metrics::Error::Read);
+			reportSong(false, 0);
+			return Result::Failed;
+		}
+
+		const std::string& dstPath = song.destination;
+		if (!song.previousDestination.empty())
+			move(song.previousDestination, dstPath);
+
+		Metrics::add(Metrics::Counter::SongsChecked);
+		FileSystem::FileInfo srcInfo, dstInfo;
+		readLimit.acquire();
+		bool srcExists = srcDir->getFileInfo(srcInfo, srcPath);
+		readLimit.release();
+		Metrics::add(Metrics::Counter::StatCalls);
+		if (!srcExists)
+		{
+			Log::error("Error: Couldn't read file '%s'.\n", song.source.c_str());
+			Metrics::addError(Metrics::Error::Read);
+			reportSong(false, 0);
+			return Result::Failed;
+		}
+
+		//See if it's already up to date. Songs that were synchronized earlier in the session don't
+		//need to be checked on the device again.
+		bool dstExists = m_state.findDestination(dstInfo, dstPath);
+		if (!dstExists)
+		{
+			m_writeLimit.acquire();
+			dstExists = m_dstDir.getFileInfo(dstInfo, dstPath);
+			m_writeLimit.release();
+			Metrics::add(Metrics::Counter::StatCalls);
+			if (dstExists)
+				m_state.setDestination(dstPath, dstInfo);
+		}
+		if (dstExists && isUpToDate(dstPath, srcInfo, dstInfo))
+		{
+			if (!m_manifest)
+			{
+				reportSong(true, 0);
+				return Result::Synced;
+			}
+
+			// Stripped songs only match the source after stripping it, which happens by copying
+			// again, so they can only be verified with a stored checksum.
+			ChecksumManifest::Entry entry;
+			bool hasChecksum = m_manifest->find(entry, dstPath) && entry.size == dstInfo.size &&
+				entry.modifiedTime == dstInfo.modifiedTime;
+			if (hasChecksum || !m_options.stripArtwork)
+			{
+				verifications.push_back(Verification{song, srcDir, srcPath, srcInfo, dstInfo,
+					hasChecksum ? std::move(entry.checksum) : std::string()});
+				return Result::Verifying;
+			}
+
+			Log::info("Song '%s' doesn't match the source, copying again.\n",
+				song.destination.c_str());
+		}
+
+		return copySong(song, *srcDir, srcPath, srcInfo, readLimit) ? Result::Synced :
+			Result::Failed;
+	}
+
+	// Checks the songs added by sync() against the stored checksums, or against the source if
+	// there isn't one. The songs and sources are hashed together, and songs that don't match are
+	// copied again.
+	void verify(std::vector<Verification>& verifications, ConcurrencyLimit& readLimit)
+	{
+		if (m_state.isCancelled())
+			return;
+
+		std::vector<FileSystem::HashRequest> requests;
+		for (const Verification& verification : verifications)
+		{
+			if (verification.checksum.empty())
+			{
+				requests.push_back(FileSystem::HashRequest{verification.srcDir,
+					verification.srcPath, &readLimit, false});
+			}
+			requests.push_back(FileSystem::HashRequest{&m_dstDir,
+				verification.song.destination, &m_writeLimit, true});
 		}
-		if (relativePaths.find(relativePath) == relativePaths.end())
+
+		std::vector<std::string> checksums = FileSystem::hashFiles(requests,
+			m_options.hashAlgorithm);
+		auto checksumIter = checksums.begin();
+		for (Verification& verification : verifications)
 		{
-			std::printf("Removing song '%s'.\n", relativePath.c_str());
-			removeFiles.emplace_back(dIter->path());
+			if (verification.checksum.empty())
+				verification.checksum = std::move(*checksumIter++);
+			const std::string& dstChecksum = *checksumIter++;
+
+			const std::string& dstPath = verification.song.destination;
+			if (!dstChecksum.empty() && dstChecksum == verification.checksum)
+			{
+				m_manifest->set(dstPath, ChecksumManifest::Entry{dstChecksum,
+					verification.dstInfo.size, verification.dstInfo.modifiedTime});
+				reportSong(true, 0);
+				verification.synced = true;
+				continue;
+			}
+
+			if (m_state.isCancelled())
+				continue;
+
+			Log::info("Song '%s' doesn't match the source, copying again.\n", dstPath.c_str());
+			verification.synced = copySong(verification.song, *verification.srcDir,
+				verification.srcPath, verification.srcInfo, readLimit);
 		}
 	}
 
-	for (const std::filesystem::path& path : removeFiles)
-		std::filesystem::remove(path);
+private:
+	// Copies a song that isn't on the device or doesn't match the source.
+	bool copySong(const SongJob& song, FileSystem& srcDir, const std::string& srcPath,
+		const FileSystem::FileInfo& srcInfo, ConcurrencyLimit& readLimit)
+	{
+		const std::string& dstPath = song.destination;
+		m_state.removeDestination(dstPath);
+		auto copyStart = std::chrono::steady_clock::now();
+		if (!m_dstDir.createParentDirectories(dstPath) ||
+			!copy(srcDir, srcPath, dstPath, readLimit))
+		{
+			// Copies that were interrupted by cancelling aren't errors.
+			if (m_state.isCancelled())
+				return false;
 
-	std::printf("Done.\n");
-}
+			Log::error("Error: Couldn't copy song '%s' to '%s'.\n",
+				song.source.c_str(), song.destination.c_str());
+			Metrics::addError(Metrics::Error::Copy);
+			reportSong(false, 0);
+			return false;
+		}
 
-} // namespace
+		Metrics::observe(Metrics::Histogram::CopyDuration,
+			std::chrono::steady_clock::now() - copyStart);
+		m_controller.addFile();
+		Log::verbose("Copied song to '%s'.\n", song.destination.c_str());
 
-namespace Logic
-{
+		// Stripped songs may be smaller than the source, so report the size that was written.
+		std::uint64_t copiedSize = srcInfo.size;
+		FileSystem::FileInfo dstInfo;
+		if ((m_state.isCaching() || m_sourceManifest) && m_dstDir.getFileInfo(dstInfo, dstPath))
+		{
+			if (m_state.isCaching())
+				m_state.setDestination(dstPath, dstInfo);
+			if (m_sourceManifest)
+			{
+				m_sourceManifest->set(dstPath, SourceManifest::Entry{srcInfo, dstInfo});
+				copiedSize = dstInfo.size;
+			}
+		}
+		Metrics::add(Metrics::Counter::SongsCopied);
+		Metrics::add(Metrics::Counter::BytesCopied, copiedSize);
+		reportSong(true, copiedSize);
+		return true;
+	}
 
-bool syncMusic(const Options& options)
-{
-	if (!validateLocations(options))
-		return false;
+	// Stripped songs can't be compared with the source, so they're only up to date if they were
+	// copied from a source with the same fingerprint. Songs copied before stripping was enabled
+	// are copied again once.
+	bool isUpToDate(const std::string& dstPath, const FileSystem::FileInfo& srcInfo,
+		const FileSystem::FileInfo& dstInfo) const
+	{
+		if (m_sourceManifest)
+			return m_sourceManifest->isUpToDate(dstPath, srcInfo, dstInfo);
+		return isSongUpToDate(srcInfo, dstInfo, m_tolerance, m_options);
+	}
 
-	std::list<PlaylistInfo> playlists;
-	SongMap songs;
+	void reportSong(bool success, std::uint64_t copiedSize)
+	{
+		m_state.updateProgress([success, copiedSize](SyncSession::Progress& progress)
+			{
+				++progress.songsSynced;
+				if (!success)
+					++progress.songsFailed;
+				else if (copiedSize > 0)
+				{
+					++progress.songsCopied;
+					progress.bytesCopied += copiedSize;
+				}
+			});
+	}
 
-	readPlaylists(playlists, options);
-	std::printf("\n");
-	getSongPaths(songs, playlists, options);
-	if (options.removePlaylists)
+	// Moves a song from its path in the previous layout of the device unless it's already at the
+	// destination. It's copied instead if it can't be moved.
+	void move(const std::string& previousPath, const std::string& dstPath)
 	{
-		removeDeletedPlaylists(playlists, options);
-		std::printf("\n");
+		FileSystem::FileInfo info;
+		m_writeLimit.acquire();
+		bool moved = !m_dstDir.getFileInfo(info, dstPath) &&
+			m_dstDir.getFileInfo(info, previousPath);
+		if (!moved)
+		{
+			m_writeLimit.release();
+			return;
+		}
+
+		moved = m_dstDir.createParentDirectories(dstPath) &&
+			m_dstDir.renameFile(previousPath, dstPath);
+
+		// Remove the subdirectory the song was split into once it's empty, which fails while
+		// other songs are left in it.
+		std::size_t previousEnd = previousPath.find_last_of(Helpers::cPathSeparator);
+		if (moved && previousEnd != std::string::npos &&
+			dstPath.compare(0, previousEnd + 1, previousPath, 0, previousEnd + 1) != 0)
+		{
+			m_dstDir.removeDirectory(previousPath.substr(0, previousEnd));
+		}
+		m_writeLimit.release();
+		if (!moved)
+		{
+			Log::error("Error: Couldn't move song '%s' to '%s'.\n", previousPath.c_str(),
+				dstPath.c_str());
+			Metrics::addError(Metrics::Error::Move);
+			return;
+		}
+
+		// Renaming keeps the size and modified time, so the stored entries still apply.
+		m_state.removeDestination(previousPath);
+		ChecksumManifest::Entry checksumEntry;
+		if (m_manifest && m_manifest->find(checksumEntry, previousPath))
+			m_manifest->set(dstPath, std::move(checksumEntry));
+		SourceManifest::Entry sourceEntry;
+		if (m_sourceManifest && m_sourceManifest->find(sourceEntry, previousPath))
+			m_sourceManifest->set(dstPath, sourceEntry);
+		Log::verbose("Moved song '%s' to '%s'.\n", previousPath.c_str(), dstPath.c_str());
 	}
-	if (options.removeSongs)
+
+	bool copy(FileSystem& srcDir, const std::string& srcPath, const std::string& dstPath,
+		ConcurrencyLimit& readLimit)
 	{
-		removeDeletedSongs(songs, options);
-		std::printf("\n");
+		FileSystem::CopyOptions copyOptions = m_copyOptions;
+		copyOptions.readLimit = &readLimit;
+		if (!m_manifest)
+			return FileSystem::copyFile(srcDir, srcPath, m_dstDir, dstPath, copyOptions);
+
+		// Hash the source while copying, then read back the destination to check it. Copy again
+		// once if it doesn't match in case it was a transient error.
+		const unsigned int cMaxAttempts = 2;
+		std::string srcChecksum, dstChecksum;
+		copyOptions.checksum = &srcChecksum;
+		for (unsigned int i = 0; i < cMaxAttempts; ++i)
+		{
+			if (!FileSystem::copyFile(srcDir, srcPath, m_dstDir, dstPath, copyOptions))
+				return false;
+
+			FileSystem::FileInfo dstInfo;
+			if (m_dstDir.hashFile(dstChecksum, dstPath, m_options.hashAlgorithm, &m_writeLimit,
+					true) && dstChecksum == srcChecksum && m_dstDir.getFileInfo(dstInfo, dstPath))
+			{
+				m_manifest->set(dstPath, ChecksumManifest::Entry{dstChecksum, dstInfo.size,
+					dstInfo.modifiedTime});
+				return true;
+			}
+
+			Log::error("Error: Song '%s' doesn't match the source after copying.\n",
+				dstPath.c_str());
+			Metrics::addError(Metrics::Error::Verify);
+		}
+
+		return false;
 	}
-	writePlaylists(playlists, songs, options);
-	std::printf("\n");
-	syncSongs(songs, options);
 
-	return true;
+	const Options& m_options;
+	SourceFileSystems& m_srcDirs;
+	FileSystem& m_dstDir;
+	SessionState& m_state;
+	TimestampTolerance m_tolerance;
+	ConcurrencyLimit& m_writeLimit;
+	ConcurrencyController& m_controller;
+	ChecksumManifest* m_manifest;
+	SourceManifest* m_sourceManifest;
+	FileSystem::CopyOptions m_copyOptions;
+};
+
+static void syncSongs(BoundedQueue<SongJob>& songs, PlaylistScheduler& scheduler,
+	const FileSystems& fileSystems, SessionState& state, const Options& options)
+{
+	// Start from a single operation when tuning, since that's the safest for slow flash devices.
+	bool autoRead = options.readLimit == Options::cAutoLimit;
+	bool autoWrite = options.writeLimit == Options::cAutoLimit;
+	ConcurrencyLimit readLimit(autoRead ? 1 : options.readLimit);
+	ConcurrencyLimit writeLimit(autoWrite ? 1 : options.writeLimit);
+	ConcurrencyController controller(readLimit, autoRead, writeLimit, autoWrite,
+		cMaxAutoConcurrency);
+
+	// Each thread holds a single read or write at a time, so there needs to be a thread for each
+	// operation that may be in flight.
+	unsigned int threadCount = std::max(autoRead ? cMaxAutoConcurrency : options.readLimit,
+		autoWrite ? cMaxAutoConcurrency : options.writeLimit);
+
+	// Checksums are kept on the device so songs that were verified before don't need to be
+	// compared against the source again.
+	std::unique_ptr<ChecksumManifest> manifest;
+	if (options.verify)
+	{
+		manifest.reset(new ChecksumManifest(*fileSystems.songOutput, options.hashAlgorithm));
+		if (!manifest->load())
+		{
+			Log::error("Error: Couldn't read checksums from '%s'.\n",
+				options.songOutput.c_str());
+		}
+	}
+
+	std::unique_ptr<SourceManifest> sourceManifest;
+	if (options.stripArtwork)
+	{
+		sourceManifest.reset(new SourceManifest(*fileSystems.songOutput));
+		if (!sourceManifest->load())
+		{
+			Log::error("Error: Couldn't read song sources from '%s'.\n",
+				options.songOutput.c_str());
+		}
+	}
+
+	SongSyncer syncer(options, fileSystems, state, writeLimit, controller, manifest.get(),
+		sourceManifest.get());
+	auto threadFunc = [&scheduler, &syncer, &state, &readLimit, autoRead](DeviceQueue& queue)
+	{
+		// Playlists left waiting once cancelled are discarded at the end.
+		auto finishSong = [&scheduler, &state](const SongJob& song, bool synced)
+			{
+				if (synced)
+					scheduler.finishSong(song.destination);
+				else if (!state.isCancelled())
+					scheduler.failSong(song.destination);
+			};
+
+		// Songs to verify wait for a full batch, but are verified before waiting for more songs
+		// so they aren't held back when the queue is empty.
+		std::vector<SongSyncer::Verification> verifications;
+		auto verify = [&syncer, &queue, &verifications, &finishSong]()
+			{
+				if (verifications.empty())
+					return;
+
+				syncer.verify(verifications, queue.readLimit);
+				for (const SongSyncer::Verification& verification : verifications)
+					finishSong(verification.song, verification.synced);
+				verifications.clear();
+			};
+
+		// Once cancelled, the remaining songs are drained without finishing them so playlists
+		// that refer to them aren't written.
+		SongJob song;
+		while (true)
+		{
+			if (verifications.size() >= cVerifyBatchSize || !queue.songs.tryPop(song))
+			{
+				verify();
+				if (!queue.songs.pop(song))
+					break;
+			}
+
+			if (state.isCancelled())
+				continue;
+
+			// The tuned read limit is applied to each device separately.
+			if (autoRead)
+				queue.readLimit.setLimit(readLimit.getLimit());
+			SongSyncer::Result result = syncer.sync(song, queue.readLimit, verifications);
+			if (result != SongSyncer::Result::Verifying)
+				finishSong(song, result == SongSyncer::Result::Synced);
+		}
+	};
+
+	// Each source device has its own queue and read limit, so songs on separate disks are read in
+	// parallel without adding seeks to any one disk. All devices share the write limit for the
+	// destination. Queues are added as songs from each device are found.
+	controller.start();
+	std::unordered_map<std::uint64_t, std::unique_ptr<DeviceQueue>> devices;
+	SongJob song;
+	while (songs.pop(song))
+	{
+		std::unique_ptr<DeviceQueue>& device = devices[song.device];
+		if (!device)
+		{
+			device.reset(new DeviceQueue(readLimit.getLimit()));
+			for (unsigned int i = 0; i < threadCount; ++i)
+				device->threads.emplace_back(threadFunc, std::ref(*device));
+		}
+		device->songs.push(std::move(song));
+	}
+
+	for (const auto& device : devices)
+		device.second->songs.close();
+	for (const auto& device : devices)
+	{
+		for (std::thread& thread : device.second->threads)
+			thread.join();
+	}
+	controller.stop();
+
+	if (manifest && !manifest->save())
+	{
+		Log::error("Error: Couldn't write checksums to '%s'.\n",
+			options.songOutput.c_str());
+	}
+
+	if (sourceManifest && !sourceManifest->save())
+	{
+		Log::error("Error: Couldn't write song sources to '%s'.\n",
+			options.songOutput.c_str());
+	}
+
+	if (controller.isTuning())
+	{
+		ConcurrencyController::Settings settings = controller.getBestSettings();
+		if (settings.bytesPerSecond > 0)
+		{
+			const double cMegabyte = 1024.0*1024.0;
+			Log::info("Best copy throughput was %.1f MB/s and %.1f files/s with %u reads and "
+				"%u writes.\nUse %s %u %s %u to keep these settings.\n",
+				settings.bytesPerSecond/cMegabyte, settings.filesPerSecond, settings.readLimit,
+				settings.writeLimit, Options::cReadLimitOption, settings.readLimit,
+				Options::cWriteLimitOption, settings.writeLimit);
+		}
+	}
+}
+
+static unsigned int getScanThreadCount(const Options& options)
+{
+	if (options.scanThreads > 0)
+		return options.scanThreads;
+
+	// Scanning is mostly bound by I/O latency rather than CPU, so use more threads than cores on
+	// small machines.
+	const unsigned int cMinThreads = 4;
+	return std::max(std::thread::hardware_concurrency(), cMinThreads);
+}
+
+// Keeps the songs of playlists on the device that are skipped by the sync, reading them from the
+// records saved when the playlists were written. The songs are added to wantedSongs if it's set,
+// otherwise to keptSongs as hashes of the case folded paths. Returns false if the songs of a
+// skipped playlist aren't known, in which case no songs may be removed.
+static bool keepSkippedPlaylistSongs(std::unordered_set<std::uint64_t>& keptSongs,
+	ExternalSorter* wantedSongs, FileSystem& playlistDir, FileSystem& songDir,
+	const Options& options)
+{
+	std::vector<FileSystem::DirectoryEntry> entries;
+	if (!playlistDir.listDirectory(entries, std::string()))
+	{
+		Log::error("Error: Couldn't read directory '%s'.\n",
+			playlistDir.getRoot().c_str());
+		return false;
+	}
+
+	auto keepSong = [&keptSongs, wantedSongs](const std::string& destination)
+		{
+			std::string foldedPath = Helpers::foldCase(destination);
+			if (wantedSongs)
+				wantedSongs->add(std::move(foldedPath));
+			else
+				keptSongs.insert(Helpers::hashString(foldedPath));
+		};
+	for (const FileSystem::DirectoryEntry& entry : entries)
+	{
+		if (!isPlaylist(entry) || isPlaylistSelected(entry.name, options))
+			continue;
+
+		if (!PlaylistRecord::exists(songDir, entry.name))
+		{
+			Log::error("Error: The songs in skipped playlist '%s' aren't known, so no songs will "
+				"be removed. Synchronize it once without skipping it to record them.\n",
+				playlistDir.getPath(entry.name).c_str());
+			return false;
+		}
+
+		if (!PlaylistRecord::read(songDir, entry.name, keepSong))
+			return false;
+	}
+	return true;
+}
+
+// Files that MusicSync keeps alongside the songs, which are never removed as old songs. This
+// includes the temporary files they're written to, since the manifests are saved by the copy
+// thread while old songs may still be removed.
+static bool isMetadataPath(const std::string& relativePath)
+{
+	if (PlaylistRecord::isRecordPath(relativePath))
+		return true;
+
+	for (const char* fileName : {ChecksumManifest::cFileName, DestinationIndex::cFileName,
+			SourceManifest::cFileName, SongLayout::cFileName, SyncStamp::cFileName})
+	{
+		if (relativePath == fileName || relativePath == FileSystem::getTempPath(fileName))
+			return true;
+	}
+	return false;
+}
+
+static void addRemoveMetrics(const DirectoryWalker::Result& result)
+{
+	Metrics::add(Metrics::Counter::FilesScanned, result.filesScanned);
+	Metrics::add(Metrics::Counter::SongsRemoved, result.filesRemoved);
+	Metrics::addError(Metrics::Error::Remove, result.errors);
+}
+
+// The index is only read while walking, so it's safe to check from all threads. It ignores case,
+// since directories may have been created with a different spelling on devices that also ignore
+// case.
+static bool isWantedSong(const std::string& relativePath, const DestinationIndex& destinations,
+	const std::unordered_set<std::uint64_t>& keptSongs)
+{
+	if (isMetadataPath(relativePath) || destinations.contains(relativePath))
+		return true;
+
+	return !keptSongs.empty() &&
+		keptSongs.count(Helpers::hashString(Helpers::foldCase(relativePath))) > 0;
+}
+
+static void removeDeletedSongs(DirectoryWalker::Result& result, FileSystem& songDir,
+	const DestinationIndex& destinations, const std::unordered_set<std::uint64_t>& keptSongs,
+	SessionState& state, const Options& options)
+{
+	// Everything that's left is kept once cancelled.
+	DirectoryWalker walker(getScanThreadCount(options));
+	walker.removeFiles(result, songDir,
+		[&destinations, &keptSongs, &state](const std::string& relativePath)
+		{
+			if (isWantedSong(relativePath, destinations, keptSongs) || state.isCancelled())
+				return true;
+
+			Log::verbose("Removing song '%s'.\n", relativePath.c_str());
+			state.removeDestination(relativePath);
+			return false;
+		});
+	addRemoveMetrics(result);
+}
+
+static void addParentDirectories(std::set<std::string>& directories, const std::string& path)
+{
+	for (std::size_t separator = path.rfind(Helpers::cPathSeparator);
+		separator != std::string::npos && separator > 0;
+		separator = path.rfind(Helpers::cPathSeparator, separator - 1))
+	{
+		if (!directories.insert(path.substr(0, separator)).second)
+			break;
+	}
+}
+
+// Finds deleted songs without holding all song paths in memory. The wanted songs and the songs on
+// the device are both sorted by case folded path using on-disk runs, then merged to call deleted
+// with each song to remove.
+static void findDeletedSongsBounded(DirectoryWalker::Result& result, FileSystem& songDir,
+	ExternalSorter& wantedSongs, const Options& options,
+	const std::function<void(const std::string& relativePath)>& deleted)
+{
+	// Store the folded path first to sort by it, followed by the original path to remove. The
+	// separator sorts before any other character so the order matches sorting the folded paths.
+	ExternalSorter existingSongs(options.memoryLimit/2);
+	DirectoryWalker walker(getScanThreadCount(options));
+	walker.removeFiles(result, songDir,
+		[&existingSongs](const std::string& relativePath)
+		{
+			if (isMetadataPath(relativePath))
+				return true;
+
+			std::string entry = Helpers::foldCase(relativePath);
+			entry.push_back('\0');
+			entry += relativePath;
+			existingSongs.add(std::move(entry));
+			return true;
+		});
+
+	if (!wantedSongs.finish() || !existingSongs.finish())
+	{
+		Log::error("Error: Couldn't sort songs to find the songs to remove.\n");
+		++result.errors;
+		return;
+	}
+
+	std::string wantedSong, existingSong;
+	bool hasWantedSong = wantedSongs.next(wantedSong);
+	while (existingSongs.next(existingSong))
+	{
+		std::size_t separator = existingSong.find('\0');
+		assert(separator != std::string::npos);
+		int compare = 1;
+		while (hasWantedSong &&
+			(compare = existingSong.compare(0, separator, wantedSong)) > 0)
+		{
+			hasWantedSong = wantedSongs.next(wantedSong);
+		}
+		if (hasWantedSong && compare == 0)
+			continue;
+
+		deleted(existingSong.substr(separator + 1));
+	}
+
+	if (wantedSongs.hasError() || existingSongs.hasError())
+	{
+		Log::error("Error: Couldn't read temporary files for removing songs.\n");
+		++result.errors;
+	}
+}
+
+// Removes deleted songs without holding all song paths in memory.
+static void removeDeletedSongsBounded(DirectoryWalker::Result& result, FileSystem& songDir,
+	ExternalSorter& wantedSongs, const Options& options)
+{
+	std::set<std::string> directories(result.emptyDirectories.begin(),
+		result.emptyDirectories.end());
+	findDeletedSongsBounded(result, songDir, wantedSongs, options,
+		[&result, &songDir, &directories](const std::string& relativePath)
+		{
+			Log::verbose("Removing song '%s'.\n", relativePath.c_str());
+			if (songDir.removeFile(relativePath))
+			{
+				++result.filesRemoved;
+				addParentDirectories(directories, relativePath);
+			}
+			else
+			{
+				Log::error("Error: Couldn't remove file '%s'.\n", relativePath.c_str());
+				++result.errors;
+			}
+		});
+	addRemoveMetrics(result);
+
+	// Directories that still have contents will fail to be removed, so these only need to be
+	// candidates as long as the deepest directories are first.
+	result.emptyDirectories.assign(directories.begin(), directories.end());
+	std::sort(result.emptyDirectories.begin(), result.emptyDirectories.end(),
+		[](const std::string& left, const std::string& right)
+		{
+			return std::count(left.begin(), left.end(), Helpers::cPathSeparator) >
+				std::count(right.begin(), right.end(), Helpers::cPathSeparator);
+		});
+}
+
+// Finds the songs that would be removed along with the space they take, without removing them
+// yet. With a memory limit only hashes of the paths are kept, and the paths are found again when
+// removing them.
+static void findRemovalCandidates(DirectoryWalker::Result& result, RemovalCandidates& candidates,
+	FileSystem& songDir, const DestinationIndex& destinations,
+	const std::unordered_set<std::uint64_t>& keptSongs, ExternalSorter* wantedSongs,
+	const SpacePlan& space, const Options& options)
+{
+	auto addCandidate = [&candidates, &songDir, &space](const std::string& relativePath)
+		{
+			FileSystem::FileInfo info;
+			std::uint64_t bytes = songDir.getFileInfo(info, relativePath) ?
+				space.getBlockBytes(info.size) : 0;
+			std::lock_guard<std::mutex> lock(candidates.mutex);
+			candidates.songs.emplace(Helpers::hashString(Helpers::foldCase(relativePath)), bytes);
+		};
+
+	if (wantedSongs)
+	{
+		findDeletedSongsBounded(result, songDir, *wantedSongs, options, addCandidate);
+		return;
+	}
+
+	DirectoryWalker walker(getScanThreadCount(options));
+	walker.removeFiles(result, songDir,
+		[&destinations, &keptSongs, &addCandidate](const std::string& relativePath)
+		{
+			if (!isWantedSong(relativePath, destinations, keptSongs))
+				addCandidate(relativePath);
+			return true;
+		});
+}
+
+// Removes the candidates that are left after the space check.
+static void removeCandidates(DirectoryWalker::Result& result, FileSystem& songDir,
+	const RemovalCandidates& candidates, SessionState& state, const Options& options)
+{
+	if (!candidates.keepAll && !candidates.songs.empty())
+	{
+		// Only the files removed by this walk are counted, since the songs were already scanned.
+		DirectoryWalker::Result removeResult;
+		DirectoryWalker walker(getScanThreadCount(options));
+		walker.removeFiles(removeResult, songDir,
+			[&candidates, &state](const std::string& relativePath)
+			{
+				if (state.isCancelled() || candidates.songs.count(
+						Helpers::hashString(Helpers::foldCase(relativePath))) == 0)
+				{
+					return true;
+				}
+
+				Log::verbose("Removing song '%s'.\n", relativePath.c_str());
+				state.removeDestination(relativePath);
+				return false;
+			});
+		result.filesRemoved += removeResult.filesRemoved;
+		result.errors += removeResult.errors;
+		result.emptyDirectories = std::move(removeResult.emptyDirectories);
+	}
+	addRemoveMetrics(result);
+}
+
+// Checks the songs held back for the space check against the free space on the device, getting
+// the number of songs to copy. The old songs that will be removed are counted as free. Returns
+// false if they don't all fit, in which case playlists are cancelled, either all of them or the
+// ones at the end of the order depending on the space check. The songs that cancelled playlists
+// refer to on the device are kept, which is repeated until the playlists that fit don't change.
+static bool planSongs(std::size_t& songCount, PlannedSongs& plannedSongs,
+	RemovalCandidates& candidates, PlaylistScheduler& scheduler, const FileSystems& fileSystems,
+	SessionState& state, const Options& options)
+{
+	songCount = plannedSongs.songs.size();
+	if (songCount == 0)
+		return true;
+	FileSystem& songOutput = *fileSystems.songOutput;
+	const SpacePlan& space = plannedSongs.space;
+
+	FileSystem::SpaceInfo spaceInfo;
+	if (!songOutput.getSpaceInfo(spaceInfo))
+	{
+		Log::error("Error: Couldn't get the free space of '%s'. Copying without checking it.\n",
+			songOutput.getRoot().c_str());
+		return true;
+	}
+
+	auto keepSong = [&candidates](const std::string& destination)
+		{
+			candidates.songs.erase(Helpers::hashString(Helpers::foldCase(destination)));
+		};
+	std::size_t playlistCount = space.getPlaylistCount();
+	std::uint64_t freeBytes;
+	do
+	{
+		freeBytes = spaceInfo.availableBytes;
+		if (!candidates.keepAll)
+		{
+			for (const auto& candidate : candidates.songs)
+				freeBytes += candidate.second;
+		}
+
+		std::size_t fittingCount = space.getFittingPlaylistCount(freeBytes);
+		if (fittingCount < space.getPlaylistCount() &&
+			options.spaceCheck == Options::SpaceCheck::Refuse)
+		{
+			fittingCount = 0;
+		}
+		if (fittingCount >= playlistCount)
+			break;
+
+		for (std::size_t i = fittingCount; i < playlistCount && !candidates.keepAll; ++i)
+		{
+			const PlannedPlaylist& playlist = plannedSongs.playlists[i];
+			if (playlist.written && PlaylistRecord::exists(songOutput, playlist.fileName) &&
+				!PlaylistRecord::read(songOutput, playlist.fileName, keepSong))
+			{
+				Log::error("Error: Couldn't read the songs in playlist '%s', so no songs will be "
+					"removed.\n", fileSystems.playlistOutput->getPath(playlist.fileName).c_str());
+				candidates.keepAll = true;
+			}
+		}
+		playlistCount = fittingCount;
+	} while (playlistCount > 0);
+
+	if (playlistCount == space.getPlaylistCount())
+		return true;
+
+	const double cMegabyte = 1024.0*1024.0;
+	if (options.spaceCheck == Options::SpaceCheck::Refuse)
+	{
+		Log::error("Error: Not enough space on '%s'. Copying the songs needs %.1f MB, but only "
+			"%.1f MB is free after removing old songs. No songs were copied.\n",
+			songOutput.getRoot().c_str(), space.getRequiredBytes()/cMegabyte,
+			freeBytes/cMegabyte);
+	}
+	else
+	{
+		Log::error("Error: Not enough space on '%s' for all playlists. Copying the songs needs "
+			"%.1f MB, but only %.1f MB is free after removing old songs. Skipping %zu playlists "
+			"starting with '%s'.\n", songOutput.getRoot().c_str(),
+			space.getRequiredBytes()/cMegabyte, freeBytes/cMegabyte,
+			space.getPlaylistCount() - playlistCount,
+			plannedSongs.playlists[playlistCount].fileName.c_str());
+	}
+
+	for (std::size_t i = playlistCount; i < plannedSongs.playlists.size(); ++i)
+	{
+		const PlannedPlaylist& playlist = plannedSongs.playlists[i];
+		if (!playlist.written)
+			continue;
+
+		Log::verbose("Skipping playlist '%s'.\n",
+			fileSystems.playlistOutput->getPath(playlist.fileName).c_str());
+		scheduler.cancelPlaylist(playlist.id);
+		Playlist::Writer::discard(*fileSystems.playlistOutput, playlist.fileName);
+		PlaylistRecord::discard(songOutput, playlist.fileName);
+	}
+
+	// Later playlists only add songs after the ones from earlier playlists.
+	if (playlistCount < plannedSongs.playlists.size())
+		songCount = plannedSongs.playlists[playlistCount].firstSong;
+	std::size_t songsSkipped = plannedSongs.songs.size() - songCount;
+	state.updateProgress(
+		[songsSkipped](SyncSession::Progress& progress) {progress.songsFound -= songsSkipped;});
+	return false;
+}
+
+// Adds what a sync depends on that's cheap to check to a stamp, getting the playlists that are
+// synchronized. The songs themselves aren't checked, only the playlists that refer to them.
+static bool addSourceStamp(SyncStamp& stamp, std::vector<std::string>& playlists,
+	FileSystem& playlistDir, const std::unordered_map<std::string, std::size_t>& priorities,
+	const Options& options)
+{
+	for (bool flag : {options.removePlaylists, options.removeSongs, options.windowsSeparators,
+			options.noUnicode, options.dedupeContents, options.verify, options.stripArtwork})
+	{
+		stamp.add(static_cast<std::uint64_t>(flag));
+	}
+	for (unsigned int value : {static_cast<unsigned int>(options.compareMode),
+			static_cast<unsigned int>(options.playlistOrder),
+			static_cast<unsigned int>(options.spaceCheck),
+			static_cast<unsigned int>(options.splitDirectories),
+			static_cast<unsigned int>(options.hashAlgorithm)})
+	{
+		stamp.add(static_cast<std::uint64_t>(value));
+	}
+	stamp.add(static_cast<std::uint64_t>(options.maxDirectorySongs));
+	for (const std::vector<std::string>* strings :
+			{&options.includePlaylists, &options.excludePlaylists, &options.pathTrims})
+	{
+		stamp.add(static_cast<std::uint64_t>(strings->size()));
+		for (const std::string& string : *strings)
+			stamp.add(string);
+	}
+	for (const std::string* string : {&options.pathPrefix, &options.playlistInput,
+			&options.playlistOutput, &options.songOutput})
+	{
+		stamp.add(*string);
+	}
+
+	std::vector<std::string> priorityOrder(priorities.size());
+	for (const auto& priority : priorities)
+		priorityOrder[priority.second] = priority.first;
+	for (const std::string& fileName : priorityOrder)
+		stamp.add(fileName);
+
+	std::vector<FileSystem::DirectoryEntry> entries;
+	if (!playlistDir.listDirectory(entries, std::string()))
+		return false;
+
+	for (const FileSystem::DirectoryEntry& entry : entries)
+	{
+		if (isPlaylist(entry) && isPlaylistSelected(entry.name, options))
+			playlists.push_back(entry.name);
+	}
+	std::sort(playlists.begin(), playlists.end());
+
+	for (const std::string& fileName : playlists)
+	{
+		FileSystem::FileInfo info;
+		if (!playlistDir.getFileInfo(info, fileName))
+			return false;
+
+		stamp.add(fileName);
+		stamp.add(info);
+	}
+	return true;
+}
+
+// Adds the playlists written to the device to a stamp, so changes to them on the device are found.
+static void addDeviceStamp(SyncStamp& stamp, const std::vector<std::string>& playlists,
+	FileSystem& playlistDir)
+{
+	for (const std::string& fileName : playlists)
+	{
+		FileSystem::FileInfo info;
+		stamp.add(fileName);
+		if (playlistDir.getFileInfo(info, fileName))
+			stamp.add(info);
+	}
+}
+
+static bool flushToDevice(FileSystem& directory)
+{
+	const std::string& path = directory.getRoot();
+	Log::info("Flushing '%s' to the device...\n", path.c_str());
+
+	// Flush the whole file system once rather than each file so the device can write everything
+	// in the order it prefers.
+	if (!directory.syncFileSystem())
+	{
+		Log::error("Error: Couldn't flush '%s' to the device.\n", path.c_str());
+		return false;
+	}
+
+	Log::info("Done.\n");
+	return true;
+}
+
+} // namespace
+
+namespace Logic
+{
+
+bool syncMusic(const Options& options, SessionState& state)
+{
+	Metrics::add(Metrics::Counter::Syncs);
+	FileSystems fileSystems;
+	if (!openFileSystems(fileSystems, state.getOpener(), options))
+		return false;
+
+	std::unordered_map<std::string, std::size_t> priorities;
+	if (!readPlaylistPriorities(priorities, options))
+		return false;
+
+	// The stamp is taken before reading the playlists, so changes made while synchronizing are
+	// found by the next sync.
+	SyncStamp sourceStamp;
+	std::vector<std::string> stampPlaylists;
+	bool stamped = options.skipUnchanged && addSourceStamp(sourceStamp, stampPlaylists,
+		*fileSystems.playlistInput, priorities, options);
+	if (stamped)
+	{
+		SyncStamp stamp = sourceStamp;
+		addDeviceStamp(stamp, stampPlaylists, *fileSystems.playlistOutput);
+		std::string savedStamp;
+		if (SyncStamp::load(savedStamp, *fileSystems.songOutput) && savedStamp == stamp.get())
+		{
+			state.updateProgress(
+				[](SyncSession::Progress& progress) {progress.playlistsDone = true;});
+			Log::info("Nothing changed since the last sync.\n");
+			return true;
+		}
+	}
+
+	// The stamp is only kept by a sync that finishes.
+	if (!SyncStamp::remove(*fileSystems.songOutput))
+	{
+		Log::error("Error: Couldn't remove the state of '%s'.\n", options.songOutput.c_str());
+		return false;
+	}
+
+	// Skipped playlists refer to songs at their current paths, so songs are only moved to a new
+	// layout when every playlist is synchronized.
+	SongLayout layout(*fileSystems.songOutput, options.splitDirectories,
+		options.maxDirectorySongs);
+	if (!layout.load(!hasPlaylistFilter(options)))
+	{
+		Log::error("Error: Couldn't read the layout of '%s'.\n", options.songOutput.c_str());
+		return false;
+	}
+	if (layout.isMoving())
+		Log::info("Moving songs to a new layout.\n");
+
+	Log::info("Synchronizing songs...\n");
+
+	// Playlists are read on one thread and songs are copied on another, with the main thread
+	// finding the songs to copy in between. Copying starts as soon as the first song is found,
+	// and songs are copied in playlist order so each playlist can be written as soon as all of
+	// its songs are on the device.
+	PlaylistWriter playlistWriter(*fileSystems.playlistOutput, *fileSystems.songOutput, options);
+	PlaylistScheduler scheduler(
+		[&playlistWriter](const std::string& fileName)
+		{
+			playlistWriter.write(fileName);
+		},
+		[&playlistWriter](const std::string& fileName)
+		{
+			playlistWriter.discard(fileName);
+		});
+
+	BoundedQueue<PlaylistInfo> playlistQueue(cPlaylistQueueSize);
+	BoundedQueue<SongJob> songQueue(cSongQueueSize);
+	std::thread readThread([&playlistQueue, &fileSystems, &state, &priorities, &options]()
+		{
+			readPlaylists(playlistQueue, *fileSystems.playlistInput, state, priorities, options);
+		});
+	std::thread copyThread;
+	auto startCopying = [&copyThread, &songQueue, &scheduler, &fileSystems, &state, &options]()
+		{
+			copyThread = std::thread([&songQueue, &scheduler, &fileSystems, &state, &options]()
+				{
+					syncSongs(songQueue, scheduler, fileSystems, state, options);
+				});
+		};
+
+	// When checking the space, copying waits until the songs to copy are known and old songs
+	// have been removed.
+	std::unique_ptr<PlannedSongs> plannedSongs;
+	if (options.spaceCheck != Options::SpaceCheck::None)
+	{
+		FileSystem::SpaceInfo spaceInfo;
+		if (fileSystems.songOutput->getSpaceInfo(spaceInfo))
+			plannedSongs.reset(new PlannedSongs(*fileSystems.songOutput, spaceInfo.blockSize));
+		else
+		{
+			Log::error("Error: Couldn't get the free space of '%s'. Copying without checking it.\n",
+				fileSystems.songOutput->getRoot().c_str());
+		}
+	}
+	if (!plannedSongs)
+		startCopying();
+
+	// With a memory limit, the songs to keep are spilled to disk rather than checked against the
+	// destination index.
+	std::unique_ptr<ExternalSorter> wantedSongs;
+	if (options.removeSongs && options.memoryLimit > 0)
+		wantedSongs.reset(new ExternalSorter(options.memoryLimit/2));
+
+	std::unordered_set<std::string> playlists;
+	// Songs are identified by the files they resolve to on the source file systems. The paths are
+	// spilled to disk along with the other song lists when the memory is limited.
+	SourceIndex sources(*fileSystems.sources, options.dedupeContents, options.hashAlgorithm,
+		options.memoryLimit > 0);
+	DestinationIndex destinations;
+	if (!destinations.load(*fileSystems.songOutput))
+	{
+		Log::error("Error: Couldn't read the owners of songs in '%s'.\n",
+			options.songOutput.c_str());
+	}
+	PlaylistInfo playlistInfo;
+	bool playlistsFailed = false;
+	while (!state.isCancelled() && playlistQueue.pop(playlistInfo))
+	{
+		if (addPlaylist(sources, destinations, layout, scheduler, songQueue, plannedSongs.get(),
+				wantedSongs.get(), state, fileSystems, playlistInfo, options))
+		{
+			playlists.insert(std::move(playlistInfo.fileName));
+		}
+		else
+			playlistsFailed = true;
+	}
+	// Closing wakes up the read thread if it's waiting to push after being cancelled.
+	playlistQueue.close();
+	if (!plannedSongs)
+		songQueue.close();
+	readThread.join();
+	state.updateProgress([](SyncSession::Progress& progress) {progress.playlistsDone = true;});
+
+	// All songs are known at this point, so anything else can be removed while copying, or
+	// before copying to free space when checking it. Nothing is removed when cancelled, since the
+	// songs that are wanted may not be known. Playlists that are skipped and their songs are also
+	// kept. When checking the space, the songs to remove are only found here so the space check
+	// can count them and keep the songs of playlists it cancels.
+	DirectoryWalker::Result removeResult;
+	RemovalCandidates removalCandidates;
+	bool removeSongs = false;
+	if (!state.isCancelled())
+	{
+		if (options.removePlaylists)
+		{
+			removeDeletedPlaylists(*fileSystems.playlistOutput, *fileSystems.songOutput,
+				playlists, options);
+		}
+
+		std::unordered_set<std::uint64_t> keptSongs(layout.getKeptPaths());
+		removeSongs = options.removeSongs && (!hasPlaylistFilter(options) ||
+			keepSkippedPlaylistSongs(keptSongs, wantedSongs.get(), *fileSystems.playlistOutput,
+				*fileSystems.songOutput, options));
+		if (removeSongs && plannedSongs)
+		{
+			findRemovalCandidates(removeResult, removalCandidates, *fileSystems.songOutput,
+				destinations, keptSongs, wantedSongs.get(), plannedSongs->space, options);
+		}
+		else if (removeSongs && wantedSongs)
+		{
+			removeDeletedSongsBounded(removeResult, *fileSystems.songOutput, *wantedSongs,
+				options);
+		}
+		else if (removeSongs)
+		{
+			removeDeletedSongs(removeResult, *fileSystems.songOutput, destinations, keptSongs,
+				state, options);
+		}
+	}
+
+	bool spaceShort = false;
+	if (plannedSongs)
+	{
+		std::size_t songCount = 0;
+		spaceShort = !state.isCancelled() && !planSongs(songCount, *plannedSongs,
+			removalCandidates, scheduler, fileSystems, state, options);
+		if (removeSongs && !state.isCancelled())
+		{
+			removeCandidates(removeResult, *fileSystems.songOutput, removalCandidates, state,
+				options);
+		}
+
+		startCopying();
+		for (std::size_t i = 0; i < songCount && !state.isCancelled(); ++i)
+			songQueue.push(std::move(plannedSongs->songs[i]));
+		songQueue.close();
+	}
+	copyThread.join();
+	assert(state.isCancelled() || scheduler.getPendingPlaylists().empty());
+
+	if (state.isCancelled())
+	{
+		for (const std::string& fileName : scheduler.getPendingPlaylists())
+		{
+			Playlist::Writer::discard(*fileSystems.playlistOutput, fileName);
+			PlaylistRecord::discard(*fileSystems.songOutput, fileName);
+		}
+
+		Log::info("Cancelled.\n");
+		return false;
+	}
+
+	// Directories may be re-used for copied songs, so only remove them once copying is done.
+	DirectoryWalker::removeEmptyDirectories(removeResult, *fileSystems.songOutput);
+	bool movesFinished = !spaceShort && !playlistsFailed && state.getProgress().songsFailed == 0;
+	bool layoutSaved = layout.save(movesFinished);
+	if (!layoutSaved)
+	{
+		Log::error("Error: Couldn't write the layout of '%s'.\n",
+			options.songOutput.c_str());
+	}
+	// The previous owners are also needed to find the previous paths of songs that weren't moved.
+	bool ownersSaved = destinations.save(*fileSystems.songOutput,
+		hasPlaylistFilter(options) || playlistsFailed || !movesFinished);
+	if (!ownersSaved)
+	{
+		Log::error("Error: Couldn't write the owners of songs in '%s'.\n",
+			options.songOutput.c_str());
+	}
+	std::size_t songsRemoved = removeResult.filesRemoved;
+	state.updateProgress(
+		[songsRemoved](SyncSession::Progress& progress) {progress.songsRemoved = songsRemoved;});
+
+	// Individual songs are only listed when verbose, so summarize what changed.
+	SyncSession::Progress progress = state.getProgress();
+	const double cMegabyte = 1024.0*1024.0;
+	Log::info("Done. Copied %zu of %zu songs (%.1f MB) and removed %zu songs.\n",
+		progress.songsCopied, progress.songsFound, progress.bytesCopied/cMegabyte,
+		progress.songsRemoved);
+	if (progress.songsFailed > 0)
+		Log::error("Error: Couldn't synchronize %zu songs.\n", progress.songsFailed);
+
+	// Only a sync that left nothing to do may be skipped by the next one.
+	bool finished = !playlistsFailed && progress.songsFailed == 0 && !spaceShort &&
+		layoutSaved && ownersSaved && !layout.willMove();
+	if (stamped && finished)
+	{
+		addDeviceStamp(sourceStamp, stampPlaylists, *fileSystems.playlistOutput);
+		if (!SyncStamp::save(*fileSystems.songOutput, sourceStamp.get()))
+		{
+			Log::error("Error: Couldn't write the state of '%s'.\n",
+				options.songOutput.c_str());
+		}
+	}
+
+	if (options.durable)
+	{
+		Log::info("\n");
+		if (!flushToDevice(*fileSystems.songOutput) ||
+			!flushToDevice(*fileSystems.playlistOutput))
+			return false;
+	}
+
+	return !spaceShort || options.spaceCheck != Options::SpaceCheck::Refuse;
 }
 
 }
@@ -17,10 +17,12 @@
 #pragma once
 
 class Options;
+class SessionState;
 
 namespace Logic
 {
 
-bool syncMusic(const Options& options);
+// Use SyncSession rather than calling this directly.
+bool syncMusic(const Options& options, SessionState& state);
 
 }
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HashKernels.h"
+
+#if MUSICSYNC_HAS_AVX2
+
+#include <immintrin.h>
+
+namespace HashKernels
+{
+
+namespace
+{
+
+inline __m256i rotateLeft(__m256i value, unsigned int shift)
+{
+	return _mm256_or_si256(_mm256_slli_epi32(value, shift), _mm256_srli_epi32(value, 32 - shift));
+}
+
+// Transposes 8 rows of 8 words so each output holds the same word from every lane.
+inline void transpose(__m256i rows[8])
+{
+	__m256i t0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+	__m256i t1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+	__m256i t2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+	__m256i t3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+	__m256i t4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+	__m256i t5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+	__m256i t6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+	__m256i t7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+} // namespace
+
+void md5BlocksAvx2(Md5Lanes& lanes, const std::uint8_t* const data[cMd5Lanes],
+	std::size_t blockCount)
+{
+	__m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.a));
+	__m256i b = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.b));
+	__m256i c = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.c));
+	__m256i d = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes.d));
+	const __m256i ones = _mm256_set1_epi32(-1);
+
+	for (std::size_t block = 0; block < blockCount; ++block)
+	{
+		// Each lane is a row of the message, so transpose each half of the block to get a vector
+		// for each message word.
+		__m256i words[16];
+		std::size_t offset = block*cMd5BlockSize;
+		for (unsigned int half = 0; half < 2; ++half)
+		{
+			__m256i* rows = words + half*8;
+			for (unsigned int lane = 0; lane < cMd5Lanes; ++lane)
+			{
+				rows[lane] = _mm256_loadu_si256(
+					reinterpret_cast<const __m256i*>(data[lane] + offset + half*32));
+			}
+			transpose(rows);
+		}
+
+		__m256i origA = a, origB = b, origC = c, origD = d;
+		for (unsigned int step = 0; step < 64; ++step)
+		{
+			__m256i f;
+			switch (step/16)
+			{
+				case 0:
+					f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+					break;
+				case 1:
+					f = _mm256_xor_si256(c, _mm256_and_si256(d, _mm256_xor_si256(b, c)));
+					break;
+				case 2:
+					f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+					break;
+				default:
+					f = _mm256_xor_si256(c, _mm256_or_si256(b, _mm256_xor_si256(d, ones)));
+					break;
+			}
+
+			f = _mm256_add_epi32(f, a);
+			f = _mm256_add_epi32(f, _mm256_set1_epi32(static_cast<int>(cMd5Constants[step])));
+			f = _mm256_add_epi32(f, words[getMd5MessageIndex(step)]);
+			a = d;
+			d = c;
+			c = b;
+			b = _mm256_add_epi32(b, rotateLeft(f, getMd5Shift(step)));
+		}
+
+		a = _mm256_add_epi32(a, origA);
+		b = _mm256_add_epi32(b, origB);
+		c = _mm256_add_epi32(c, origC);
+		d = _mm256_add_epi32(d, origD);
+	}
+
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes.a), a);
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes.b), b);
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes.c), c);
+	_mm256_store_si256(reinterpret_cast<__m256i*>(lanes.d), d);
+}
+
+} // namespace HashKernels
+
+#endif // MUSICSYNC_HAS_AVX2
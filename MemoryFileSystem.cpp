@@ -0,0 +1,381 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MemoryFileSystem.h"
+
+#include "Helpers.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+
+std::int64_t getCurrentTime()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Full paths always start with a separator and never end with one, so the top level directory is
+// an empty string.
+std::string normalizePath(const std::string& path)
+{
+	std::string normalized;
+	if (path.empty() || path.front() != Helpers::cPathSeparator)
+		normalized.push_back(Helpers::cPathSeparator);
+	normalized += path;
+	while (!normalized.empty() && normalized.back() == Helpers::cPathSeparator)
+		normalized.pop_back();
+	return normalized;
+}
+
+std::string getParentPath(const std::string& path)
+{
+	std::size_t separator = path.rfind(Helpers::cPathSeparator);
+	return separator == std::string::npos ? std::string() : path.substr(0, separator);
+}
+
+} // namespace
+
+class MemoryFileSystem::MemoryReadFile : public FileSystem::ReadFile
+{
+public:
+	MemoryReadFile(std::shared_ptr<Device> device, std::shared_ptr<Device::FileData> data)
+		: m_device(std::move(device)), m_data(std::move(data)), m_offset(0)
+	{
+	}
+
+	bool getInfo(FileInfo& info) override
+	{
+		std::lock_guard<std::mutex> lock(m_device->m_mutex);
+		info.size = m_data->contents.size();
+		info.modifiedTime = m_data->modifiedTime;
+		info.device = reinterpret_cast<std::uintptr_t>(m_device.get());
+		info.fileId = reinterpret_cast<std::uintptr_t>(m_data.get());
+		return true;
+	}
+
+	std::ptrdiff_t read(void* data, std::size_t size) override
+	{
+		std::lock_guard<std::mutex> lock(m_device->m_mutex);
+		const std::string& contents = m_data->contents;
+		if (m_offset >= contents.size())
+			return 0;
+
+		size = std::min(size, contents.size() - m_offset);
+		std::memcpy(data, contents.data() + m_offset, size);
+		m_offset += size;
+		return size;
+	}
+
+private:
+	std::shared_ptr<Device> m_device;
+	std::shared_ptr<Device::FileData> m_data;
+	std::size_t m_offset;
+};
+
+class MemoryFileSystem::MemoryWriteFile : public FileSystem::WriteFile
+{
+public:
+	MemoryWriteFile(std::shared_ptr<Device> device, std::shared_ptr<Device::FileData> data)
+		: m_device(std::move(device)), m_data(std::move(data))
+	{
+	}
+
+	bool write(const void* data, std::size_t size) override
+	{
+		std::lock_guard<std::mutex> lock(m_device->m_mutex);
+		m_data->contents.append(reinterpret_cast<const char*>(data), size);
+		m_data->modifiedTime = getCurrentTime();
+		return true;
+	}
+
+	bool truncate(std::uint64_t size) override
+	{
+		std::lock_guard<std::mutex> lock(m_device->m_mutex);
+		m_data->contents.resize(size);
+		m_data->modifiedTime = getCurrentTime();
+		return true;
+	}
+
+	bool setModifiedTime(std::int64_t modifiedTime) override
+	{
+		std::lock_guard<std::mutex> lock(m_device->m_mutex);
+		m_data->modifiedTime = modifiedTime;
+		return true;
+	}
+
+	bool close() override
+	{
+		return true;
+	}
+
+	void preallocate(std::uint64_t size) override
+	{
+		std::lock_guard<std::mutex> lock(m_device->m_mutex);
+		m_data->contents.reserve(size);
+	}
+
+private:
+	std::shared_ptr<Device> m_device;
+	std::shared_ptr<Device::FileData> m_data;
+};
+
+bool MemoryFileSystem::Device::addFile(const std::string& path, std::string contents,
+	std::int64_t modifiedTime)
+{
+	std::string fullPath = normalizePath(path);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!addDirectories(getParentPath(fullPath)))
+		return false;
+
+	auto foundIter = m_files.find(fullPath);
+	if (foundIter != m_files.end() && !foundIter->second)
+		return false;
+
+	m_files[fullPath] = std::make_shared<FileData>(FileData{std::move(contents), modifiedTime});
+	return true;
+}
+
+bool MemoryFileSystem::Device::addDirectory(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return addDirectories(normalizePath(path));
+}
+
+std::uint64_t MemoryFileSystem::Device::getTotalSize() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::uint64_t size = 0;
+	for (const auto& file : m_files)
+	{
+		if (file.second)
+			size += file.second->contents.size();
+	}
+	return size;
+}
+
+bool MemoryFileSystem::Device::addDirectories(const std::string& path)
+{
+	for (std::size_t separator = path.find(Helpers::cPathSeparator, 1);;
+		separator = path.find(Helpers::cPathSeparator, separator + 1))
+	{
+		std::string directory = path.substr(0, separator);
+		if (!directory.empty())
+		{
+			auto insertResult = m_files.emplace(directory, nullptr);
+			if (!insertResult.second && insertResult.first->second)
+				return false;
+		}
+
+		if (separator == std::string::npos)
+			return true;
+	}
+}
+
+MemoryFileSystem::MemoryFileSystem(std::shared_ptr<Device> device, const std::string& root)
+	: m_device(std::move(device)), m_root(root)
+{
+}
+
+FileSystem::Opener MemoryFileSystem::getOpener(std::shared_ptr<Device> device)
+{
+	return [device](const std::string& root, bool create) -> std::unique_ptr<FileSystem>
+	{
+		std::unique_ptr<MemoryFileSystem> fileSystem(new MemoryFileSystem(device, root));
+		std::string fullPath = fileSystem->getFullPath(std::string());
+		std::lock_guard<std::mutex> lock(device->m_mutex);
+		if (!fullPath.empty())
+		{
+			auto foundIter = device->m_files.find(fullPath);
+			if (foundIter == device->m_files.end())
+			{
+				if (!create || !device->addDirectories(fullPath))
+					return nullptr;
+			}
+			else if (foundIter->second)
+				return nullptr;
+		}
+		return fileSystem;
+	};
+}
+
+bool MemoryFileSystem::getFileInfo(FileInfo& info, const std::string& relativePath)
+{
+	std::lock_guard<std::mutex> lock(m_device->m_mutex);
+	auto foundIter = m_device->m_files.find(getFullPath(relativePath));
+	if (foundIter == m_device->m_files.end() || !foundIter->second)
+		return false;
+
+	info.size = foundIter->second->contents.size();
+	info.modifiedTime = foundIter->second->modifiedTime;
+	// File data is shared by every path to a file, so its address identifies it while it exists.
+	info.device = reinterpret_cast<std::uintptr_t>(m_device.get());
+	info.fileId = reinterpret_cast<std::uintptr_t>(foundIter->second.get());
+	return true;
+}
+
+bool MemoryFileSystem::listDirectory(std::vector<DirectoryEntry>& entries,
+	const std::string& relativeDir)
+{
+	std::string prefix = getFullPath(relativeDir);
+	std::lock_guard<std::mutex> lock(m_device->m_mutex);
+	const Device::FileMap& files = m_device->m_files;
+	if (!prefix.empty())
+	{
+		auto foundIter = files.find(prefix);
+		if (foundIter == files.end() || foundIter->second)
+			return false;
+	}
+
+	// Entries under subdirectories share the subdirectory path as a prefix, so skip past them.
+	entries.clear();
+	prefix.push_back(Helpers::cPathSeparator);
+	auto iter = files.lower_bound(prefix);
+	while (iter != files.end() && iter->first.compare(0, prefix.size(), prefix) == 0)
+	{
+		std::size_t separator = iter->first.find(Helpers::cPathSeparator, prefix.size());
+		if (separator != std::string::npos)
+		{
+			std::string next = iter->first.substr(0, separator);
+			next.push_back(Helpers::cPathSeparator + 1);
+			iter = files.lower_bound(next);
+			continue;
+		}
+
+		entries.push_back(DirectoryEntry{iter->first.substr(prefix.size()),
+			iter->second ? EntryType::File : EntryType::Directory});
+		++iter;
+	}
+	return true;
+}
+
+bool MemoryFileSystem::createParentDirectories(const std::string& relativePath)
+{
+	std::string parent = getParentPath(getFullPath(relativePath));
+	std::lock_guard<std::mutex> lock(m_device->m_mutex);
+	return m_device->addDirectories(parent);
+}
+
+bool MemoryFileSystem::removeFile(const std::string& relativePath)
+{
+	std::lock_guard<std::mutex> lock(m_device->m_mutex);
+	auto foundIter = m_device->m_files.find(getFullPath(relativePath));
+	if (foundIter == m_device->m_files.end() || !foundIter->second)
+		return false;
+
+	m_device->m_files.erase(foundIter);
+	return true;
+}
+
+bool MemoryFileSystem::removeDirectory(const std::string& relativeDir)
+{
+	std::string fullPath = getFullPath(relativeDir);
+	std::lock_guard<std::mutex> lock(m_device->m_mutex);
+	Device::FileMap& files = m_device->m_files;
+	auto foundIter = files.find(fullPath);
+	if (foundIter == files.end() || foundIter->second)
+		return false;
+
+	// The next entry would be the first child if it isn't empty.
+	auto nextIter = std::next(foundIter);
+	if (nextIter != files.end() && nextIter->first.size() > fullPath.size() &&
+		nextIter->first.compare(0, fullPath.size(), fullPath) == 0 &&
+		nextIter->first[fullPath.size()] == Helpers::cPathSeparator)
+	{
+		return false;
+	}
+
+	files.erase(foundIter);
+	return true;
+}
+
+bool MemoryFileSystem::renameFile(const std::string& fromPath, const std::string& toPath)
+{
+	std::string fullFromPath = getFullPath(fromPath);
+	std::string fullToPath = getFullPath(toPath);
+	std::string toParent = getParentPath(fullToPath);
+	std::lock_guard<std::mutex> lock(m_device->m_mutex);
+	Device::FileMap& files = m_device->m_files;
+	auto fromIter = files.find(fullFromPath);
+	if (fromIter == files.end() || !fromIter->second)
+		return false;
+
+	if (!toParent.empty())
+	{
+		auto parentIter = files.find(toParent);
+		if (parentIter == files.end() || parentIter->second)
+			return false;
+	}
+
+	auto toIter = files.find(fullToPath);
+	if (toIter != files.end() && !toIter->second)
+		return false;
+
+	std::shared_ptr<Device::FileData> data = std::move(fromIter->second);
+	files.erase(fromIter);
+	files[fullToPath] = std::move(data);
+	return true;
+}
+
+std::unique_ptr<FileSystem::ReadFile> MemoryFileSystem::openRead(
+	const std::string& relativePath, ReadMode)
+{
+	std::lock_guard<std::mutex> lock(m_device->m_mutex);
+	auto foundIter = m_device->m_files.find(getFullPath(relativePath));
+	if (foundIter == m_device->m_files.end() || !foundIter->second)
+		return nullptr;
+
+	return std::unique_ptr<ReadFile>(new MemoryReadFile(m_device, foundIter->second));
+}
+
+std::unique_ptr<FileSystem::WriteFile> MemoryFileSystem::openWrite(
+	const std::string& relativePath)
+{
+	std::string fullPath = getFullPath(relativePath);
+	std::string parent = getParentPath(fullPath);
+	std::lock_guard<std::mutex> lock(m_device->m_mutex);
+	Device::FileMap& files = m_device->m_files;
+	if (!parent.empty())
+	{
+		auto parentIter = files.find(parent);
+		if (parentIter == files.end() || parentIter->second)
+			return nullptr;
+	}
+
+	auto foundIter = files.find(fullPath);
+	if (foundIter != files.end() && !foundIter->second)
+		return nullptr;
+
+	// Files that are already open keep the previous contents, like replacing the file.
+	auto data = std::make_shared<Device::FileData>(
+		Device::FileData{std::string(), getCurrentTime()});
+	files[fullPath] = data;
+	return std::unique_ptr<WriteFile>(new MemoryWriteFile(m_device, data));
+}
+
+std::string MemoryFileSystem::getFullPath(const std::string& relativePath) const
+{
+	std::string fullPath = normalizePath(m_root);
+	if (!relativePath.empty())
+	{
+		fullPath.push_back(Helpers::cPathSeparator);
+		fullPath += relativePath;
+	}
+	return fullPath;
+}
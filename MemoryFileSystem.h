@@ -0,0 +1,96 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "FileSystem.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// File system that keeps all files in memory. This allows a library and device to be set up
+// without touching the disk, such as for benchmarks.
+//
+// All file systems opened on the same device share the same files, so different roots may be used
+// for the playlists and songs like with the real file system. Roots are absolute paths with '/'
+// separators.
+class MemoryFileSystem : public FileSystem
+{
+public:
+	class Device
+	{
+	public:
+		// Adds a file, creating any parent directories. The modified time is in nanoseconds since
+		// the Unix epoch.
+		bool addFile(const std::string& path, std::string contents, std::int64_t modifiedTime);
+		bool addDirectory(const std::string& path);
+
+		// Gets the total size of all files.
+		std::uint64_t getTotalSize() const;
+
+	private:
+		friend class MemoryFileSystem;
+
+		struct FileData
+		{
+			std::string contents;
+			std::int64_t modifiedTime;
+		};
+
+		// Files and directories are stored by full path, so all entries in a directory are next
+		// to each other. Directories have no data.
+		using FileMap = std::map<std::string, std::shared_ptr<FileData>>;
+
+		bool addDirectories(const std::string& path);
+
+		mutable std::mutex m_mutex;
+		FileMap m_files;
+	};
+
+	MemoryFileSystem(std::shared_ptr<Device> device, const std::string& root);
+
+	// Opens file systems on a device. Roots that don't exist are only created if requested.
+	static Opener getOpener(std::shared_ptr<Device> device);
+
+	const std::string& getRoot() const override	{return m_root;}
+	FileSystemType getFileSystemType() const override	{return FileSystemType::Unknown;}
+	bool getSpaceInfo(SpaceInfo&) const override	{return false;}
+
+	bool getFileInfo(FileInfo& info, const std::string& relativePath) override;
+	bool listDirectory(std::vector<DirectoryEntry>& entries,
+		const std::string& relativeDir) override;
+	bool createParentDirectories(const std::string& relativePath) override;
+	bool removeFile(const std::string& relativePath) override;
+	bool removeDirectory(const std::string& relativeDir) override;
+	bool renameFile(const std::string& fromPath, const std::string& toPath) override;
+
+	std::unique_ptr<ReadFile> openRead(const std::string& relativePath,
+		ReadMode mode = ReadMode::Normal) override;
+	std::unique_ptr<WriteFile> openWrite(const std::string& relativePath) override;
+
+	bool syncFileSystem() override	{return true;}
+
+private:
+	class MemoryReadFile;
+	class MemoryWriteFile;
+
+	std::string getFullPath(const std::string& relativePath) const;
+
+	std::shared_ptr<Device> m_device;
+	std::string m_root;
+};
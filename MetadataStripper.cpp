@@ -0,0 +1,254 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MetadataStripper.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+const std::size_t cProbeSize = 4;
+const std::size_t cId3HeaderSize = 10;
+const unsigned char cId3Unsynchronisation = 0x80;
+const unsigned char cId3ExtendedHeader = 0x40;
+const unsigned char cId3Footer = 0x10;
+// Larger tags are copied unchanged rather than held in memory.
+const std::uint32_t cMaxTagSize = 64*1024*1024;
+
+const std::size_t cFlacBlockHeaderSize = 4;
+const unsigned char cFlacLastBlock = 0x80;
+const unsigned char cFlacPadding = 1;
+const unsigned char cFlacPicture = 6;
+
+const std::size_t cSkipBufferSize = 64*1024;
+
+// Appends up to size bytes to data, returning the number of bytes read or -1 on error.
+std::ptrdiff_t readAppend(std::string& data, std::size_t size,
+	const MetadataStripper::ReadFunction& read)
+{
+	std::size_t start = data.size();
+	data.resize(start + size);
+	std::ptrdiff_t readSize = size == 0 ? 0 : read(&data[start], size);
+	data.resize(start + std::max(readSize, std::ptrdiff_t(0)));
+	return readSize;
+}
+
+bool readExact(std::string& data, std::size_t size, const MetadataStripper::ReadFunction& read)
+{
+	return readAppend(data, size, read) == static_cast<std::ptrdiff_t>(size);
+}
+
+bool skip(std::size_t size, const MetadataStripper::ReadFunction& read)
+{
+	std::vector<char> buffer(std::min(size, cSkipBufferSize));
+	while (size > 0)
+	{
+		std::size_t chunkSize = std::min(size, buffer.size());
+		if (read(buffer.data(), chunkSize) != static_cast<std::ptrdiff_t>(chunkSize))
+			return false;
+		size -= chunkSize;
+	}
+	return true;
+}
+
+std::uint32_t readBigEndian(const char* data, unsigned int byteCount)
+{
+	std::uint32_t value = 0;
+	for (unsigned int i = 0; i < byteCount; ++i)
+		value = (value << 8) | static_cast<unsigned char>(data[i]);
+	return value;
+}
+
+// Sizes in ID3v2 headers only use the low 7 bits of each byte. Returns false if it's invalid.
+bool readSyncSafe(std::uint32_t& value, const char* data)
+{
+	value = 0;
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		unsigned char c = static_cast<unsigned char>(data[i]);
+		if (c & 0x80)
+			return false;
+		value = (value << 7) | c;
+	}
+	return true;
+}
+
+void writeSyncSafe(char* data, std::uint32_t value)
+{
+	for (unsigned int i = 0; i < 4; ++i)
+		data[i] = static_cast<char>((value >> (7*(3 - i))) & 0x7F);
+}
+
+bool isPictureFrame(const char* id, unsigned char version)
+{
+	if (version == 2)
+		return std::memcmp(id, "PIC", 3) == 0;
+	return std::memcmp(id, "APIC", 4) == 0;
+}
+
+// Removes the pictures and padding from the frames of an ID3v2 tag.
+std::string stripId3Frames(const std::string& frames, unsigned char version)
+{
+	// Version 2.2 uses 3 character IDs and 3 byte sizes, while 2.4 uses sync safe sizes.
+	std::size_t headerSize = version == 2 ? 6 : 10;
+	std::size_t idSize = version == 2 ? 3 : 4;
+	std::string output;
+	std::size_t offset = 0;
+	while (frames.size() - offset >= headerSize && frames[offset] != 0)
+	{
+		const char* header = frames.data() + offset;
+		std::uint32_t frameSize;
+		if (version == 4)
+		{
+			if (!readSyncSafe(frameSize, header + idSize))
+				break;
+		}
+		else
+			frameSize = readBigEndian(header + idSize, version == 2 ? 3 : 4);
+
+		if (frames.size() - offset - headerSize < frameSize)
+			break;
+
+		if (!isPictureFrame(header, version))
+			output.append(header, headerSize + frameSize);
+		offset += headerSize + frameSize;
+	}
+
+	// Keep anything that couldn't be parsed as is. Otherwise what's left is padding.
+	if (offset < frames.size() && frames[offset] != 0)
+		output.append(frames, offset, std::string::npos);
+	return output;
+}
+
+// Reads the rest of an ID3v2 tag whose first bytes are in output, replacing it with the stripped
+// tag. Returns false on a read error, and sets stripped to false if the tag must be copied as is.
+// Truncated tags are also copied as is, the same as when not stripping.
+bool stripId3(std::string& output, bool& stripped, const MetadataStripper::ReadFunction& read)
+{
+	stripped = false;
+	std::size_t tagStart = output.size() - cProbeSize;
+	std::size_t remainingHeaderSize = cId3HeaderSize - cProbeSize;
+	std::ptrdiff_t readSize = readAppend(output, remainingHeaderSize, read);
+	if (readSize < 0)
+		return false;
+	else if (static_cast<std::size_t>(readSize) < remainingHeaderSize)
+		return true;
+
+	const char* header = output.data() + tagStart;
+	unsigned char version = static_cast<unsigned char>(header[3]);
+	unsigned char flags = static_cast<unsigned char>(header[5]);
+	std::uint32_t tagSize;
+	if (version < 2 || version > 4 || !readSyncSafe(tagSize, header + 6) ||
+		(flags & (cId3Unsynchronisation | cId3ExtendedHeader | cId3Footer)) ||
+		tagSize > cMaxTagSize)
+	{
+		return true;
+	}
+
+	std::string frames;
+	readSize = readAppend(frames, tagSize, read);
+	if (readSize < 0)
+		return false;
+	else if (readSize < static_cast<std::ptrdiff_t>(tagSize))
+	{
+		output += frames;
+		return true;
+	}
+
+	frames = stripId3Frames(frames, version);
+	writeSyncSafe(&output[tagStart + 6], static_cast<std::uint32_t>(frames.size()));
+	output += frames;
+	stripped = true;
+	return true;
+}
+
+// Reads the metadata blocks of a FLAC file after the marker in output, only keeping the blocks
+// that aren't pictures or padding.
+bool stripFlac(std::string& output, const MetadataStripper::ReadFunction& read)
+{
+	std::size_t lastHeader = std::string::npos;
+	bool lastBlock = false;
+	while (!lastBlock)
+	{
+		std::string header;
+		if (!readExact(header, cFlacBlockHeaderSize, read))
+			return false;
+
+		unsigned char type = static_cast<unsigned char>(header[0]) & ~cFlacLastBlock;
+		lastBlock = (static_cast<unsigned char>(header[0]) & cFlacLastBlock) != 0;
+		std::uint32_t blockSize = readBigEndian(header.data() + 1, 3);
+		if (type == cFlacPicture || type == cFlacPadding)
+		{
+			if (!skip(blockSize, read))
+				return false;
+			continue;
+		}
+
+		// The last flag is set once it's known which block is kept last.
+		header[0] = static_cast<char>(type);
+		lastHeader = output.size();
+		output += header;
+		if (!readExact(output, blockSize, read))
+			return false;
+	}
+
+	// The stream info block is required to be first, so there's always a block that's kept.
+	if (lastHeader == std::string::npos)
+		return false;
+	output[lastHeader] = static_cast<char>(output[lastHeader] | cFlacLastBlock);
+	return true;
+}
+
+} // namespace
+
+namespace MetadataStripper
+{
+
+bool strip(std::string& output, const ReadFunction& read)
+{
+	output.clear();
+	std::ptrdiff_t readSize = readAppend(output, cProbeSize, read);
+	if (readSize < 0)
+		return false;
+	else if (static_cast<std::size_t>(readSize) < cProbeSize)
+		return true;
+
+	if (output.compare(0, 3, "ID3") == 0)
+	{
+		bool stripped;
+		if (!stripId3(output, stripped, read))
+			return false;
+		else if (!stripped)
+			return true;
+
+		// FLAC files may have an ID3v2 tag before the FLAC metadata.
+		readSize = readAppend(output, cProbeSize, read);
+		if (readSize < 0)
+			return false;
+		else if (static_cast<std::size_t>(readSize) < cProbeSize)
+			return true;
+	}
+
+	if (output.compare(output.size() - cProbeSize, cProbeSize, "fLaC") == 0)
+		return stripFlac(output, read);
+	return true;
+}
+
+} // namespace MetadataStripper
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// Removes embedded pictures and padding from the metadata at the start of songs, which players
+// often can't display and can be a large part of the size of a song.
+//
+// ID3v2 tags lose their APIC (or PIC) frames and padding, and FLAC files lose their PICTURE and
+// PADDING blocks. A FLAC file may also start with an ID3v2 tag. Everything after the metadata,
+// including all of the audio, is left to be copied unchanged, as are tags that use features that
+// would need the frames to be decoded. (unsynchronisation, extended headers and footers)
+namespace MetadataStripper
+{
+
+// Reads up to size bytes, only reading fewer at the end of the file. Returns the number of bytes
+// read or -1 on error.
+using ReadFunction = std::function<std::ptrdiff_t(char* data, std::size_t size)>;
+
+// Reads the metadata at the start of a song and sets output to the data to write in its place.
+// Data that was read but isn't metadata is also added to output, so the rest of the song can be
+// copied as is. Returns false if reading failed or the FLAC metadata was truncated.
+bool strip(std::string& output, const ReadFunction& read);
+
+} // namespace MetadataStripper
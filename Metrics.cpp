@@ -0,0 +1,337 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Metrics.h"
+
+#include "Log.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const std::size_t cCounterCount = static_cast<std::size_t>(Metrics::Counter::Count);
+const std::size_t cErrorCount = static_cast<std::size_t>(Metrics::Error::Count);
+const std::size_t cHistogramCount = static_cast<std::size_t>(Metrics::Histogram::Count);
+
+struct Description
+{
+	const char* name;
+	const char* help;
+};
+
+const Description cCounters[cCounterCount] =
+{
+	{"musicsync_songs_checked_total", "Songs checked against the device."},
+	{"musicsync_songs_copied_total", "Songs copied to the device."},
+	{"musicsync_bytes_copied_total", "Bytes written to the device for copied songs."},
+	{"musicsync_stat_calls_total",
+		"Reads of the size and modified time when checking songs."},
+	{"musicsync_files_scanned_total",
+		"Files found on the device when looking for songs to remove."},
+	{"musicsync_songs_removed_total", "Songs removed from the device."},
+	{"musicsync_playlists_loaded_total", "Playlists parsed."},
+	{"musicsync_playlist_entries_total", "Songs read from playlists."},
+	{"musicsync_playlists_written_total", "Playlists written to the device."},
+	{"musicsync_syncs_total", "Syncs started."}
+};
+
+const char* const cErrorName = "musicsync_errors_total";
+const char* const cErrorTypes[cErrorCount] =
+	{"read", "copy", "move", "verify", "remove", "playlist_read", "playlist_write"};
+
+const Description cHistograms[cHistogramCount] =
+{
+	{"musicsync_copy_duration_seconds", "Time to copy a song."},
+	{"musicsync_playlist_load_duration_seconds", "Time to parse a playlist."}
+};
+
+// Upper bounds of the buckets, covering small songs on fast disks up to large songs on slow
+// devices. Observations above the last bound are only in the +Inf bucket.
+const std::size_t cBucketCount = 12;
+const std::int64_t cBucketBounds[cBucketCount] =
+{
+	1000000LL, 2500000LL, 5000000LL, 10000000LL, 25000000LL, 50000000LL, 100000000LL,
+	250000000LL, 500000000LL, 1000000000LL, 5000000000LL, 30000000000LL
+};
+const char* const cBucketLabels[cBucketCount] =
+	{"0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "5", "30"};
+
+struct HistogramValues
+{
+	// The last bucket counts observations above every bound.
+	std::atomic<std::uint64_t> buckets[cBucketCount + 1];
+	std::atomic<std::uint64_t> sumNanoseconds;
+};
+
+struct Values
+{
+	std::atomic<std::uint64_t> counters[cCounterCount];
+	std::atomic<std::uint64_t> errors[cErrorCount];
+	HistogramValues histograms[cHistogramCount];
+};
+
+// Only called by the thread that owns the values, so there's no need for an atomic add.
+void increment(std::atomic<std::uint64_t>& value, std::uint64_t amount)
+{
+	value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void merge(std::atomic<std::uint64_t>& total, const std::atomic<std::uint64_t>& value)
+{
+	total.fetch_add(value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void mergeValues(Values& total, const Values& values)
+{
+	for (std::size_t i = 0; i < cCounterCount; ++i)
+		merge(total.counters[i], values.counters[i]);
+	for (std::size_t i = 0; i < cErrorCount; ++i)
+		merge(total.errors[i], values.errors[i]);
+	for (std::size_t i = 0; i < cHistogramCount; ++i)
+	{
+		for (std::size_t j = 0; j <= cBucketCount; ++j)
+			merge(total.histograms[i].buckets[j], values.histograms[i].buckets[j]);
+		merge(total.histograms[i].sumNanoseconds, values.histograms[i].sumNanoseconds);
+	}
+}
+
+// Guards the list of values, and the values of threads that exited.
+std::mutex gValuesMutex;
+std::vector<const Values*> gThreadValues;
+Values gExitedValues;
+
+// Values of the current thread, which are folded into gExitedValues when the thread exits.
+class ThreadValues
+{
+public:
+	ThreadValues()
+		: m_values(nullptr)
+	{
+	}
+
+	~ThreadValues()
+	{
+		if (!m_values)
+			return;
+
+		std::lock_guard<std::mutex> lock(gValuesMutex);
+		mergeValues(gExitedValues, *m_values);
+		gThreadValues.erase(std::find(gThreadValues.begin(), gThreadValues.end(), m_values));
+		delete m_values;
+	}
+
+	Values& get()
+	{
+		if (!m_values)
+		{
+			// Value initialization zeroes the atomics.
+			m_values = new Values();
+			std::lock_guard<std::mutex> lock(gValuesMutex);
+			gThreadValues.push_back(m_values);
+		}
+		return *m_values;
+	}
+
+private:
+	Values* m_values;
+};
+
+thread_local ThreadValues tValues;
+
+std::mutex gWriterMutex;
+std::condition_variable gWriterCondition;
+bool gStopping = false;
+std::thread gWriterThread;
+std::string gPath;
+
+void appendHeader(std::string& text, const char* name, const char* help, const char* type)
+{
+	text += "# HELP ";
+	text += name;
+	text += ' ';
+	text += help;
+	text += "\n# TYPE ";
+	text += name;
+	text += ' ';
+	text += type;
+	text += '\n';
+}
+
+void appendValue(std::string& text, const char* name, const char* labels, std::uint64_t value)
+{
+	text += name;
+	text += labels;
+	text += ' ';
+	text += std::to_string(value);
+	text += '\n';
+}
+
+bool writeFile(const std::string& path)
+{
+	std::string text = Metrics::format();
+	std::filesystem::path filePath = std::filesystem::u8path(path);
+	std::filesystem::path tempPath = std::filesystem::u8path(path + ".tmp");
+	std::error_code error;
+	{
+		std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+		stream.write(text.data(), text.size());
+		stream.close();
+		if (stream.fail())
+		{
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(tempPath, filePath, error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
+
+void runWriter(std::chrono::seconds interval)
+{
+	// Only report the first failure of a run of failures so the log isn't flooded.
+	bool failed = false;
+	std::unique_lock<std::mutex> lock(gWriterMutex);
+	while (true)
+	{
+		bool stopping = gWriterCondition.wait_for(lock, interval, []() {return gStopping;});
+		bool success = writeFile(gPath);
+		if (!success && !failed)
+			Log::error("Error: Couldn't write metrics to '%s'.\n", gPath.c_str());
+		failed = !success;
+		if (stopping)
+			break;
+	}
+}
+
+} // namespace
+
+namespace Metrics
+{
+
+void add(Counter counter, std::uint64_t value)
+{
+	increment(tValues.get().counters[static_cast<std::size_t>(counter)], value);
+}
+
+void addError(Error error, std::uint64_t count)
+{
+	increment(tValues.get().errors[static_cast<std::size_t>(error)], count);
+}
+
+void observe(Histogram histogram, Duration duration)
+{
+	std::int64_t nanoseconds =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	std::size_t bucket = std::lower_bound(cBucketBounds, cBucketBounds + cBucketCount,
+		nanoseconds) - cBucketBounds;
+	HistogramValues& values = tValues.get().histograms[static_cast<std::size_t>(histogram)];
+	increment(values.buckets[bucket], 1);
+	increment(values.sumNanoseconds, static_cast<std::uint64_t>(std::max<std::int64_t>(
+		nanoseconds, 0)));
+}
+
+std::string format()
+{
+	Values total{};
+	{
+		std::lock_guard<std::mutex> lock(gValuesMutex);
+		mergeValues(total, gExitedValues);
+		for (const Values* values : gThreadValues)
+			mergeValues(total, *values);
+	}
+
+	std::string text;
+	for (std::size_t i = 0; i < cCounterCount; ++i)
+	{
+		appendHeader(text, cCounters[i].name, cCounters[i].help, "counter");
+		appendValue(text, cCounters[i].name, "", total.counters[i]);
+	}
+
+	appendHeader(text, cErrorName, "Errors by type.", "counter");
+	for (std::size_t i = 0; i < cErrorCount; ++i)
+	{
+		std::string labels = std::string("{type=\"") + cErrorTypes[i] + "\"}";
+		appendValue(text, cErrorName, labels.c_str(), total.errors[i]);
+	}
+
+	for (std::size_t i = 0; i < cHistogramCount; ++i)
+	{
+		const char* name = cHistograms[i].name;
+		const HistogramValues& values = total.histograms[i];
+		appendHeader(text, name, cHistograms[i].help, "histogram");
+
+		// Prometheus buckets are cumulative.
+		std::string bucketName = std::string(name) + "_bucket";
+		std::uint64_t count = 0;
+		for (std::size_t j = 0; j <= cBucketCount; ++j)
+		{
+			count += values.buckets[j];
+			std::string labels = std::string("{le=\"") +
+				(j < cBucketCount ? cBucketLabels[j] : "+Inf") + "\"}";
+			appendValue(text, bucketName.c_str(), labels.c_str(), count);
+		}
+
+		char sum[32];
+		std::snprintf(sum, sizeof(sum), "%.9f", values.sumNanoseconds/1e9);
+		text += name;
+		text += "_sum ";
+		text += sum;
+		text += '\n';
+		appendValue(text, (std::string(name) + "_count").c_str(), "", count);
+	}
+	return text;
+}
+
+void start(const std::string& path, std::chrono::seconds interval)
+{
+	if (gWriterThread.joinable())
+		stop();
+
+	gPath = path;
+	gStopping = false;
+	gWriterThread = std::thread(&runWriter, interval);
+}
+
+void stop()
+{
+	if (!gWriterThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(gWriterMutex);
+		gStopping = true;
+	}
+	gWriterCondition.notify_one();
+	gWriterThread.join();
+}
+
+} // namespace Metrics
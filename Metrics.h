@@ -0,0 +1,82 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Counters and histograms for monitoring syncs that run on a schedule. Each thread adds to its own
+// set of values, so recording is only a relaxed atomic store that never contends with other
+// threads. The values of threads that exit are folded into a shared set so nothing is lost.
+//
+// While started, the values are written periodically in the Prometheus text format for the
+// textfile collector of node_exporter. The file is replaced atomically so the collector never
+// reads a partial file. Values accumulate for the lifetime of the process.
+namespace Metrics
+{
+
+enum class Counter
+{
+	SongsChecked,     // Songs checked against the device.
+	SongsCopied,      // Songs copied to the device.
+	BytesCopied,      // Bytes written to the device for copied songs.
+	StatCalls,        // Reads of the size and modified time when checking songs.
+	FilesScanned,     // Files found on the device when looking for songs to remove.
+	SongsRemoved,     // Songs removed from the device.
+	PlaylistsLoaded,  // Playlists parsed.
+	PlaylistEntries,  // Songs read from playlists.
+	PlaylistsWritten, // Playlists written to the device.
+	Syncs,            // Syncs started.
+	Count
+};
+
+enum class Error
+{
+	Read,          // A song couldn't be read from the library.
+	Copy,          // A song couldn't be copied to the device.
+	Move,          // A song couldn't be moved to a new layout.
+	Verify,        // A song didn't match the source after copying.
+	Remove,        // A file couldn't be removed from the device.
+	PlaylistRead,  // A playlist couldn't be read.
+	PlaylistWrite, // A playlist couldn't be written to the device.
+	Count
+};
+
+enum class Histogram
+{
+	CopyDuration,         // Time to copy a song.
+	PlaylistLoadDuration, // Time to parse a playlist.
+	Count
+};
+
+using Duration = std::chrono::steady_clock::duration;
+
+void add(Counter counter, std::uint64_t value = 1);
+void addError(Error error, std::uint64_t count = 1);
+void observe(Histogram histogram, Duration duration);
+
+// Gets the current values in the Prometheus text format.
+std::string format();
+
+// Starts a thread that writes the values to a file at a fixed interval. The file is also written
+// once stopped.
+void start(const std::string& path, std::chrono::seconds interval);
+void stop();
+
+} // namespace Metrics
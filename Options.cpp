@@ -15,6 +15,8 @@
  */
 
 #include "Options.h"
+#include <climits>
+#include <cstdlib>
 #include <cstring>
 #include <cstdio>
 
@@ -22,13 +24,48 @@ static const char* const cRemovePlaylists = "--remove-old-playlists";
 static const char* const cRemoveSongs = "--remove-old-songs";
 static const char* const cWindowsSeparators = "--windows-separators";
 static const char* const cNoUnicode = "--no-unicode";
+static const char* const cDurable = "--durable";
+static const char* const cDedupeContents = "--dedupe-contents";
+static const char* const cVerify = "--verify";
+static const char* const cStripArtwork = "--strip-artwork";
+static const char* const cSkipUnchanged = "--skip-unchanged";
 static const char* const cPathTrim = "--trim-prefix";
 static const char* const cPathPrefix = "--path-prefix";
 static const char* const cPlaylistInput = "--playlist-input-dir";
 static const char* const cPlaylistOutput = "--playlist-output-dir";
 static const char* const cSongOutput = "--song-output-dir";
+static const char* const cScanThreads = "--scan-threads";
+static const char* const cCompare = "--compare";
+static const char* const cCompareNewer = "newer";
+static const char* const cCompareFingerprint = "fingerprint";
+static const char* const cPlaylistOrder = "--playlist-order";
+static const char* const cPlaylistOrderName = "name";
+static const char* const cPlaylistOrderModified = "modified";
+static const char* const cPlaylistPriority = "--playlist-priority";
+static const char* const cPlaylistCache = "--playlist-cache";
+static const char* const cMetricsFile = "--metrics-file";
+static const char* const cMetricsInterval = "--metrics-interval";
+static const char* const cInclude = "--include";
+static const char* const cExclude = "--exclude";
+static const char* const cSpaceCheck = "--space-check";
+static const char* const cSpaceCheckRefuse = "refuse";
+static const char* const cSpaceCheckTrim = "trim";
+static const char* const cSplitDirectories = "--split-directories";
+static const char* const cSplitLetter = "letter";
+static const char* const cSplitHash = "hash";
+static const char* const cMaxDirectorySongs = "--max-directory-songs";
+static const char* const cHash = "--hash";
+static const char* const cHashMd5 = "md5";
+static const char* const cHashXXH64 = "xxh64";
+static const char* const cMemoryLimit = "--memory-limit";
+static const char* const cQuiet = "--quiet";
+static const char* const cVerbose = "--verbose";
+
+static const char* const cAuto = "auto";
 
 const char* const Options::cProgramName = "MusicSync";
+const char* const Options::cReadLimitOption = "--read-limit";
+const char* const Options::cWriteLimitOption = "--write-limit";
 
 static bool getNextString(unsigned int& index, std::string& string,
 	unsigned int argc, const char* const* argv, const Options& options)
@@ -44,8 +81,54 @@ static bool getNextString(unsigned int& index, std::string& string,
 	return true;
 }
 
+static bool getNextUInt(unsigned int& index, unsigned int& value,
+	unsigned int argc, const char* const* argv, const Options& options)
+{
+	std::string string;
+	if (!getNextString(index, string, argc, argv, options))
+		return false;
+
+	char* end;
+	unsigned long parsedValue = std::strtoul(string.c_str(), &end, 10);
+	if (string.empty() || *end != 0 || parsedValue > UINT_MAX)
+	{
+		options.printHelp();
+		return false;
+	}
+
+	value = static_cast<unsigned int>(parsedValue);
+	return true;
+}
+
+static bool getNextLimit(unsigned int& index, unsigned int& value,
+	unsigned int argc, const char* const* argv, const Options& options)
+{
+	if (index + 1 < argc && std::strcmp(argv[index + 1], cAuto) == 0)
+	{
+		index += 2;
+		value = Options::cAutoLimit;
+		return true;
+	}
+
+	if (!getNextUInt(index, value, argc, argv, options))
+		return false;
+
+	if (value == 0)
+	{
+		options.printHelp();
+		return false;
+	}
+	return true;
+}
+
 Options::Options()
-	: removePlaylists(false), removeSongs(false), windowsSeparators(false), noUnicode(false)
+	: removePlaylists(false), removeSongs(false), windowsSeparators(false), noUnicode(false),
+	durable(false), dedupeContents(false), verify(false), stripArtwork(false),
+	skipUnchanged(false), scanThreads(0),
+	compareMode(CompareMode::Newer), playlistOrder(PlaylistOrder::Name),
+	spaceCheck(SpaceCheck::None), splitDirectories(SongLayout::Split::None),
+	maxDirectorySongs(1000), hashAlgorithm(Hash::Algorithm::Md5), verbosity(Log::Level::Info),
+	readLimit(1), writeLimit(1), memoryLimit(0), metricsInterval(15)
 {
 }
 
@@ -74,10 +157,47 @@ bool Options::getFromCommandLine(unsigned int argc, const char* const* argv)
 			++index;
 			noUnicode = true;
 		}
+		else if (std::strcmp(argv[index], cDurable) == 0)
+		{
+			++index;
+			durable = true;
+		}
+		else if (std::strcmp(argv[index], cDedupeContents) == 0)
+		{
+			++index;
+			dedupeContents = true;
+		}
+		else if (std::strcmp(argv[index], cVerify) == 0)
+		{
+			++index;
+			verify = true;
+		}
+		else if (std::strcmp(argv[index], cStripArtwork) == 0)
+		{
+			++index;
+			stripArtwork = true;
+		}
+		else if (std::strcmp(argv[index], cSkipUnchanged) == 0)
+		{
+			++index;
+			skipUnchanged = true;
+		}
+		else if (std::strcmp(argv[index], cQuiet) == 0)
+		{
+			++index;
+			verbosity = Log::Level::Error;
+		}
+		else if (std::strcmp(argv[index], cVerbose) == 0)
+		{
+			++index;
+			verbosity = Log::Level::Verbose;
+		}
 		else if (std::strcmp(argv[index], cPathTrim) == 0)
 		{
+			std::string pathTrim;
 			if (!getNextString(index, pathTrim, argc, argv, *this))
 				return false;
+			pathTrims.push_back(std::move(pathTrim));
 		}
 		else if (std::strcmp(argv[index], cPathPrefix) == 0)
 		{
@@ -99,6 +219,167 @@ bool Options::getFromCommandLine(unsigned int argc, const char* const* argv)
 			if (!getNextString(index, songOutput, argc, argv, *this))
 				return false;
 		}
+		else if (std::strcmp(argv[index], cScanThreads) == 0)
+		{
+			if (!getNextUInt(index, scanThreads, argc, argv, *this))
+				return false;
+		}
+		else if (std::strcmp(argv[index], cCompare) == 0)
+		{
+			std::string mode;
+			if (!getNextString(index, mode, argc, argv, *this))
+				return false;
+
+			if (mode == cCompareNewer)
+				compareMode = CompareMode::Newer;
+			else if (mode == cCompareFingerprint)
+				compareMode = CompareMode::Fingerprint;
+			else
+			{
+				printHelp();
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[index], cPlaylistOrder) == 0)
+		{
+			std::string order;
+			if (!getNextString(index, order, argc, argv, *this))
+				return false;
+
+			if (order == cPlaylistOrderName)
+				playlistOrder = PlaylistOrder::Name;
+			else if (order == cPlaylistOrderModified)
+				playlistOrder = PlaylistOrder::Modified;
+			else
+			{
+				printHelp();
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[index], cSpaceCheck) == 0)
+		{
+			std::string check;
+			if (!getNextString(index, check, argc, argv, *this))
+				return false;
+
+			if (check == cSpaceCheckRefuse)
+				spaceCheck = SpaceCheck::Refuse;
+			else if (check == cSpaceCheckTrim)
+				spaceCheck = SpaceCheck::Trim;
+			else
+			{
+				printHelp();
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[index], cSplitDirectories) == 0)
+		{
+			std::string split;
+			if (!getNextString(index, split, argc, argv, *this))
+				return false;
+
+			if (split == cSplitLetter)
+				splitDirectories = SongLayout::Split::Letter;
+			else if (split == cSplitHash)
+				splitDirectories = SongLayout::Split::Hash;
+			else
+			{
+				printHelp();
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[index], cMaxDirectorySongs) == 0)
+		{
+			unsigned int songs;
+			if (!getNextUInt(index, songs, argc, argv, *this))
+				return false;
+
+			if (songs == 0)
+			{
+				printHelp();
+				return false;
+			}
+			maxDirectorySongs = songs;
+		}
+		else if (std::strcmp(argv[index], cHash) == 0)
+		{
+			std::string algorithm;
+			if (!getNextString(index, algorithm, argc, argv, *this))
+				return false;
+
+			if (algorithm == cHashMd5)
+				hashAlgorithm = Hash::Algorithm::Md5;
+			else if (algorithm == cHashXXH64)
+				hashAlgorithm = Hash::Algorithm::XXH64;
+			else
+			{
+				printHelp();
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[index], cPlaylistPriority) == 0)
+		{
+			if (!getNextString(index, playlistPriorityFile, argc, argv, *this))
+				return false;
+		}
+		else if (std::strcmp(argv[index], cPlaylistCache) == 0)
+		{
+			if (!getNextString(index, playlistCache, argc, argv, *this))
+				return false;
+		}
+		else if (std::strcmp(argv[index], cMetricsFile) == 0)
+		{
+			if (!getNextString(index, metricsFile, argc, argv, *this))
+				return false;
+		}
+		else if (std::strcmp(argv[index], cMetricsInterval) == 0)
+		{
+			if (!getNextUInt(index, metricsInterval, argc, argv, *this))
+				return false;
+
+			if (metricsInterval == 0)
+			{
+				printHelp();
+				return false;
+			}
+		}
+		else if (std::strcmp(argv[index], cInclude) == 0)
+		{
+			std::string pattern;
+			if (!getNextString(index, pattern, argc, argv, *this))
+				return false;
+			includePlaylists.push_back(std::move(pattern));
+		}
+		else if (std::strcmp(argv[index], cExclude) == 0)
+		{
+			std::string pattern;
+			if (!getNextString(index, pattern, argc, argv, *this))
+				return false;
+			excludePlaylists.push_back(std::move(pattern));
+		}
+		else if (std::strcmp(argv[index], cReadLimitOption) == 0)
+		{
+			if (!getNextLimit(index, readLimit, argc, argv, *this))
+				return false;
+		}
+		else if (std::strcmp(argv[index], cWriteLimitOption) == 0)
+		{
+			if (!getNextLimit(index, writeLimit, argc, argv, *this))
+				return false;
+		}
+		else if (std::strcmp(argv[index], cMemoryLimit) == 0)
+		{
+			unsigned int megabytes;
+			if (!getNextUInt(index, megabytes, argc, argv, *this))
+				return false;
+
+			if (megabytes == 0)
+			{
+				printHelp();
+				return false;
+			}
+			memoryLimit = static_cast<std::size_t>(megabytes)*1024*1024;
+		}
 		else
 		{
 			printHelp();
@@ -117,9 +398,18 @@ void Options::printHelp()
 {
 	std::fprintf(stderr,
 		"Usage: %s [%s] [%s]\n"
-		"         [%s] [%s] [%s <prefix>]\n"
-		"         [%s <prefix>] %s <path>\n"
+		"         [%s] [%s] [%s] [%s]\n"
+		"         [%s] [%s] [%s] [%s] [%s]\n"
+		"         [%s <prefix>] [%s <prefix>] [%s <count>]\n"
+		"         [%s <%s|%s>] [%s <%s|%s>]\n"
+		"         [%s <file>] [%s <dir>]\n"
+		"         [%s <file>] [%s <seconds>]\n"
+		"         [%s <glob>] [%s <glob>] [%s <%s|%s>]\n"
+		"         [%s <%s|%s>] [%s <count>]\n"
+		"         [%s <count|%s>] [%s <count|%s>]\n"
+		"         [%s <MB>] [%s <%s|%s>]\n"
 		"         %s <path> %s <path>\n"
+		"         %s <path>\n"
 		"\nOptions:\n"
 		"   %s: Remove playlists that appear in the playlist output\n"
 		"     directory but not the input directory.\n"
@@ -127,13 +417,97 @@ void Options::printHelp()
 		"     but not in any playlist.\n"
 		"   %s: Replace '/' with '\\' in playlist paths.\n"
 		"   %s: Remove Unicode characters in filenames.\n"
+		"   %s: Wait for songs to be written to the device before writing\n"
+		"     playlists, and for playlists to be written before exiting.\n"
+		"   %s: Only copy one song when songs from different paths have\n"
+		"     the same contents. Songs that are the same file are always only copied\n"
+		"     once.\n"
+		"   %s: Read back songs after copying them to check they match\n"
+		"     the source, and check songs copied before against checksums stored\n"
+		"     on the device. Songs that don't match are copied again.\n"
+		"   %s: Remove embedded pictures and padding from ID3v2 tags and\n"
+		"     FLAC metadata while copying songs, leaving the audio unchanged. Songs\n"
+		"     copied without this are copied again once.\n"
+		"   %s: Stop early if nothing changed since the last sync that\n"
+		"     finished without errors, only checking the options and the playlists\n"
+		"     on both sides. Songs that change without their playlists changing\n"
+		"     aren't copied.\n"
+		"   %s: Only print errors.\n"
+		"   %s: Print each playlist and song that is changed. Otherwise\n"
+		"     only a summary is printed, with a progress line when writing to a\n"
+		"     terminal.\n"
 		"   %s: A prefix to trim from every song path in a playlist file.\n"
+		"     May be given multiple times for songs under different roots, such as\n"
+		"     separate disks. The longest prefix that matches is trimmed.\n"
 		"   %s: A prefix to add to every song path in a playlist file.\n"
 		"   %s: The input directory to read M3U playlists from.\n"
 		"   %s: The output directory to write M3U playlists to.\n"
-		"   %s: The output directory to write song fiels to.\n",
-		cProgramName, cRemovePlaylists, cRemoveSongs, cWindowsSeparators, cNoUnicode, cPathTrim,
-		cPathPrefix, cPlaylistInput, cPlaylistOutput, cSongOutput, cRemovePlaylists, cRemoveSongs,
-		cWindowsSeparators, cNoUnicode, cPathTrim, cPathPrefix, cPlaylistInput, cPlaylistOutput,
-		cSongOutput);
+		"   %s: The output directory to write song fiels to.\n"
+		"   %s: The number of threads to scan the song output directory\n"
+		"     with when removing songs. Defaults to a value based on the CPU count.\n"
+		"   %s: How to decide if a song needs to be copied.\n"
+		"     %s: Copy when the source is newer than the destination. (default)\n"
+		"     %s: Copy when the size or modified time differ. The modified time\n"
+		"       is preserved on copied songs and compared with a tolerance based on\n"
+		"       the destination file system, which is stable for FAT and exFAT\n"
+		"       devices and when restoring the source from a backup.\n"
+		"   %s: The order to synchronize playlists in. Each playlist is\n"
+		"     written as soon as all of its songs are copied.\n"
+		"     %s: Alphabetical order. (default)\n"
+		"     %s: Most recently modified first.\n"
+		"   %s: A file listing playlist file names to synchronize first,\n"
+		"     one per line in priority order. Other playlists follow using %s.\n"
+		"   %s: A directory to save parsed playlists in. Playlists that\n"
+		"     haven't changed since the last sync are read from the saved copy\n"
+		"     rather than parsed again.\n"
+		"   %s: Only synchronize playlists with file names that match the\n"
+		"     pattern, ignoring case. '*' matches any text and '?' any character.\n"
+		"     May be given multiple times.\n"
+		"   %s: Skip playlists with file names that match the pattern. May be\n"
+		"     given multiple times. Playlists and songs on the device that belong\n"
+		"     to playlists that are skipped are never removed.\n"
+		"   %s: Check the free space on the device before copying, counting\n"
+		"     old songs to remove, rather than copying until the device is full.\n"
+		"     %s: Don't copy any songs if they don't all fit.\n"
+		"     %s: Skip the playlists at the end of the order that don't fit,\n"
+		"       so every playlist that's written has all of its songs.\n"
+		"   %s: The maximum number of reads in flight when copying songs.\n"
+		"     Use %s to tune it based on the measured throughput. Defaults to 1.\n"
+		"   %s: The maximum number of writes in flight when copying songs.\n"
+		"     Use %s to tune it based on the measured throughput. Defaults to 1.\n"
+		"   %s: Limit the memory used to track songs when removing old\n"
+		"     songs by spilling to sorted files in the temporary directory. Use for\n"
+		"     very large libraries on machines with little memory. The paths of\n"
+		"     songs are also spilled, leaving a small fixed amount for each song.\n"
+		"   %s: Split directories on the device that hold more songs\n"
+		"     than %s into subdirectories, which keeps lookups fast on\n"
+		"     FAT devices. Directories are split starting with the next sync, and\n"
+		"     songs are moved rather than copied again when the layout changes.\n"
+		"     %s: By the first letter of the file name.\n"
+		"     %s: By a hash of the file name, which gives even subdirectories.\n"
+		"   %s: The most songs in a directory before it's split.\n"
+		"     Defaults to 1000.\n"
+		"   %s: The hash to compare song contents and checksums with.\n"
+		"     %s: MD5, hashing several songs at once with AVX2. (default)\n"
+		"     %s: XXH64, which is faster but only has 64 bits.\n"
+		"   %s: A file to write metrics to in the Prometheus text format,\n"
+		"     such as for the textfile collector of node_exporter. The file is\n"
+		"     replaced while synchronizing and once done.\n"
+		"   %s: The seconds between writing metrics. Defaults to 15.\n",
+		cProgramName, cRemovePlaylists, cRemoveSongs, cWindowsSeparators, cNoUnicode, cDurable,
+		cDedupeContents, cVerify, cStripArtwork, cSkipUnchanged, cQuiet, cVerbose, cPathTrim,
+		cPathPrefix, cScanThreads, cCompare, cCompareNewer, cCompareFingerprint, cPlaylistOrder,
+		cPlaylistOrderName, cPlaylistOrderModified, cPlaylistPriority, cPlaylistCache, cMetricsFile,
+		cMetricsInterval, cInclude, cExclude, cSpaceCheck, cSpaceCheckRefuse, cSpaceCheckTrim,
+		cSplitDirectories, cSplitLetter, cSplitHash, cMaxDirectorySongs, cReadLimitOption, cAuto,
+		cWriteLimitOption, cAuto, cMemoryLimit, cHash, cHashMd5, cHashXXH64, cPlaylistInput,
+		cPlaylistOutput, cSongOutput, cRemovePlaylists, cRemoveSongs, cWindowsSeparators,
+		cNoUnicode, cDurable, cDedupeContents, cVerify, cStripArtwork, cSkipUnchanged, cQuiet,
+		cVerbose, cPathTrim, cPathPrefix, cPlaylistInput, cPlaylistOutput, cSongOutput,
+		cScanThreads, cCompare, cCompareNewer, cCompareFingerprint, cPlaylistOrder,
+		cPlaylistOrderName, cPlaylistOrderModified, cPlaylistPriority, cPlaylistOrder,
+		cPlaylistCache, cInclude, cExclude, cSpaceCheck, cSpaceCheckRefuse, cSpaceCheckTrim,
+		cReadLimitOption, cAuto, cWriteLimitOption, cAuto, cMemoryLimit, cSplitDirectories,
+		cMaxDirectorySongs, cSplitLetter, cSplitHash, cMaxDirectorySongs, cHash, cHashMd5,
+		cHashXXH64, cMetricsFile, cMetricsInterval);
 }
@@ -14,13 +14,41 @@
  * limitations under the License.
  */
 
+#include "Hash.h"
+#include "Log.h"
+#include "SongLayout.h"
+#include <cstddef>
 #include <string>
+#include <vector>
 
 #pragma once
 
 struct Options
 {
+	enum class CompareMode
+	{
+		Newer,      // Copy songs when the source is newer than the destination.
+		Fingerprint // Copy songs when the size or modified time differ.
+	};
+
+	enum class PlaylistOrder
+	{
+		Name,    // Alphabetical order.
+		Modified // Most recently modified first.
+	};
+
+	enum class SpaceCheck
+	{
+		None,   // Copy songs until the device is full.
+		Refuse, // Don't copy any songs if they don't all fit.
+		Trim    // Skip the playlists at the end of the order that don't fit.
+	};
+
 	static const char* const cProgramName;
+	static const char* const cReadLimitOption;
+	static const char* const cWriteLimitOption;
+	// Value for the read or write limit to tune the limit automatically.
+	static const unsigned int cAutoLimit = 0;
 
 	Options();
 	bool getFromCommandLine(unsigned int argc, const char* const* argv);
@@ -30,7 +58,42 @@ struct Options
 	bool removeSongs;
 	bool windowsSeparators;
 	bool noUnicode;
-	std::string pathTrim;
+	bool durable;
+	bool dedupeContents;
+	bool verify;
+	bool stripArtwork;
+	bool skipUnchanged;
+	// 0 to choose based on the hardware.
+	unsigned int scanThreads;
+	CompareMode compareMode;
+	PlaylistOrder playlistOrder;
+	SpaceCheck spaceCheck;
+	// How to split directories with more than maxDirectorySongs songs on the device.
+	SongLayout::Split splitDirectories;
+	std::size_t maxDirectorySongs;
+	// Hash to compare song contents with.
+	Hash::Algorithm hashAlgorithm;
+	Log::Level verbosity;
+	// Maximum number of reads and writes in flight when copying songs, or cAutoLimit.
+	unsigned int readLimit;
+	unsigned int writeLimit;
+	// Maximum memory in bytes for tracking songs to remove, or 0 for no limit.
+	std::size_t memoryLimit;
+	// File listing playlist file names in priority order, one per line.
+	std::string playlistPriorityFile;
+	// Directory to save parsed playlists in, or empty to always parse them.
+	std::string playlistCache;
+	// File to write metrics to in the Prometheus text format, or empty to not write them.
+	std::string metricsFile;
+	// Seconds between writing metrics.
+	unsigned int metricsInterval;
+	// Glob patterns for playlist file names to synchronize and to skip. All playlists are
+	// synchronized when there are no include patterns.
+	std::vector<std::string> includePlaylists;
+	std::vector<std::string> excludePlaylists;
+	// Prefixes to trim from song paths, where the longest prefix that matches is trimmed. Songs
+	// that don't match any prefix can't be synchronized.
+	std::vector<std::string> pathTrims;
 	std::string pathPrefix;
 	std::string playlistInput;
 	std::string playlistOutput;
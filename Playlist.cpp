@@ -16,88 +16,273 @@
 
 #include "Playlist.h"
 
-#include "Helpers.h"
-#include <cassert>
-#include <cstdio>
+#include "Log.h"
+#include "Metrics.h"
+#include <chrono>
 #include <cstring>
-#include <fstream>
 
 static const char* const cHeader = "#EXTM3U";
 static const char* const cInfo = "#EXTINF";
-const char * const Playlist::cExtension = ".m3u";
+static const char* const cExtensions[] = {".m3u", ".m3u8"};
+// M3U8 files written on Windows often start with a byte order mark.
+static const char* const cUtf8Bom = "\xEF\xBB\xBF";
+static const std::size_t cBufferSize = 64*1024;
 
-bool Playlist::load(const std::string& fileName)
+Playlist::Reader::Reader()
+	: m_offset(0), m_size(0), m_loadDuration(0), m_firstLine(true), m_endOfFile(false),
+	m_error(false)
 {
-	std::ifstream stream;
-	stream.open(fileName.c_str(), std::ifstream::in);
-	if (!stream)
+}
+
+bool Playlist::Reader::open(FileSystem& fileSystem, const std::string& fileName)
+{
+	auto start = std::chrono::steady_clock::now();
+	m_path = fileSystem.getPath(fileName);
+	m_file = fileSystem.openRead(fileName, FileSystem::ReadMode::Sequential);
+	m_offset = 0;
+	m_size = 0;
+	m_firstLine = true;
+	m_endOfFile = false;
+	m_error = !m_file;
+	if (m_error)
 	{
-		std::fprintf(stderr, "Error: Couldn't open file '%s'.\n",
-			fileName.c_str());
+		Log::error("Error: Couldn't open file '%s'.\n", m_path.c_str());
+		Metrics::addError(Metrics::Error::PlaylistRead);
 		return false;
 	}
 
-	std::string header;
-	if (!Helpers::readLine(header, stream))
-	{
-		std::fprintf(stderr, "Error: Error reading file '%s'.\n", fileName.c_str());
+	m_buffer.resize(cBufferSize);
+	Metrics::add(Metrics::Counter::PlaylistsLoaded);
+	m_loadDuration = std::chrono::steady_clock::now() - start;
+	return true;
+}
+
+bool Playlist::Reader::next(Entry& entry)
+{
+	if (!m_file)
 		return false;
+
+	auto start = std::chrono::steady_clock::now();
+	// The info line applies to the next song. Other directives aren't kept.
+	entry.info.clear();
+	while (readLine(entry.song))
+	{
+		if (entry.song.empty())
+			continue;
+		else if (entry.song[0] != '#')
+		{
+			Metrics::add(Metrics::Counter::PlaylistEntries);
+			m_loadDuration += std::chrono::steady_clock::now() - start;
+			return true;
+		}
+		else if (entry.song.compare(0, std::strlen(cInfo), cInfo) == 0)
+			entry.info.swap(entry.song);
 	}
 
-	if (header != cHeader)
+	// Streamed playlists are finished here rather than by load(), so this is where the duration
+	// is observed for both.
+	if (!m_error)
 	{
-		std::fprintf(stderr, "Error: File '%s' isn't a valid M3U file.\n",
-			fileName.c_str());
-		return false;
+		m_loadDuration += std::chrono::steady_clock::now() - start;
+		Metrics::observe(Metrics::Histogram::PlaylistLoadDuration, m_loadDuration);
 	}
+	m_file.reset();
+	return false;
+}
 
-	std::string info, songPath;
-	do
+bool Playlist::Reader::readLine(std::string& line)
+{
+	line.clear();
+	while (true)
 	{
-		if (!Helpers::readLine(info, stream))
+		if (m_offset == m_size)
 		{
-			std::fprintf(stderr, "Error: Error reading file '%s'.\n", fileName.c_str());
-			return false;
-		}
-		if (info.empty())
+			if (m_endOfFile)
+			{
+				if (line.empty())
+					return false;
+				break;
+			}
+
+			std::ptrdiff_t readSize = m_file->read(m_buffer.data(), m_buffer.size());
+			if (readSize < 0)
+			{
+				Log::error("Error: Error reading file '%s'.\n", m_path.c_str());
+				Metrics::addError(Metrics::Error::PlaylistRead);
+				m_error = true;
+				return false;
+			}
+
+			m_offset = 0;
+			m_size = readSize;
+			m_endOfFile = readSize == 0;
 			continue;
-		if (info.find(cInfo) != 0 || stream.eof())
-		{
-			std::fprintf(stderr, "Error: File '%s' isn't a valid M3U file.\n", fileName.c_str());
-			return false;
 		}
-		if (!Helpers::readLine(songPath, stream))
+
+		const char* start = m_buffer.data() + m_offset;
+		const char* end = m_buffer.data() + m_size;
+		const char* newline = static_cast<const char*>(std::memchr(start, '\n', end - start));
+		if (!newline)
 		{
-			std::fprintf(stderr, "Error: Error reading file '%s'.\n", fileName.c_str());
-			return false;
+			line.append(start, end);
+			m_offset = m_size;
+			continue;
 		}
-		addSong(songPath, info);
-	} while (!stream.eof());
 
-	std::printf("Loaded playlist '%s'.\n", fileName.c_str());
+		line.append(start, newline);
+		m_offset = newline + 1 - m_buffer.data();
+		break;
+	}
+
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+	if (m_firstLine)
+	{
+		if (line.compare(0, std::strlen(cUtf8Bom), cUtf8Bom) == 0)
+			line.erase(0, std::strlen(cUtf8Bom));
+		m_firstLine = false;
+	}
 	return true;
 }
 
-bool Playlist::save(const std::string& fileName) const
+Playlist::Writer::Writer()
+	: m_fileSystem(nullptr), m_error(false)
 {
-	std::ofstream stream;
-	stream.open(fileName.c_str(), std::ofstream::out);
-	if (!stream)
+}
+
+Playlist::Writer::~Writer()
+{
+	if (m_file)
 	{
-		std::fprintf(stderr, "Error: Couldn't save file '%s'.\n",
-			fileName.c_str());
+		m_file.reset();
+		discard(*m_fileSystem, m_fileName);
+	}
+}
+
+bool Playlist::Writer::open(FileSystem& fileSystem, const std::string& fileName)
+{
+	m_fileSystem = &fileSystem;
+	m_fileName = fileName;
+	m_file = fileSystem.openWrite(FileSystem::getTempPath(fileName));
+	m_error = !m_file;
+	if (m_error)
+	{
+		Log::error("Error: Couldn't save file '%s'.\n", fileSystem.getPath(fileName).c_str());
 		return false;
 	}
 
-	stream << cHeader << std::endl;
+	m_buffer = cHeader;
+	m_buffer.push_back('\n');
+	return true;
+}
 
-	for (const Entry& entry : m_entries)
+bool Playlist::Writer::addSong(std::string_view song, std::string_view info)
+{
+	if (!m_file || m_error)
+		return false;
+
+	if (!info.empty())
+	{
+		m_buffer += info;
+		m_buffer.push_back('\n');
+	}
+	m_buffer += song;
+	m_buffer.push_back('\n');
+	if (m_buffer.size() >= cBufferSize)
+		return flush();
+	return true;
+}
+
+bool Playlist::Writer::close()
+{
+	if (!m_file)
+		return false;
+
+	bool success = !m_error && (m_buffer.empty() || flush());
+	success = m_file->close() && success;
+	m_file.reset();
+	if (!success)
 	{
-		stream << entry.info << std::endl;
-		stream << entry.song << std::endl;
+		Log::error("Error: Couldn't save file '%s'.\n", m_fileSystem->getPath(m_fileName).c_str());
+		discard(*m_fileSystem, m_fileName);
+	}
+	return success;
+}
+
+bool Playlist::Writer::commit(FileSystem& fileSystem, const std::string& fileName)
+{
+	if (!fileSystem.renameFile(FileSystem::getTempPath(fileName), fileName))
+	{
+		Log::error("Error: Couldn't save file '%s'.\n", fileSystem.getPath(fileName).c_str());
+		discard(fileSystem, fileName);
+		return false;
 	}
+	return true;
+}
+
+void Playlist::Writer::discard(FileSystem& fileSystem, const std::string& fileName)
+{
+	fileSystem.removeFile(FileSystem::getTempPath(fileName));
+}
+
+bool Playlist::Writer::flush()
+{
+	if (!m_file->write(m_buffer.data(), m_buffer.size()))
+		m_error = true;
+	m_buffer.clear();
+	return !m_error;
+}
+
+bool Playlist::isPlaylistFile(const std::string& fileName)
+{
+	std::size_t extensionStart = fileName.rfind('.');
+	if (extensionStart == std::string::npos)
+		return false;
+
+	std::string extension = fileName.substr(extensionStart);
+	for (char& c : extension)
+	{
+		if (c >= 'A' && c <= 'Z')
+			c = static_cast<char>(c - 'A' + 'a');
+	}
+
+	for (const char* playlistExtension : cExtensions)
+	{
+		if (extension == playlistExtension)
+			return true;
+	}
+	return false;
+}
+
+bool Playlist::load(FileSystem& fileSystem, const std::string& fileName)
+{
+	Reader reader;
+	if (!reader.open(fileSystem, fileName))
+		return false;
+
+	m_entries.clear();
+	Entry entry;
+	while (reader.next(entry))
+		m_entries.push_back(std::move(entry));
+	if (reader.hasError())
+		return false;
+
+	Log::verbose("Loaded playlist '%s'.\n", fileSystem.getPath(fileName).c_str());
+	return true;
+}
+
+bool Playlist::save(FileSystem& fileSystem, const std::string& fileName) const
+{
+	Writer writer;
+	if (!writer.open(fileSystem, fileName))
+		return false;
+
+	for (const Entry& entry : m_entries)
+		writer.addSong(entry.song, entry.info);
+	if (!writer.close() || !Writer::commit(fileSystem, fileName))
+		return false;
 
-	std::printf("Saved playlist '%s'.\n", fileName.c_str());
+	Log::verbose("Saved playlist '%s'.\n", fileSystem.getPath(fileName).c_str());
 	return true;
 }
 
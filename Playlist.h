@@ -16,21 +16,29 @@
 
 #pragma once
 
+#include "FileSystem.h"
+#include <chrono>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+// Extended M3U playlist. Playlists may also be streamed with Reader and Writer, which only hold a
+// single entry in memory at a time.
+//
+// Playlists are read leniently: the #EXTM3U header is optional, songs may be listed without an
+// #EXTINF line, and other directives and comments are skipped. (e.g. #EXTGRP and #PLAYLIST) Both
+// .m3u and .m3u8 files are read, and are written as UTF-8.
 class Playlist
 {
 public:
-
-	static const char* const cExtension;
-
 	struct Entry
 	{
 		Entry() {}
 		Entry(const std::string& initSong, const std::string& initInfo)
 			: song(initSong), info(initInfo) {}
 		std::string song;
+		// The full #EXTINF line, or empty if there was none.
 		std::string info;
 
 		bool operator==(const Entry& other) const
@@ -40,8 +48,69 @@ public:
 		bool operator!=(const Entry& other) const	{return !(*this == other);}
 	};
 
-	bool load(const std::string& fileName);
-	bool save(const std::string& fileName) const;
+	class Reader
+	{
+	public:
+		Reader();
+
+		bool open(FileSystem& fileSystem, const std::string& fileName);
+
+		// Returns false at the end of the playlist or when an error occurred. The file is closed
+		// once the end is reached.
+		bool next(Entry& entry);
+		bool hasError() const	{return m_error;}
+
+	private:
+		bool readLine(std::string& line);
+
+		std::unique_ptr<FileSystem::ReadFile> m_file;
+		std::string m_path;
+		std::vector<char> m_buffer;
+		std::size_t m_offset;
+		std::size_t m_size;
+		// Time spent in open() and next(), leaving out the time between entries while streaming.
+		std::chrono::steady_clock::duration m_loadDuration;
+		bool m_firstLine;
+		bool m_endOfFile;
+		bool m_error;
+	};
+
+	// Writes to a temporary file, which replaces the playlist once committed so an interrupted
+	// sync never leaves a truncated playlist.
+	class Writer
+	{
+	public:
+		Writer();
+		~Writer();
+
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+
+		bool open(FileSystem& fileSystem, const std::string& fileName);
+		bool addSong(std::string_view song, std::string_view info);
+
+		// Finishes writing the temporary file without replacing the playlist. The temporary file
+		// is removed if this fails or isn't called.
+		bool close();
+
+		// Replaces a playlist with the temporary file that was closed earlier.
+		static bool commit(FileSystem& fileSystem, const std::string& fileName);
+		static void discard(FileSystem& fileSystem, const std::string& fileName);
+
+	private:
+		bool flush();
+
+		FileSystem* m_fileSystem;
+		std::string m_fileName;
+		std::unique_ptr<FileSystem::WriteFile> m_file;
+		std::string m_buffer;
+		bool m_error;
+	};
+
+	static bool isPlaylistFile(const std::string& fileName);
+
+	bool load(FileSystem& fileSystem, const std::string& fileName);
+	bool save(FileSystem& fileSystem, const std::string& fileName) const;
 
 	void addSong(const std::string& song, const std::string& info);
 
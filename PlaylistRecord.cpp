@@ -0,0 +1,118 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PlaylistRecord.h"
+
+#include "Helpers.h"
+#include "Log.h"
+#include <cstring>
+
+const char* const PlaylistRecord::cDirectoryName = ".MusicSyncPlaylists";
+
+// Records are stored as M3U files so they can be streamed like playlists, but with a different
+// extension so players don't list them as playlists on the device.
+static const char* const cRecordExtension = ".songs";
+// Destinations starting with '#' would be read as directives, so they're written relative to the
+// current directory instead.
+static const char* const cCurrentDirectory = "./";
+
+static std::string getRecordPath(const std::string& playlistFileName)
+{
+	return std::string(PlaylistRecord::cDirectoryName) + Helpers::cPathSeparator +
+		playlistFileName + cRecordExtension;
+}
+
+bool PlaylistRecord::Reader::open(FileSystem& songDir, const std::string& playlistFileName)
+{
+	return m_reader.open(songDir, getRecordPath(playlistFileName));
+}
+
+bool PlaylistRecord::Reader::next(std::string& destination)
+{
+	if (!m_reader.next(m_entry))
+		return false;
+
+	std::size_t prefixLength = std::strlen(cCurrentDirectory);
+	if (m_entry.song.compare(0, prefixLength, cCurrentDirectory) == 0)
+		destination.assign(m_entry.song, prefixLength, std::string::npos);
+	else
+		destination.swap(m_entry.song);
+	return true;
+}
+
+bool PlaylistRecord::isRecordPath(const std::string& relativePath)
+{
+	std::size_t length = std::strlen(cDirectoryName);
+	return relativePath.size() > length && relativePath[length] == Helpers::cPathSeparator &&
+		relativePath.compare(0, length, cDirectoryName) == 0;
+}
+
+bool PlaylistRecord::exists(FileSystem& songDir, const std::string& playlistFileName)
+{
+	FileSystem::FileInfo info;
+	return songDir.getFileInfo(info, getRecordPath(playlistFileName));
+}
+
+bool PlaylistRecord::open(FileSystem& songDir, const std::string& playlistFileName)
+{
+	std::string path = getRecordPath(playlistFileName);
+	if (!songDir.createParentDirectories(path))
+	{
+		Log::error("Error: Couldn't save file '%s'.\n", songDir.getPath(path).c_str());
+		return false;
+	}
+	return m_writer.open(songDir, path);
+}
+
+bool PlaylistRecord::addSong(const std::string& destination)
+{
+	if (!destination.empty() && destination[0] == '#')
+		return m_writer.addSong(cCurrentDirectory + destination, std::string_view());
+	return m_writer.addSong(destination, std::string_view());
+}
+
+bool PlaylistRecord::close()
+{
+	return m_writer.close();
+}
+
+bool PlaylistRecord::commit(FileSystem& songDir, const std::string& playlistFileName)
+{
+	return Playlist::Writer::commit(songDir, getRecordPath(playlistFileName));
+}
+
+void PlaylistRecord::discard(FileSystem& songDir, const std::string& playlistFileName)
+{
+	Playlist::Writer::discard(songDir, getRecordPath(playlistFileName));
+}
+
+bool PlaylistRecord::remove(FileSystem& songDir, const std::string& playlistFileName)
+{
+	return songDir.removeFile(getRecordPath(playlistFileName));
+}
+
+bool PlaylistRecord::read(FileSystem& songDir, const std::string& playlistFileName,
+	const std::function<void(const std::string& destination)>& addSong)
+{
+	Reader reader;
+	if (!reader.open(songDir, playlistFileName))
+		return false;
+
+	std::string destination;
+	while (reader.next(destination))
+		addSong(destination);
+	return !reader.hasError();
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "FileSystem.h"
+#include "Playlist.h"
+#include <functional>
+#include <string>
+
+// Songs that a playlist on the device referenced when it was last written. This is used to keep
+// the songs of playlists that are skipped by a sync without reading the playlists they came from.
+//
+// Records are kept in a hidden directory inside the song output directory, with one file for each
+// playlist listing the destinations of its songs. They're written alongside the playlist and
+// committed just before it, so a record is never older than the playlist on the device.
+class PlaylistRecord
+{
+public:
+	// Reads the destinations of the songs one at a time.
+	class Reader
+	{
+	public:
+		bool open(FileSystem& songDir, const std::string& playlistFileName);
+
+		// Returns false at the end of the record or when an error occurred.
+		bool next(std::string& destination);
+		bool hasError() const	{return m_reader.hasError();}
+
+	private:
+		Playlist::Reader m_reader;
+		Playlist::Entry m_entry;
+	};
+
+	static const char* const cDirectoryName;
+
+	// Returns whether a path relative to the song directory is for a record, which must not be
+	// removed along with old songs.
+	static bool isRecordPath(const std::string& relativePath);
+	static bool exists(FileSystem& songDir, const std::string& playlistFileName);
+
+	// Writes the record to a temporary file like Playlist::Writer.
+	bool open(FileSystem& songDir, const std::string& playlistFileName);
+	bool addSong(const std::string& destination);
+	bool close();
+
+	static bool commit(FileSystem& songDir, const std::string& playlistFileName);
+	static void discard(FileSystem& songDir, const std::string& playlistFileName);
+	static bool remove(FileSystem& songDir, const std::string& playlistFileName);
+
+	// Calls addSong with the destination of each song. Returns false if the record couldn't be
+	// read.
+	static bool read(FileSystem& songDir, const std::string& playlistFileName,
+		const std::function<void(const std::string& destination)>& addSong);
+
+private:
+	Playlist::Writer m_writer;
+};
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PlaylistScheduler.h"
+
+#include <cassert>
+
+PlaylistScheduler::PlaylistScheduler(WriteFunction write, DiscardFunction discard)
+	: m_write(std::move(write)), m_discard(std::move(discard)), m_nextPlaylistId(0)
+{
+}
+
+void PlaylistScheduler::addSong(const std::string& song)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_songs.emplace(song, SongState());
+}
+
+std::size_t PlaylistScheduler::beginPlaylist(const std::string& fileName)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::size_t id = m_nextPlaylistId++;
+	m_playlists.emplace(id, PendingPlaylist{fileName, 0, false, false});
+	return id;
+}
+
+void PlaylistScheduler::addPlaylistSong(std::size_t playlist, const std::string& song)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto foundIter = m_songs.find(song);
+	if (foundIter == m_songs.end())
+	{
+		if (!m_failedSongs.empty() && m_failedSongs.count(song) > 0)
+		{
+			auto playlistIter = m_playlists.find(playlist);
+			assert(playlistIter != m_playlists.end());
+			playlistIter->second.failed = true;
+		}
+		return;
+	}
+
+	// Playlists may list the same song more than once.
+	std::vector<std::size_t>& waitingPlaylists = foundIter->second.waitingPlaylists;
+	if (!waitingPlaylists.empty() && waitingPlaylists.back() == playlist)
+		return;
+
+	auto playlistIter = m_playlists.find(playlist);
+	assert(playlistIter != m_playlists.end());
+	assert(!playlistIter->second.finished);
+	waitingPlaylists.push_back(playlist);
+	++playlistIter->second.remainingSongs;
+}
+
+void PlaylistScheduler::finishPlaylist(std::size_t playlist)
+{
+	std::string fileName;
+	bool failed;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto foundIter = m_playlists.find(playlist);
+		assert(foundIter != m_playlists.end());
+		failed = foundIter->second.failed;
+		if (!failed && foundIter->second.remainingSongs > 0)
+		{
+			foundIter->second.finished = true;
+			return;
+		}
+
+		fileName = std::move(foundIter->second.fileName);
+		m_playlists.erase(foundIter);
+	}
+
+	if (failed)
+		m_discard(fileName);
+	else
+		m_write(fileName);
+}
+
+void PlaylistScheduler::cancelPlaylist(std::size_t playlist)
+{
+	// Songs may still refer to the playlist, which are skipped once finished.
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_playlists.erase(playlist);
+}
+
+void PlaylistScheduler::finishSong(const std::string& song)
+{
+	std::vector<std::string> readyPlaylists;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto foundIter = m_songs.find(song);
+		if (foundIter == m_songs.end())
+			return;
+
+		for (std::size_t id : foundIter->second.waitingPlaylists)
+		{
+			auto playlistIter = m_playlists.find(id);
+			if (playlistIter == m_playlists.end())
+				continue;
+
+			assert(playlistIter->second.remainingSongs > 0);
+			if (--playlistIter->second.remainingSongs == 0 && playlistIter->second.finished)
+			{
+				readyPlaylists.push_back(std::move(playlistIter->second.fileName));
+				m_playlists.erase(playlistIter);
+			}
+		}
+
+		// Songs that aren't known are treated as finished, so only songs in flight are tracked.
+		m_songs.erase(foundIter);
+	}
+
+	for (const std::string& fileName : readyPlaylists)
+		m_write(fileName);
+}
+
+void PlaylistScheduler::failSong(const std::string& song)
+{
+	// Playlists that are still being added are discarded once finished.
+	std::vector<std::string> failedPlaylists;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_failedSongs.insert(song);
+		auto foundIter = m_songs.find(song);
+		if (foundIter == m_songs.end())
+			return;
+
+		for (std::size_t id : foundIter->second.waitingPlaylists)
+		{
+			auto playlistIter = m_playlists.find(id);
+			if (playlistIter == m_playlists.end())
+				continue;
+
+			if (playlistIter->second.finished)
+			{
+				failedPlaylists.push_back(std::move(playlistIter->second.fileName));
+				m_playlists.erase(playlistIter);
+			}
+			else
+				playlistIter->second.failed = true;
+		}
+		m_songs.erase(foundIter);
+	}
+
+	for (const std::string& fileName : failedPlaylists)
+		m_discard(fileName);
+}
+
+std::vector<std::string> PlaylistScheduler::getPendingPlaylists() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<std::string> fileNames;
+	fileNames.reserve(m_playlists.size());
+	for (const auto& playlist : m_playlists)
+		fileNames.push_back(playlist.second.fileName);
+	return fileNames;
+}
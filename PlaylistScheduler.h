@@ -0,0 +1,87 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Writes each playlist as soon as all of its songs have been synchronized. Playlists with a song
+// that couldn't be synchronized are discarded instead, so a playlist is never written referring to
+// songs that aren't on the device.
+//
+// Songs are added before they are queued to be copied and finished once they have been processed.
+// When combined with queueing songs in the order of the playlists, this completes playlists one at
+// a time so an interrupted sync leaves complete playlists rather than many partial ones. Songs are
+// forgotten once finished and playlists only track the songs they're waiting on, so the memory use
+// only depends on the number of songs in flight rather than the size of the playlists.
+//
+// All functions are thread-safe. The write and discard functions are called without any locks
+// held from whichever thread completed the playlist.
+class PlaylistScheduler
+{
+public:
+	using WriteFunction = std::function<void(const std::string& fileName)>;
+	using DiscardFunction = std::function<void(const std::string& fileName)>;
+
+	PlaylistScheduler(WriteFunction write, DiscardFunction discard);
+
+	void addSong(const std::string& song);
+
+	// Playlists are added one song at a time, and may only be written once they are finished.
+	// Returns the ID to add songs to the playlist with.
+	std::size_t beginPlaylist(const std::string& fileName);
+	void addPlaylistSong(std::size_t playlist, const std::string& song);
+	void finishPlaylist(std::size_t playlist);
+	// Forgets a playlist without writing it.
+	void cancelPlaylist(std::size_t playlist);
+
+	void finishSong(const std::string& song);
+	// Discards the playlists that refer to a song that couldn't be synchronized, including
+	// playlists that add it later.
+	void failSong(const std::string& song);
+
+	// Returns the file names of the playlists still waiting for songs.
+	std::vector<std::string> getPendingPlaylists() const;
+
+private:
+	struct PendingPlaylist
+	{
+		std::string fileName;
+		std::size_t remainingSongs;
+		bool finished;
+		bool failed;
+	};
+
+	struct SongState
+	{
+		std::vector<std::size_t> waitingPlaylists;
+	};
+
+	WriteFunction m_write;
+	DiscardFunction m_discard;
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, SongState> m_songs;
+	std::unordered_map<std::size_t, PendingPlaylist> m_playlists;
+	std::unordered_set<std::string> m_failedSongs;
+	std::size_t m_nextPlaylistId;
+};
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PlaylistSnapshot.h"
+
+#include "Hash.h"
+#include "Playlist.h"
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+const char cMagic[8] = {'M', 'S', 'P', 'L', 'S', 'N', 'A', 'P'};
+// Increment when the layout changes so old snapshots are ignored.
+const std::uint32_t cVersion = 1;
+const char* const cSnapshotExtension = ".snapshot";
+const char* const cTempExtension = ".tmp";
+
+struct Header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t pathLength;
+	std::uint64_t playlistSize;
+	std::int64_t playlistModifiedTime;
+	std::uint64_t entryCount;
+	// Size of the entries following the path.
+	std::uint64_t dataSize;
+};
+
+std::filesystem::path getSnapshotPath(const std::string& cacheDir,
+	const std::string& playlistPath)
+{
+	return std::filesystem::u8path(cacheDir) /
+		(Hash::hashString(playlistPath, Hash::Algorithm::XXH64) + cSnapshotExtension);
+}
+
+// Reads the entry at offset, returning false if it would go past the end.
+bool readEntry(std::size_t& offset, std::string_view& song, std::string_view& info,
+	const char* data, std::size_t size)
+{
+	std::uint32_t lengths[2];
+	if (size - offset < sizeof(lengths))
+		return false;
+
+	// The mapping may not be aligned for the lengths.
+	std::memcpy(lengths, data + offset, sizeof(lengths));
+	offset += sizeof(lengths);
+	if (size - offset < static_cast<std::uint64_t>(lengths[0]) + lengths[1])
+		return false;
+
+	song = std::string_view(data + offset, lengths[0]);
+	offset += lengths[0];
+	info = std::string_view(data + offset, lengths[1]);
+	offset += lengths[1];
+	return true;
+}
+
+const char* mapFile(std::size_t& size, const std::filesystem::path& path)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	// The view keeps the mapping alive after the handles are closed.
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return nullptr;
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data)
+		return nullptr;
+
+	size = static_cast<std::size_t>(fileSize.QuadPart);
+	return static_cast<const char*>(data);
+#else
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return nullptr;
+	}
+
+	// The mapping stays valid after the file is closed.
+	void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	madvise(data, info.st_size, MADV_SEQUENTIAL);
+	size = static_cast<std::size_t>(info.st_size);
+	return static_cast<const char*>(data);
+#endif
+}
+
+void unmapFile(const char* data, std::size_t size)
+{
+#if defined(_WIN32)
+	(void)size;
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<char*>(data), size);
+#endif
+}
+
+} // namespace
+
+PlaylistSnapshot::Writer::Writer()
+	: m_entryCount(0), m_dataSize(0)
+{
+}
+
+PlaylistSnapshot::Writer::~Writer()
+{
+	if (m_stream.is_open())
+	{
+		m_stream.close();
+		std::error_code error;
+		std::filesystem::remove(std::filesystem::u8path(m_path + cTempExtension), error);
+	}
+}
+
+bool PlaylistSnapshot::Writer::open(const std::string& cacheDir,
+	const std::string& playlistPath, const FileSystem::FileInfo& info)
+{
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::u8path(cacheDir), error);
+	if (error)
+		return false;
+
+	m_path = getSnapshotPath(cacheDir, playlistPath).u8string();
+	m_playlistPath = playlistPath;
+	m_info = info;
+	m_entryCount = 0;
+	m_dataSize = 0;
+
+	// The header is written again once the entries are known.
+	m_stream.open(std::filesystem::u8path(m_path + cTempExtension),
+		std::ios::binary | std::ios::trunc);
+	Header header = {};
+	m_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_stream.write(playlistPath.data(), playlistPath.size());
+	if (!m_stream.good())
+	{
+		m_stream.close();
+		std::filesystem::remove(std::filesystem::u8path(m_path + cTempExtension), error);
+		return false;
+	}
+	return true;
+}
+
+void PlaylistSnapshot::Writer::addSong(std::string_view song, std::string_view info)
+{
+	if (!m_stream.is_open())
+		return;
+
+	std::uint32_t lengths[2] =
+		{static_cast<std::uint32_t>(song.size()), static_cast<std::uint32_t>(info.size())};
+	m_stream.write(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+	m_stream.write(song.data(), song.size());
+	m_stream.write(info.data(), info.size());
+	++m_entryCount;
+	m_dataSize += sizeof(lengths) + song.size() + info.size();
+}
+
+bool PlaylistSnapshot::Writer::close()
+{
+	if (!m_stream.is_open())
+		return false;
+
+	Header header;
+	std::memcpy(header.magic, cMagic, sizeof(cMagic));
+	header.version = cVersion;
+	header.pathLength = static_cast<std::uint32_t>(m_playlistPath.size());
+	header.playlistSize = m_info.size;
+	header.playlistModifiedTime = m_info.modifiedTime;
+	header.entryCount = m_entryCount;
+	header.dataSize = m_dataSize;
+	m_stream.seekp(0);
+	m_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_stream.close();
+
+	std::filesystem::path tempPath = std::filesystem::u8path(m_path + cTempExtension);
+	std::error_code error;
+	if (m_stream.fail())
+	{
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	std::filesystem::rename(tempPath, std::filesystem::u8path(m_path), error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
+
+PlaylistSnapshot::PlaylistSnapshot()
+	: m_data(nullptr), m_size(0), m_entriesOffset(0), m_offset(0), m_entryCount(0)
+{
+}
+
+PlaylistSnapshot::~PlaylistSnapshot()
+{
+	close();
+}
+
+bool PlaylistSnapshot::open(const std::string& cacheDir, const std::string& playlistPath,
+	const FileSystem::FileInfo& info)
+{
+	close();
+	m_data = mapFile(m_size, getSnapshotPath(cacheDir, playlistPath));
+	if (!m_data)
+		return false;
+
+	Header header;
+	if (m_size < sizeof(header))
+	{
+		close();
+		return false;
+	}
+
+	std::memcpy(&header, m_data, sizeof(header));
+	if (std::memcmp(header.magic, cMagic, sizeof(cMagic)) != 0 || header.version != cVersion ||
+		header.playlistSize != info.size || header.playlistModifiedTime != info.modifiedTime ||
+		m_size - sizeof(header) < header.pathLength ||
+		m_size - sizeof(header) - header.pathLength != header.dataSize ||
+		std::string_view(m_data + sizeof(header), header.pathLength) != playlistPath)
+	{
+		close();
+		return false;
+	}
+
+	// Check every entry up front so reading them can't fail part way through.
+	m_entriesOffset = sizeof(header) + header.pathLength;
+	std::size_t offset = m_entriesOffset;
+	std::string_view song, songInfo;
+	for (std::uint64_t i = 0; i < header.entryCount; ++i)
+	{
+		if (!readEntry(offset, song, songInfo, m_data, m_size))
+		{
+			close();
+			return false;
+		}
+	}
+
+	if (offset != m_size)
+	{
+		close();
+		return false;
+	}
+
+	m_offset = m_entriesOffset;
+	m_entryCount = static_cast<std::size_t>(header.entryCount);
+	return true;
+}
+
+void PlaylistSnapshot::close()
+{
+	if (m_data)
+		unmapFile(m_data, m_size);
+	m_data = nullptr;
+	m_size = 0;
+	m_entriesOffset = 0;
+	m_offset = 0;
+	m_entryCount = 0;
+}
+
+bool PlaylistSnapshot::next(std::string_view& song, std::string_view& info)
+{
+	if (!m_data)
+		return false;
+	return readEntry(m_offset, song, info, m_data, m_size);
+}
+
+void PlaylistSnapshot::load(Playlist& playlist)
+{
+	rewind();
+	std::string_view song, info;
+	while (next(song, info))
+		playlist.addSong(std::string(song), std::string(info));
+}
+
+bool PlaylistSnapshot::save(const std::string& cacheDir, const std::string& playlistPath,
+	const FileSystem::FileInfo& info, const Playlist& playlist)
+{
+	Writer writer;
+	if (!writer.open(cacheDir, playlistPath, info))
+		return false;
+
+	for (const Playlist::Entry& entry : playlist.getEntries())
+		writer.addSong(entry.song, entry.info);
+	return writer.close();
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "FileSystem.h"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+class Playlist;
+
+// Parsed playlist saved in a cache directory so playlists that haven't changed since the last sync
+// don't need to be parsed again.
+//
+// Each snapshot is a single file that is memory mapped and read in place. Entries are stored as
+// their lengths followed by the strings, so reading them only returns views into the mapping.
+// Snapshots are named after a hash of the full path of the playlist, and are only used while the
+// size and modified time of the playlist match. They use the native byte order since they're only
+// a local cache, and the cache directory may be cleared at any time.
+class PlaylistSnapshot
+{
+public:
+	// Saves a snapshot one entry at a time. The snapshot is written to a temporary file that only
+	// replaces the previous snapshot once closed.
+	class Writer
+	{
+	public:
+		Writer();
+		~Writer();
+
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+
+		bool open(const std::string& cacheDir, const std::string& playlistPath,
+			const FileSystem::FileInfo& info);
+		bool isOpen() const	{return m_stream.is_open();}
+
+		void addSong(std::string_view song, std::string_view info);
+		bool close();
+
+	private:
+		std::ofstream m_stream;
+		std::string m_path;
+		std::string m_playlistPath;
+		FileSystem::FileInfo m_info;
+		std::uint64_t m_entryCount;
+		std::uint64_t m_dataSize;
+	};
+
+	PlaylistSnapshot();
+	~PlaylistSnapshot();
+
+	PlaylistSnapshot(const PlaylistSnapshot&) = delete;
+	PlaylistSnapshot& operator=(const PlaylistSnapshot&) = delete;
+
+	// Returns false if there's no snapshot, it's invalid, or the playlist changed since it was
+	// saved.
+	bool open(const std::string& cacheDir, const std::string& playlistPath,
+		const FileSystem::FileInfo& info);
+	void close();
+
+	std::size_t getEntryCount() const	{return m_entryCount;}
+
+	// Reads the entries in order. Returns false after the last entry.
+	bool next(std::string_view& song, std::string_view& info);
+	// Starts reading from the first entry again.
+	void rewind()	{m_offset = m_entriesOffset;}
+
+	// Copies all entries into a playlist.
+	void load(Playlist& playlist);
+
+	static bool save(const std::string& cacheDir, const std::string& playlistPath,
+		const FileSystem::FileInfo& info, const Playlist& playlist);
+
+private:
+	const char* m_data;
+	std::size_t m_size;
+	std::size_t m_entriesOffset;
+	std::size_t m_offset;
+	std::size_t m_entryCount;
+};
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SessionState.h"
+
+#include "Options.h"
+
+SessionState::SessionState(FileSystem::Opener openFileSystem)
+	: m_openFileSystem(std::move(openFileSystem)), m_cancelled(false), m_caching(false),
+	m_noUnicode(false)
+{
+}
+
+void SessionState::setProgressFunction(SyncSession::ProgressFunction progress)
+{
+	std::lock_guard<std::mutex> lock(m_progressMutex);
+	m_progressFunction = std::move(progress);
+}
+
+SyncSession::Progress SessionState::getProgress()
+{
+	std::lock_guard<std::mutex> lock(m_progressMutex);
+	return m_progress;
+}
+
+void SessionState::startSync(const Options& options)
+{
+	m_cancelled = false;
+	{
+		std::lock_guard<std::mutex> lock(m_progressMutex);
+		m_progress = SyncSession::Progress();
+	}
+
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_caching = options.memoryLimit == 0;
+	if (!m_caching)
+	{
+		clearCacheLocked();
+		return;
+	}
+
+	if (options.pathTrims != m_pathTrims || options.noUnicode != m_noUnicode)
+	{
+		m_songPaths.clear();
+		m_pathTrims = options.pathTrims;
+		m_noUnicode = options.noUnicode;
+	}
+
+	if (options.songOutput != m_songOutput)
+	{
+		m_destinations.clear();
+		m_songOutput = options.songOutput;
+	}
+
+	m_seenPlaylists.clear();
+}
+
+void SessionState::finishSync()
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	for (auto iter = m_playlists.begin(); iter != m_playlists.end();)
+	{
+		if (m_seenPlaylists.find(iter->first) == m_seenPlaylists.end())
+			iter = m_playlists.erase(iter);
+		else
+			++iter;
+	}
+	m_seenPlaylists.clear();
+}
+
+void SessionState::clearCache()
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	clearCacheLocked();
+}
+
+bool SessionState::isCaching() const
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	return m_caching;
+}
+
+std::shared_ptr<const Playlist> SessionState::findPlaylist(const std::string& path,
+	const FileSystem::FileInfo& info)
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	auto foundIter = m_playlists.find(path);
+	if (foundIter == m_playlists.end() || foundIter->second.info.size != info.size ||
+		foundIter->second.info.modifiedTime != info.modifiedTime)
+	{
+		return nullptr;
+	}
+
+	m_seenPlaylists.insert(path);
+	return foundIter->second.playlist;
+}
+
+void SessionState::addPlaylist(const std::string& path, const FileSystem::FileInfo& info,
+	std::shared_ptr<const Playlist> playlist)
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	if (!m_caching)
+		return;
+
+	m_seenPlaylists.insert(path);
+	m_playlists[path] = CachedPlaylist{info, std::move(playlist)};
+}
+
+bool SessionState::findSongPath(std::string& relativePath, const std::string& song) const
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	auto foundIter = m_songPaths.find(song);
+	if (foundIter == m_songPaths.end())
+		return false;
+
+	relativePath = foundIter->second;
+	return true;
+}
+
+void SessionState::addSongPath(const std::string& song, const std::string& relativePath)
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	if (m_caching)
+		m_songPaths[song] = relativePath;
+}
+
+bool SessionState::findDestination(FileSystem::FileInfo& info,
+	const std::string& relativePath) const
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	auto foundIter = m_destinations.find(relativePath);
+	if (foundIter == m_destinations.end())
+		return false;
+
+	info = foundIter->second;
+	return true;
+}
+
+void SessionState::setDestination(const std::string& relativePath,
+	const FileSystem::FileInfo& info)
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	if (m_caching)
+		m_destinations[relativePath] = info;
+}
+
+void SessionState::removeDestination(const std::string& relativePath)
+{
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_destinations.erase(relativePath);
+}
+
+void SessionState::clearCacheLocked()
+{
+	m_pathTrims.clear();
+	m_noUnicode = false;
+	m_songOutput.clear();
+	m_playlists.clear();
+	m_seenPlaylists.clear();
+	m_songPaths.clear();
+	m_destinations.clear();
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "FileSystem.h"
+#include "Playlist.h"
+#include "SyncSession.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct Options;
+
+// State of a SyncSession that is used while synchronizing: the file systems to use, cancellation,
+// progress, and the caches kept between syncs.
+//
+// All functions are thread-safe.
+class SessionState
+{
+public:
+	explicit SessionState(FileSystem::Opener openFileSystem);
+
+	const FileSystem::Opener& getOpener() const	{return m_openFileSystem;}
+
+	void cancel()	{m_cancelled = true;}
+	bool isCancelled() const	{return m_cancelled;}
+	const std::atomic<bool>& getCancelled() const	{return m_cancelled;}
+
+	void setProgressFunction(SyncSession::ProgressFunction progress);
+	SyncSession::Progress getProgress();
+
+	// Updates the progress with a function that modifies it, then reports it.
+	template <typename UpdateFunction>
+	void updateProgress(UpdateFunction update)
+	{
+		std::lock_guard<std::mutex> lock(m_progressMutex);
+		update(m_progress);
+		if (m_progressFunction)
+			m_progressFunction(m_progress);
+	}
+
+	// Resets the progress and cancellation, and drops cached entries that don't apply to the
+	// options.
+	void startSync(const Options& options);
+	// Drops cached playlists that weren't seen during the sync.
+	void finishSync();
+	void clearCache();
+
+	bool isCaching() const;
+
+	// Playlists are cached by full path, and only used while the size and modified time match.
+	std::shared_ptr<const Playlist> findPlaylist(const std::string& path,
+		const FileSystem::FileInfo& info);
+	void addPlaylist(const std::string& path, const FileSystem::FileInfo& info,
+		std::shared_ptr<const Playlist> playlist);
+
+	// Destination paths relative to the song directory, which are empty for songs that can't be
+	// synchronized.
+	bool findSongPath(std::string& relativePath, const std::string& song) const;
+	void addSongPath(const std::string& song, const std::string& relativePath);
+
+	// Songs on the device, relative to the song directory.
+	bool findDestination(FileSystem::FileInfo& info, const std::string& relativePath) const;
+	void setDestination(const std::string& relativePath, const FileSystem::FileInfo& info);
+	void removeDestination(const std::string& relativePath);
+
+private:
+	struct CachedPlaylist
+	{
+		FileSystem::FileInfo info;
+		std::shared_ptr<const Playlist> playlist;
+	};
+
+	void clearCacheLocked();
+
+	FileSystem::Opener m_openFileSystem;
+	std::atomic<bool> m_cancelled;
+
+	std::mutex m_progressMutex;
+	SyncSession::ProgressFunction m_progressFunction;
+	SyncSession::Progress m_progress;
+
+	mutable std::mutex m_cacheMutex;
+	bool m_caching;
+	// Options the cached song paths and destinations depend on.
+	std::vector<std::string> m_pathTrims;
+	bool m_noUnicode;
+	std::string m_songOutput;
+	std::unordered_map<std::string, CachedPlaylist> m_playlists;
+	std::unordered_set<std::string> m_seenPlaylists;
+	std::unordered_map<std::string, std::string> m_songPaths;
+	std::unordered_map<std::string, FileSystem::FileInfo> m_destinations;
+};
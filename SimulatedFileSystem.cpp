@@ -0,0 +1,243 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SimulatedFileSystem.h"
+
+#include <algorithm>
+#include <thread>
+
+class SimulatedFileSystem::SimulatedReadFile : public FileSystem::ReadFile
+{
+public:
+	SimulatedReadFile(std::shared_ptr<Device> device, std::unique_ptr<ReadFile> file)
+		: m_device(std::move(device)), m_file(std::move(file))
+	{
+	}
+
+	bool getInfo(FileInfo& info) override
+	{
+		// The information is already known from opening the file.
+		return m_file->getInfo(info);
+	}
+
+	std::ptrdiff_t read(void* data, std::size_t size) override
+	{
+		std::ptrdiff_t readSize = m_file->read(data, size);
+		m_device->performOperation(std::max(readSize, std::ptrdiff_t(0)), 0);
+		return readSize;
+	}
+
+private:
+	std::shared_ptr<Device> m_device;
+	std::unique_ptr<ReadFile> m_file;
+};
+
+class SimulatedFileSystem::SimulatedWriteFile : public FileSystem::WriteFile
+{
+public:
+	SimulatedWriteFile(std::shared_ptr<Device> device, std::unique_ptr<WriteFile> file)
+		: m_device(std::move(device)), m_file(std::move(file))
+	{
+	}
+
+	bool write(const void* data, std::size_t size) override
+	{
+		bool success = m_file->write(data, size);
+		m_device->performOperation(0, success ? size : 0);
+		return success;
+	}
+
+	bool truncate(std::uint64_t size) override
+	{
+		m_device->performOperation(0, 0);
+		return m_file->truncate(size);
+	}
+
+	bool setModifiedTime(std::int64_t modifiedTime) override
+	{
+		m_device->performOperation(0, 0);
+		return m_file->setModifiedTime(modifiedTime);
+	}
+
+	bool close() override
+	{
+		m_device->performOperation(0, 0);
+		return m_file->close();
+	}
+
+	void preallocate(std::uint64_t size) override
+	{
+		m_file->preallocate(size);
+	}
+
+	void startWriteback() override
+	{
+		m_file->startWriteback();
+	}
+
+private:
+	std::shared_ptr<Device> m_device;
+	std::unique_ptr<WriteFile> m_file;
+};
+
+SimulatedFileSystem::Device::Device(const Settings& settings)
+	: m_settings(settings), m_slots(std::max(settings.queueDepth, 1U))
+{
+}
+
+SimulatedFileSystem::Statistics SimulatedFileSystem::Device::getStatistics() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_statistics;
+}
+
+void SimulatedFileSystem::Device::performOperation(std::uint64_t readSize,
+	std::uint64_t writeSize)
+{
+	Clock::duration duration = m_settings.latency;
+	if (readSize > 0 && m_settings.readBytesPerSecond > 0)
+	{
+		duration += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+			double(readSize)/double(m_settings.readBytesPerSecond)));
+	}
+	if (writeSize > 0 && m_settings.writeBytesPerSecond > 0)
+	{
+		duration += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+			double(writeSize)/double(m_settings.writeBytesPerSecond)));
+	}
+
+	// Reserve the slot that frees up first. Scheduling against the time each slot is busy until
+	// rather than sleeping for the duration keeps the total time independent of how long the
+	// threads take to wake up.
+	Clock::time_point endTime;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_statistics.operations;
+		m_statistics.bytesRead += readSize;
+		m_statistics.bytesWritten += writeSize;
+
+		auto slot = std::min_element(m_slots.begin(), m_slots.end());
+		endTime = std::max(*slot, Clock::now()) + duration;
+		*slot = endTime;
+	}
+
+	std::this_thread::sleep_until(endTime);
+}
+
+SimulatedFileSystem::Settings SimulatedFileSystem::getUsb2Settings()
+{
+	// USB 2.0 tops out around 35 MB/s in practice, and cheap flash drives write much slower than
+	// they read. Each command is a round trip over the bus.
+	Settings settings;
+	settings.latency = std::chrono::microseconds(1000);
+	settings.readBytesPerSecond = 30*1024*1024;
+	settings.writeBytesPerSecond = 10*1024*1024;
+	settings.queueDepth = 1;
+	settings.fileSystemType = FileSystemType::Fat;
+	return settings;
+}
+
+SimulatedFileSystem::SimulatedFileSystem(std::shared_ptr<Device> device,
+	std::unique_ptr<FileSystem> fileSystem)
+	: m_device(std::move(device)), m_fileSystem(std::move(fileSystem))
+{
+}
+
+FileSystem::Opener SimulatedFileSystem::wrapOpener(Opener opener, std::shared_ptr<Device> device)
+{
+	return [opener, device](const std::string& root, bool create) -> std::unique_ptr<FileSystem>
+	{
+		device->performOperation(0, 0);
+		std::unique_ptr<FileSystem> fileSystem = opener(root, create);
+		if (!fileSystem)
+			return nullptr;
+		return std::unique_ptr<FileSystem>(new SimulatedFileSystem(device, std::move(fileSystem)));
+	};
+}
+
+FileSystem::FileSystemType SimulatedFileSystem::getFileSystemType() const
+{
+	return m_device->getSettings().fileSystemType;
+}
+
+bool SimulatedFileSystem::getSpaceInfo(SpaceInfo& info) const
+{
+	m_device->performOperation(0, 0);
+	return m_fileSystem->getSpaceInfo(info);
+}
+
+bool SimulatedFileSystem::getFileInfo(FileInfo& info, const std::string& relativePath)
+{
+	m_device->performOperation(0, 0);
+	return m_fileSystem->getFileInfo(info, relativePath);
+}
+
+bool SimulatedFileSystem::listDirectory(std::vector<DirectoryEntry>& entries,
+	const std::string& relativeDir)
+{
+	m_device->performOperation(0, 0);
+	return m_fileSystem->listDirectory(entries, relativeDir);
+}
+
+bool SimulatedFileSystem::createParentDirectories(const std::string& relativePath)
+{
+	m_device->performOperation(0, 0);
+	return m_fileSystem->createParentDirectories(relativePath);
+}
+
+bool SimulatedFileSystem::removeFile(const std::string& relativePath)
+{
+	m_device->performOperation(0, 0);
+	return m_fileSystem->removeFile(relativePath);
+}
+
+bool SimulatedFileSystem::removeDirectory(const std::string& relativeDir)
+{
+	m_device->performOperation(0, 0);
+	return m_fileSystem->removeDirectory(relativeDir);
+}
+
+bool SimulatedFileSystem::renameFile(const std::string& fromPath, const std::string& toPath)
+{
+	m_device->performOperation(0, 0);
+	return m_fileSystem->renameFile(fromPath, toPath);
+}
+
+std::unique_ptr<FileSystem::ReadFile> SimulatedFileSystem::openRead(
+	const std::string& relativePath, ReadMode mode)
+{
+	m_device->performOperation(0, 0);
+	std::unique_ptr<ReadFile> file = m_fileSystem->openRead(relativePath, mode);
+	if (!file)
+		return nullptr;
+	return std::unique_ptr<ReadFile>(new SimulatedReadFile(m_device, std::move(file)));
+}
+
+std::unique_ptr<FileSystem::WriteFile> SimulatedFileSystem::openWrite(
+	const std::string& relativePath)
+{
+	m_device->performOperation(0, 0);
+	std::unique_ptr<WriteFile> file = m_fileSystem->openWrite(relativePath);
+	if (!file)
+		return nullptr;
+	return std::unique_ptr<WriteFile>(new SimulatedWriteFile(m_device, std::move(file)));
+}
+
+bool SimulatedFileSystem::syncFileSystem()
+{
+	m_device->performOperation(0, 0);
+	return m_fileSystem->syncFileSystem();
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "FileSystem.h"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// File system that forwards to another file system while simulating the timing of a slow device.
+// This allows the scheduling of reads and writes to be measured without the real hardware.
+//
+// Each operation takes a fixed latency plus the time to transfer its data at the device's
+// bandwidth. The device only processes a limited number of operations at once, and the rest wait
+// for the earliest free slot. Data isn't cached, so every write is charged when it's made.
+class SimulatedFileSystem : public FileSystem
+{
+public:
+	struct Settings
+	{
+		// Time for each operation before any data is transferred.
+		std::chrono::microseconds latency = std::chrono::microseconds(0);
+		// Bandwidth in bytes per second, or 0 for no limit.
+		std::uint64_t readBytesPerSecond = 0;
+		std::uint64_t writeBytesPerSecond = 0;
+		// Number of operations the device processes at once.
+		unsigned int queueDepth = 1;
+		// Type reported for the file system, which affects how modified times are compared.
+		FileSystemType fileSystemType = FileSystemType::Unknown;
+	};
+
+	struct Statistics
+	{
+		std::uint64_t operations = 0;
+		std::uint64_t bytesRead = 0;
+		std::uint64_t bytesWritten = 0;
+	};
+
+	// State shared by all file systems on the same device.
+	class Device
+	{
+	public:
+		explicit Device(const Settings& settings);
+
+		const Settings& getSettings() const	{return m_settings;}
+		Statistics getStatistics() const;
+
+		// Waits until an operation transferring the given data would complete.
+		void performOperation(std::uint64_t readSize, std::uint64_t writeSize);
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		Settings m_settings;
+
+		mutable std::mutex m_mutex;
+		// The time each slot in the queue is busy until.
+		std::vector<Clock::time_point> m_slots;
+		Statistics m_statistics;
+	};
+
+	// Approximates a FAT formatted USB 2.0 flash drive, which only handles a single command at a
+	// time.
+	static Settings getUsb2Settings();
+
+	SimulatedFileSystem(std::shared_ptr<Device> device, std::unique_ptr<FileSystem> fileSystem);
+
+	// Opens file systems with another opener and simulates the device on top of them.
+	static Opener wrapOpener(Opener opener, std::shared_ptr<Device> device);
+
+	const std::string& getRoot() const override	{return m_fileSystem->getRoot();}
+	FileSystemType getFileSystemType() const override;
+	bool getSpaceInfo(SpaceInfo& info) const override;
+
+	bool getFileInfo(FileInfo& info, const std::string& relativePath) override;
+	bool listDirectory(std::vector<DirectoryEntry>& entries,
+		const std::string& relativeDir) override;
+	bool createParentDirectories(const std::string& relativePath) override;
+	bool removeFile(const std::string& relativePath) override;
+	bool removeDirectory(const std::string& relativeDir) override;
+	bool renameFile(const std::string& fromPath, const std::string& toPath) override;
+
+	std::unique_ptr<ReadFile> openRead(const std::string& relativePath,
+		ReadMode mode = ReadMode::Normal) override;
+	std::unique_ptr<WriteFile> openWrite(const std::string& relativePath) override;
+
+	bool syncFileSystem() override;
+
+private:
+	class SimulatedReadFile;
+	class SimulatedWriteFile;
+
+	std::shared_ptr<Device> m_device;
+	std::unique_ptr<FileSystem> m_fileSystem;
+};
@@ -0,0 +1,241 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SongLayout.h"
+
+#include "FileSystem.h"
+#include "Hash.h"
+#include "Helpers.h"
+#include <sstream>
+
+const char* const SongLayout::cFileName = ".MusicSyncLayout";
+
+namespace
+{
+
+// Increment when the layout of the file changes so old files are ignored.
+const char* const cHeader = "#MusicSync layout 1";
+const char* const cSplitDirectory = "split";
+const char* const cNextDirectory = "next";
+
+const char* getSplitName(SongLayout::Split split)
+{
+	switch (split)
+	{
+		case SongLayout::Split::Letter:
+			return "letter";
+		case SongLayout::Split::Hash:
+			return "hash";
+		default:
+			return "none";
+	}
+}
+
+std::string getSubdirectory(const std::string& fileName, SongLayout::Split split)
+{
+	if (split == SongLayout::Split::Hash)
+	{
+		const std::size_t cHashLength = 2;
+		return Hash::hashString(Helpers::foldCase(fileName), Hash::Algorithm::XXH64).substr(0,
+			cHashLength);
+	}
+
+	// Only ASCII letters get their own directory so the names are the same on every device.
+	char c = fileName.empty() ? 0 : fileName[0];
+	if (c >= 'a' && c <= 'z')
+		return std::string(1, static_cast<char>(c - 'a' + 'A'));
+	else if (c >= 'A' && c <= 'Z')
+		return std::string(1, c);
+	else if (c >= '0' && c <= '9')
+		return "0-9";
+	return "_";
+}
+
+std::string getDirectoryKey(const std::string& relativePath)
+{
+	std::size_t separator = relativePath.find_last_of(Helpers::cPathSeparator);
+	if (separator == std::string::npos)
+		return std::string();
+	return Helpers::foldCase(relativePath.substr(0, separator));
+}
+
+} // namespace
+
+SongLayout::SongLayout(FileSystem& songDir, Split split, std::size_t maxSongs)
+	: m_songDir(songDir), m_requestedSplit(split), m_maxSongs(maxSongs),
+	m_previousSplit(Split::None), m_split(Split::None), m_canMove(false), m_moving(false)
+{
+}
+
+bool SongLayout::load(bool canMove)
+{
+	m_previousSplit = Split::None;
+	m_previousDirectories.clear();
+	m_pendingDirectories.clear();
+	m_songCounts.clear();
+	m_keptPaths.clear();
+
+	FileSystem::FileInfo info;
+	std::string contents;
+	bool success = true;
+	if (m_songDir.getFileInfo(info, cFileName))
+		success = m_songDir.readFile(contents, cFileName);
+
+	std::istringstream stream(contents);
+	std::string line;
+	if (success && Helpers::readLine(line, stream) && line == cHeader &&
+		Helpers::readLine(line, stream))
+	{
+		for (Split split : {Split::Letter, Split::Hash})
+		{
+			if (line == getSplitName(split))
+				m_previousSplit = split;
+		}
+
+		// Each line is whether the directory is split now or from the next sync, followed by the
+		// case folded path, separated by a tab.
+		while (Helpers::readLine(line, stream))
+		{
+			std::size_t separator = line.find('\t');
+			if (separator != std::string::npos)
+			{
+				std::string type = line.substr(0, separator);
+				if (type == cSplitDirectory)
+					m_previousDirectories.insert(line.substr(separator + 1));
+				else if (type == cNextDirectory)
+					m_pendingDirectories.insert(line.substr(separator + 1));
+			}
+
+			if (stream.eof())
+				break;
+		}
+	}
+
+	if (m_previousSplit == Split::None)
+		m_previousDirectories.clear();
+
+	m_canMove = canMove;
+	if (canMove)
+	{
+		m_split = m_requestedSplit;
+		m_directories.clear();
+		if (m_split != Split::None)
+		{
+			m_directories = m_previousDirectories;
+			m_directories.insert(m_pendingDirectories.begin(), m_pendingDirectories.end());
+		}
+		m_pendingDirectories.clear();
+	}
+	else
+	{
+		m_split = m_previousSplit;
+		m_directories = m_previousDirectories;
+	}
+
+	m_moving = m_directories != m_previousDirectories ||
+		(m_split != m_previousSplit && !m_directories.empty());
+	return success;
+}
+
+bool SongLayout::save(bool movesFinished)
+{
+	for (const auto& directoryCount : m_songCounts)
+	{
+		if (directoryCount.second > m_maxSongs)
+			m_pendingDirectories.insert(directoryCount.first);
+	}
+	m_songCounts.clear();
+
+	// Songs that weren't moved are still at their previous path, so keep the previous layout and
+	// split the directories of this sync again with the next one. Songs that were already moved
+	// are left in place then.
+	Split split = m_split;
+	const std::unordered_set<std::string>* directories = &m_directories;
+	if (m_moving && !movesFinished)
+	{
+		split = m_previousSplit;
+		directories = &m_previousDirectories;
+		for (const std::string& directory : m_directories)
+		{
+			if (m_previousDirectories.find(directory) == m_previousDirectories.end())
+				m_pendingDirectories.insert(directory);
+		}
+	}
+
+	FileSystem::FileInfo info;
+	bool exists = m_songDir.getFileInfo(info, cFileName);
+	if (directories->empty() && m_pendingDirectories.empty())
+		return !exists || m_songDir.removeFile(cFileName);
+
+	std::ostringstream stream;
+	stream << cHeader << '\n' << getSplitName(split) << '\n';
+	for (const std::string& directory : *directories)
+		stream << cSplitDirectory << '\t' << directory << '\n';
+	for (const std::string& directory : m_pendingDirectories)
+		stream << cNextDirectory << '\t' << directory << '\n';
+
+	std::string contents = stream.str();
+	std::string previousContents;
+	if (exists && m_songDir.readFile(previousContents, cFileName) && previousContents == contents)
+		return true;
+
+	// Replace the file in one step so an interrupted save keeps the previous layout.
+	return m_songDir.replaceFile(cFileName, contents);
+}
+
+std::string SongLayout::getPath(const std::string& relativePath) const
+{
+	return getPath(relativePath, m_split, m_directories);
+}
+
+std::string SongLayout::getPreviousPath(const std::string& relativePath) const
+{
+	return getPath(relativePath, m_previousSplit, m_previousDirectories);
+}
+
+void SongLayout::addSong(const std::string& relativePath)
+{
+	if (m_requestedSplit == Split::None)
+		return;
+
+	// Directories that are already split don't need to be counted.
+	std::string directory = getDirectoryKey(relativePath);
+	if (m_directories.find(directory) == m_directories.end())
+		++m_songCounts[directory];
+}
+
+void SongLayout::keepPreviousPath(const std::string& previousPath)
+{
+	m_keptPaths.insert(Helpers::hashString(Helpers::foldCase(previousPath)));
+}
+
+std::string SongLayout::getPath(const std::string& relativePath, Split split,
+	const std::unordered_set<std::string>& directories)
+{
+	if (split == Split::None || directories.empty() ||
+		directories.find(getDirectoryKey(relativePath)) == directories.end())
+	{
+		return relativePath;
+	}
+
+	std::size_t nameStart = relativePath.find_last_of(Helpers::cPathSeparator);
+	nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+	std::string path = relativePath;
+	path.insert(nameStart, getSubdirectory(relativePath.substr(nameStart), split) +
+		Helpers::cPathSeparator);
+	return path;
+}
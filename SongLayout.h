@@ -0,0 +1,98 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+class FileSystem;
+
+// Layout of the songs in the song output directory, which splits directories with many songs into
+// subdirectories. FAT finds entries by scanning the whole directory, so directories with thousands
+// of songs, such as for compilations, get slow to open and to copy songs into.
+//
+// Each song in a split directory is placed in a subdirectory named after its file name, either its
+// first letter or a prefix of its hash, so the path of a song doesn't depend on the other songs.
+// Directories are split once a sync places more songs in them than the maximum. This takes effect
+// in the next sync, since playlists are written while the songs are still being found. The split
+// directories are stored in a file in the song output directory along with how they're split, and
+// when that changes the songs are moved by renaming them rather than copying them again.
+class SongLayout
+{
+public:
+	enum class Split
+	{
+		None,   // Songs are placed directly in their directories.
+		Letter, // By the first letter of the file name.
+		Hash    // By the first two hex digits of a hash of the file name.
+	};
+
+	// Name of the layout file relative to the song directory.
+	static const char* const cFileName;
+
+	SongLayout(FileSystem& songDir, Split split, std::size_t maxSongs);
+
+	// Loads the layout used by the last sync. When canMove is false the songs keep that layout,
+	// such as when some playlists are skipped that may refer to them.
+	bool load(bool canMove);
+	// Saves the layout used by this sync along with the directories that are split next time.
+	// When movesFinished is false, such as when songs failed or playlists were cancelled for
+	// space, the previous layout is saved instead so the songs that weren't moved can still be
+	// found at their previous paths.
+	bool save(bool movesFinished);
+
+	// Returns whether songs are moved to a different layout by this sync.
+	bool isMoving() const	{return m_moving;}
+	// Returns whether songs will be moved by the next sync, once saved.
+	bool willMove() const	{return m_canMove && !m_pendingDirectories.empty();}
+
+	// Gets the path of a song in the layout of this sync.
+	std::string getPath(const std::string& relativePath) const;
+	// Gets the path of a song in the layout of the last sync.
+	std::string getPreviousPath(const std::string& relativePath) const;
+
+	// Counts a song placed in its directory by this sync, given its path before it's split.
+	void addSong(const std::string& relativePath);
+
+	// Keeps a song at its previous path from being removed as an old song before it's moved.
+	void keepPreviousPath(const std::string& previousPath);
+	// Gets the hashes of the case folded previous paths that are kept.
+	const std::unordered_set<std::uint64_t>& getKeptPaths() const	{return m_keptPaths;}
+
+private:
+	static std::string getPath(const std::string& relativePath, Split split,
+		const std::unordered_set<std::string>& directories);
+
+	FileSystem& m_songDir;
+	Split m_requestedSplit;
+	std::size_t m_maxSongs;
+
+	Split m_previousSplit;
+	std::unordered_set<std::string> m_previousDirectories;
+	Split m_split;
+	// Keyed by the case folded path.
+	std::unordered_set<std::string> m_directories;
+	std::unordered_set<std::string> m_pendingDirectories;
+	std::unordered_map<std::string, std::size_t> m_songCounts;
+	std::unordered_set<std::uint64_t> m_keptPaths;
+	bool m_canMove;
+	bool m_moving;
+};
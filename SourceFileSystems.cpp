@@ -0,0 +1,52 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SourceFileSystems.h"
+
+#include "Log.h"
+#include <filesystem>
+
+SourceFileSystems::SourceFileSystems(FileSystem::Opener openFileSystem, FileSystem& relativeDir)
+	: m_openFileSystem(std::move(openFileSystem)), m_relativeDir(relativeDir)
+{
+}
+
+FileSystem* SourceFileSystems::get(std::string& relativePath, const std::string& source)
+{
+	//Assume it's reative to the playlist input if it's not absolute.
+	std::filesystem::path path = std::filesystem::u8path(source);
+	if (!path.is_absolute())
+	{
+		relativePath = source;
+		return &m_relativeDir;
+	}
+
+	// The root may be longer than a single character, such as 'C:\' or a UNC share on Windows.
+	std::string root = path.root_path().u8string();
+	relativePath = path.relative_path().generic_u8string();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto foundIter = m_roots.find(root);
+	if (foundIter != m_roots.end())
+		return foundIter->second.get();
+
+	std::unique_ptr<FileSystem>& fileSystem = m_roots[root];
+	fileSystem = m_openFileSystem(root, false);
+	if (!fileSystem)
+		Log::error("Error: Couldn't open directory '%s'.\n", root.c_str());
+	return fileSystem.get();
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "FileSystem.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// File systems that songs are read from. Songs with relative paths are relative to the playlist
+// input directory, while songs with absolute paths are read relative to their root, such as '/' or
+// a drive on Windows. A file system is opened for each root the first time it's used.
+//
+// All functions are thread-safe.
+class SourceFileSystems
+{
+public:
+	SourceFileSystems(FileSystem::Opener openFileSystem, FileSystem& relativeDir);
+
+	// Gets the file system for a song and the path of the song relative to it. Returns null if the
+	// root of the song couldn't be opened.
+	FileSystem* get(std::string& relativePath, const std::string& source);
+
+private:
+	FileSystem::Opener m_openFileSystem;
+	FileSystem& m_relativeDir;
+
+	std::mutex m_mutex;
+	// Keyed by the root path. Roots that couldn't be opened are null so they're only tried once.
+	std::unordered_map<std::string, std::unique_ptr<FileSystem>> m_roots;
+};
@@ -0,0 +1,244 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SourceIndex.h"
+
+#include "Helpers.h"
+#include <filesystem>
+#include <random>
+#include <system_error>
+
+namespace
+{
+
+std::string getSpillPath()
+{
+	std::error_code error;
+	std::filesystem::path path = std::filesystem::temp_directory_path(error);
+	path /= "MusicSync-" + std::to_string(std::random_device()()) + ".sources";
+	return path.string();
+}
+
+void writeString(std::ostream& stream, const std::string& value)
+{
+	std::uint32_t length = static_cast<std::uint32_t>(value.size());
+	stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+	stream.write(value.data(), value.size());
+}
+
+bool readString(std::istream& stream, std::string& value)
+{
+	std::uint32_t length;
+	if (!stream.read(reinterpret_cast<char*>(&length), sizeof(length)))
+		return false;
+
+	value.resize(length);
+	return length == 0 || stream.read(&value[0], length);
+}
+
+} // namespace
+
+SourceIndex::SourceIndex(SourceFileSystems& fileSystems, bool compareContents,
+	Hash::Algorithm hashAlgorithm, bool spill)
+	: m_fileSystems(fileSystems), m_compareContents(compareContents),
+	m_hashAlgorithm(hashAlgorithm)
+{
+	// Keep the records in memory if the file can't be created.
+	if (spill)
+	{
+		m_spillPath = getSpillPath();
+		m_spillFile.open(m_spillPath,
+			std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+	}
+}
+
+SourceIndex::~SourceIndex()
+{
+	if (m_spillFile.is_open())
+	{
+		m_spillFile.close();
+		std::error_code error;
+		std::filesystem::remove(m_spillPath, error);
+	}
+}
+
+bool SourceIndex::find(std::string& destination, Identity& identity, const std::string& source)
+{
+	identity = Identity();
+	if (!getIdentity(identity, source))
+		return false;
+
+	Record record;
+	auto foundIter = m_files.find(identity.id);
+	if (foundIter != m_files.end())
+	{
+		if (!readRecord(record, foundIter->second))
+			return false;
+
+		destination = std::move(record.destination);
+		return true;
+	}
+
+	if (!m_compareContents)
+		return false;
+
+	auto sizeIter = m_sizes.find(identity.size);
+	if (sizeIter == m_sizes.end())
+		return false;
+
+	// The song is hashed along with the songs of the same size that weren't hashed yet, so MD5 can
+	// hash them in parallel. Each song is still only hashed once.
+	std::vector<std::string> sources(1, source);
+	std::vector<SizeEntry*> unhashedEntries;
+	for (SizeEntry& entry : sizeIter->second)
+	{
+		if (!entry.hashed && readRecord(record, entry.record))
+		{
+			sources.push_back(std::move(record.source));
+			unhashedEntries.push_back(&entry);
+		}
+	}
+
+	std::vector<std::string> digests = hashContents(sources);
+	for (std::size_t i = 0; i < unhashedEntries.size(); ++i)
+	{
+		const std::string& digest = digests[i + 1];
+		if (!digest.empty())
+		{
+			unhashedEntries[i]->contentHash = getContentHash(digest);
+			unhashedEntries[i]->hashed = true;
+		}
+	}
+
+	if (digests[0].empty())
+		return false;
+	identity.contentHash = getContentHash(digests[0]);
+	identity.hashed = true;
+
+	for (const SizeEntry& entry : sizeIter->second)
+	{
+		if (entry.hashed && entry.contentHash == identity.contentHash &&
+			readRecord(record, entry.record))
+		{
+			destination = std::move(record.destination);
+			// Remember the file so other paths to it don't need to be hashed again.
+			m_files.emplace(identity.id, entry.record);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void SourceIndex::add(const Identity& identity, const std::string& source,
+	const std::string& destination)
+{
+	if (!identity.valid)
+		return;
+
+	std::uint64_t record = addRecord(source, destination);
+	m_files.emplace(identity.id, record);
+	if (m_compareContents)
+	{
+		m_sizes[identity.size].push_back(
+			SizeEntry{record, identity.contentHash, identity.hashed});
+	}
+}
+
+bool SourceIndex::getIdentity(Identity& identity, const std::string& source)
+{
+	std::string relativePath;
+	FileSystem* fileSystem = m_fileSystems.get(relativePath, source);
+	FileSystem::FileInfo info;
+	if (!fileSystem || !fileSystem->getFileInfo(info, relativePath))
+		return false;
+
+	identity.id.device = info.device;
+	identity.id.file = info.fileId;
+	// Fall back to the path when the file system can't identify the file, so only the same path
+	// is found.
+	if (info.device == 0 && info.fileId == 0)
+	{
+		identity.id.file = Helpers::hashString(
+			fileSystem->getRoot() + Helpers::cPathSeparator + relativePath);
+	}
+	identity.size = info.size;
+	identity.valid = true;
+	return true;
+}
+
+std::vector<std::string> SourceIndex::hashContents(const std::vector<std::string>& sources)
+{
+	std::vector<FileSystem::HashRequest> requests;
+	std::vector<std::size_t> requestSources;
+	for (std::size_t i = 0; i < sources.size(); ++i)
+	{
+		std::string relativePath;
+		FileSystem* fileSystem = m_fileSystems.get(relativePath, sources[i]);
+		if (fileSystem)
+		{
+			requests.push_back(FileSystem::HashRequest{fileSystem, std::move(relativePath),
+				nullptr, false});
+			requestSources.push_back(i);
+		}
+	}
+
+	std::vector<std::string> requestDigests = FileSystem::hashFiles(requests, m_hashAlgorithm);
+	std::vector<std::string> digests(sources.size());
+	for (std::size_t i = 0; i < requestSources.size(); ++i)
+		digests[requestSources[i]] = std::move(requestDigests[i]);
+	return digests;
+}
+
+std::uint64_t SourceIndex::getContentHash(const std::string& digest)
+{
+	// Only keep 64 bits of the digest, which is still unlikely to collide between songs that
+	// already have the same size.
+	return Helpers::hashString(digest);
+}
+
+std::uint64_t SourceIndex::addRecord(const std::string& source, const std::string& destination)
+{
+	if (!m_spillFile.is_open())
+	{
+		m_records.push_back(Record{source, destination});
+		return m_records.size() - 1;
+	}
+
+	m_spillFile.clear();
+	m_spillFile.seekp(0, std::ios::end);
+	std::uint64_t offset = static_cast<std::uint64_t>(m_spillFile.tellp());
+	writeString(m_spillFile, source);
+	writeString(m_spillFile, destination);
+	return offset;
+}
+
+bool SourceIndex::readRecord(Record& record, std::uint64_t id)
+{
+	if (!m_spillFile.is_open())
+	{
+		if (id >= m_records.size())
+			return false;
+
+		record = m_records[id];
+		return true;
+	}
+
+	m_spillFile.clear();
+	m_spillFile.seekg(static_cast<std::streamoff>(id));
+	return readString(m_spillFile, record.source) && readString(m_spillFile, record.destination);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "Hash.h"
+#include "SourceFileSystems.h"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Finds songs that were already added under a different source path so they're only copied once.
+//
+// Songs are identified by the device and file ID from the file system they're read from, so paths
+// through symlinks, hard links and '..' components all refer to the same song. When comparing
+// contents, songs with the same size are also compared by a hash of their contents. The hash is
+// only computed once a second song with the same size is found, so most songs are never read.
+//
+// Each song keeps a fixed size entry in memory with its file ID, size and a 64-bit hash of its
+// contents. The source and destination paths are stored separately as a record, which is only
+// read back when a song is found again. When spilling, such as with a memory limit, records are
+// written to a file in the temporary directory rather than kept in memory.
+class SourceIndex
+{
+public:
+	struct FileId
+	{
+		std::uint64_t device = 0;
+		std::uint64_t file = 0;
+	};
+
+	struct Identity
+	{
+		FileId id;
+		std::uint64_t size = 0;
+		// Only set when the contents needed to be compared.
+		std::uint64_t contentHash = 0;
+		bool hashed = false;
+		bool valid = false;
+	};
+
+	SourceIndex(SourceFileSystems& fileSystems, bool compareContents,
+		Hash::Algorithm hashAlgorithm, bool spill);
+	~SourceIndex();
+
+	SourceIndex(const SourceIndex&) = delete;
+	SourceIndex& operator=(const SourceIndex&) = delete;
+
+	// Returns true and sets destination if an identical song was already added. Otherwise identity
+	// is set to pass to add().
+	bool find(std::string& destination, Identity& identity, const std::string& source);
+	void add(const Identity& identity, const std::string& source, const std::string& destination);
+
+private:
+	struct FileIdHash
+	{
+		std::size_t operator()(const FileId& id) const
+		{
+			return static_cast<std::size_t>(id.device*31 + id.file);
+		}
+	};
+
+	struct FileIdEqual
+	{
+		bool operator()(const FileId& left, const FileId& right) const
+		{
+			return left.device == right.device && left.file == right.file;
+		}
+	};
+
+	struct SizeEntry
+	{
+		std::uint64_t record;
+		std::uint64_t contentHash;
+		bool hashed;
+	};
+
+	struct Record
+	{
+		std::string source;
+		std::string destination;
+	};
+
+	bool getIdentity(Identity& identity, const std::string& source);
+	// Returns the digest of each source, which is empty if it couldn't be read.
+	std::vector<std::string> hashContents(const std::vector<std::string>& sources);
+	static std::uint64_t getContentHash(const std::string& digest);
+
+	std::uint64_t addRecord(const std::string& source, const std::string& destination);
+	bool readRecord(Record& record, std::uint64_t id);
+
+	SourceFileSystems& m_fileSystems;
+	bool m_compareContents;
+	Hash::Algorithm m_hashAlgorithm;
+	std::unordered_map<FileId, std::uint64_t, FileIdHash, FileIdEqual> m_files;
+	std::unordered_map<std::uint64_t, std::vector<SizeEntry>> m_sizes;
+
+	// Records are indices into m_records, or offsets into the spill file when it's open.
+	std::vector<Record> m_records;
+	std::string m_spillPath;
+	std::fstream m_spillFile;
+};
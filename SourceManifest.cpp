@@ -0,0 +1,146 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SourceManifest.h"
+
+#include "Helpers.h"
+#include <cstdlib>
+#include <sstream>
+
+const char* const SourceManifest::cFileName = ".MusicSyncSources";
+
+namespace
+{
+
+// Increment when the layout changes so old manifests are ignored.
+const char* const cHeader = "#MusicSync sources 1";
+const unsigned int cNumberCount = 4;
+
+} // namespace
+
+SourceManifest::SourceManifest(FileSystem& songDir)
+	: m_songDir(songDir), m_changed(false)
+{
+}
+
+bool SourceManifest::load()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+	m_changed = false;
+
+	FileSystem::FileInfo info;
+	if (!m_songDir.getFileInfo(info, cFileName))
+		return true;
+
+	std::string contents;
+	if (!m_songDir.readFile(contents, cFileName))
+		return false;
+
+	std::istringstream stream(contents);
+	std::string line;
+	if (!Helpers::readLine(line, stream) || line != cHeader)
+		return true;
+
+	// Each line is the source size and modified time, then the destination size and modified
+	// time, followed by the path, separated by tabs.
+	while (Helpers::readLine(line, stream))
+	{
+		std::int64_t numbers[cNumberCount];
+		std::size_t start = 0;
+		unsigned int i = 0;
+		for (; i < cNumberCount; ++i)
+		{
+			std::size_t end = line.find('\t', start);
+			if (end == std::string::npos)
+				break;
+
+			numbers[i] = std::strtoll(line.c_str() + start, nullptr, 10);
+			start = end + 1;
+		}
+
+		if (i == cNumberCount)
+		{
+			Entry& entry = m_entries[line.substr(start)];
+			entry.source = FileSystem::FileInfo{static_cast<std::uint64_t>(numbers[0]),
+				numbers[1]};
+			entry.destination = FileSystem::FileInfo{static_cast<std::uint64_t>(numbers[2]),
+				numbers[3]};
+		}
+
+		if (stream.eof())
+			break;
+	}
+
+	return true;
+}
+
+bool SourceManifest::save()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_changed)
+		return true;
+
+	std::ostringstream stream;
+	stream << cHeader << '\n';
+	for (const auto& pathEntry : m_entries)
+	{
+		const Entry& entry = pathEntry.second;
+		stream << entry.source.size << '\t' << entry.source.modifiedTime << '\t' <<
+			entry.destination.size << '\t' << entry.destination.modifiedTime << '\t' <<
+			pathEntry.first << '\n';
+	}
+
+	// Replace the file in one step so an interrupted save keeps the previous manifest.
+	if (!m_songDir.replaceFile(cFileName, stream.str()))
+		return false;
+
+	m_changed = false;
+	return true;
+}
+
+bool SourceManifest::isUpToDate(const std::string& relativePath,
+	const FileSystem::FileInfo& srcInfo, const FileSystem::FileInfo& dstInfo) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto foundIter = m_entries.find(relativePath);
+	if (foundIter == m_entries.end())
+		return false;
+
+	const Entry& entry = foundIter->second;
+	return entry.source.size == srcInfo.size &&
+		entry.source.modifiedTime == srcInfo.modifiedTime &&
+		entry.destination.size == dstInfo.size &&
+		entry.destination.modifiedTime == dstInfo.modifiedTime;
+}
+
+bool SourceManifest::find(Entry& entry, const std::string& relativePath) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto foundIter = m_entries.find(relativePath);
+	if (foundIter == m_entries.end())
+		return false;
+
+	entry = foundIter->second;
+	return true;
+}
+
+void SourceManifest::set(const std::string& relativePath, const Entry& entry)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries[relativePath] = entry;
+	m_changed = true;
+}
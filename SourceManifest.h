@@ -0,0 +1,64 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "FileSystem.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Fingerprints of the sources of songs that were changed while copying, stored in a file in the
+// song output directory. Such songs can't be compared with their source directly, so this allows
+// them to be found up to date without transforming the source again.
+//
+// Each entry records the size and modified time of both the source and the song on the device, so
+// the entry no longer applies once either is changed. Entries are kept until they're replaced,
+// since songs that aren't part of a sync may still be on the device.
+//
+// All functions are thread-safe.
+class SourceManifest
+{
+public:
+	struct Entry
+	{
+		FileSystem::FileInfo source;
+		FileSystem::FileInfo destination;
+	};
+
+	// Name of the manifest file relative to the song directory.
+	static const char* const cFileName;
+
+	explicit SourceManifest(FileSystem& songDir);
+
+	// Returns true if the manifest doesn't exist yet.
+	bool load();
+	// Only writes the manifest if it was changed.
+	bool save();
+
+	// Returns whether the destination was copied from a source with the same fingerprint.
+	bool isUpToDate(const std::string& relativePath, const FileSystem::FileInfo& srcInfo,
+		const FileSystem::FileInfo& dstInfo) const;
+	bool find(Entry& entry, const std::string& relativePath) const;
+	void set(const std::string& relativePath, const Entry& entry);
+
+private:
+	FileSystem& m_songDir;
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, Entry> m_entries;
+	bool m_changed;
+};
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SpacePlan.h"
+
+#include <algorithm>
+#include <cassert>
+
+SpacePlan::SpacePlan(std::uint64_t blockSize)
+	: m_blockSize(std::max<std::uint64_t>(blockSize, 1))
+{
+}
+
+void SpacePlan::beginPlaylist()
+{
+	m_playlistBytes.push_back(m_playlistBytes.empty() ? 0 : m_playlistBytes.back());
+}
+
+void SpacePlan::addSong(std::uint64_t size, std::uint64_t replacedSize)
+{
+	assert(!m_playlistBytes.empty());
+	std::uint64_t bytes = getBlockBytes(size);
+	std::uint64_t replacedBytes = getBlockBytes(replacedSize);
+	if (bytes > replacedBytes)
+		m_playlistBytes.back() += bytes - replacedBytes;
+}
+
+std::uint64_t SpacePlan::getBlockBytes(std::uint64_t size) const
+{
+	return (size + m_blockSize - 1)/m_blockSize*m_blockSize;
+}
+
+std::uint64_t SpacePlan::getRequiredBytes(std::size_t count) const
+{
+	assert(count <= m_playlistBytes.size());
+	return cReservedBytes + (count == 0 ? 0 : m_playlistBytes[count - 1]);
+}
+
+std::size_t SpacePlan::getFittingPlaylistCount(std::uint64_t availableBytes) const
+{
+	if (availableBytes < cReservedBytes)
+		return 0;
+
+	// The space required only grows with each playlist.
+	return std::upper_bound(m_playlistBytes.begin(), m_playlistBytes.end(),
+		availableBytes - cReservedBytes) - m_playlistBytes.begin();
+}
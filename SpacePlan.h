@@ -0,0 +1,61 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Space needed on the device to copy the songs of each playlist, so a sync that doesn't fit is
+// found before copying rather than when the device fills up part way through.
+//
+// Playlists are added in the order they're synchronized, which is also their priority. Songs are
+// only counted for the first playlist that adds them, rounded up to whole blocks of the
+// destination file system. Songs that replace a file on the device only need the space they add
+// to it, since the old file is removed once the new one is copied.
+class SpacePlan
+{
+public:
+	// Space left free for playlists, records and new directories, which aren't counted.
+	static const std::uint64_t cReservedBytes = 16*1024*1024;
+
+	explicit SpacePlan(std::uint64_t blockSize);
+
+	void beginPlaylist();
+	// Adds a song to the current playlist. replacedSize is the size of the file the song replaces
+	// on the device, or 0 if there isn't one.
+	void addSong(std::uint64_t size, std::uint64_t replacedSize);
+
+	std::size_t getPlaylistCount() const	{return m_playlistBytes.size();}
+
+	// Rounds a file size up to the space it takes in whole blocks.
+	std::uint64_t getBlockBytes(std::uint64_t size) const;
+
+	// Gets the space required to copy the songs of the first count playlists, including the
+	// reserved space.
+	std::uint64_t getRequiredBytes(std::size_t count) const;
+	std::uint64_t getRequiredBytes() const	{return getRequiredBytes(m_playlistBytes.size());}
+
+	// Returns the number of playlists from the start whose songs fit in the available space.
+	std::size_t getFittingPlaylistCount(std::uint64_t availableBytes) const;
+
+private:
+	std::uint64_t m_blockSize;
+	// Space required by the end of each playlist, not including the reserved space.
+	std::vector<std::uint64_t> m_playlistBytes;
+};
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SyncSession.h"
+
+#include "DirectoryCache.h"
+#include "Logic.h"
+#include "SessionState.h"
+
+SyncSession::SyncSession(FileSystem::Opener openFileSystem)
+	: m_state(new SessionState(openFileSystem ? std::move(openFileSystem) :
+		DirectoryCache::getOpener()))
+{
+}
+
+SyncSession::~SyncSession() = default;
+
+void SyncSession::setProgressFunction(ProgressFunction progress)
+{
+	m_state->setProgressFunction(std::move(progress));
+}
+
+bool SyncSession::sync(const Options& options)
+{
+	m_state->startSync(options);
+	bool success = Logic::syncMusic(options, *m_state);
+	if (!m_state->isCancelled())
+		m_state->finishSync();
+	return success;
+}
+
+void SyncSession::cancel()
+{
+	m_state->cancel();
+}
+
+void SyncSession::clearCache()
+{
+	m_state->clearCache();
+}
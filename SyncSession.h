@@ -0,0 +1,79 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "FileSystem.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+struct Options;
+class SessionState;
+
+// Synchronizes music with state that is kept between syncs. This is the entry point for
+// applications that link against the library.
+//
+// Parsed playlists, the destination paths for songs, and the songs known to be on the device are
+// cached so later syncs only need to read what changed. The cache assumes nothing else modifies
+// the device between syncs, so call clearCache() if it may have been. (e.g. it was unplugged)
+// Caching is disabled when a memory limit is set, since it grows with the size of the library.
+//
+// Only one sync may run at a time. cancel() may be called from any thread, including signal
+// handlers.
+class SyncSession
+{
+public:
+	struct Progress
+	{
+		std::size_t playlistsRead = 0;
+		// The number of songs found keeps growing until all playlists have been read.
+		bool playlistsDone = false;
+		std::size_t songsFound = 0;
+		// Songs that were checked, whether or not they needed to be copied.
+		std::size_t songsSynced = 0;
+		std::size_t songsCopied = 0;
+		std::size_t songsFailed = 0;
+		std::uint64_t bytesCopied = 0;
+		std::size_t songsRemoved = 0;
+	};
+
+	// Called each time the progress changes from the thread that changed it. Calls are never
+	// concurrent, but should return quickly since they block the sync.
+	using ProgressFunction = std::function<void(const Progress& progress)>;
+
+	// Uses the real file system when no opener is provided.
+	explicit SyncSession(FileSystem::Opener openFileSystem = FileSystem::Opener());
+	~SyncSession();
+
+	SyncSession(const SyncSession&) = delete;
+	SyncSession& operator=(const SyncSession&) = delete;
+
+	void setProgressFunction(ProgressFunction progress);
+
+	// Returns false if there were errors or the sync was cancelled.
+	bool sync(const Options& options);
+
+	// Stops the current sync as soon as possible. Songs being copied are removed, playlists are
+	// only written if all their songs were copied, and nothing is removed from the device.
+	void cancel();
+
+	void clearCache();
+
+private:
+	std::unique_ptr<SessionState> m_state;
+};
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SyncStamp.h"
+
+#include "Hash.h"
+#include "Helpers.h"
+#include <sstream>
+
+const char* const SyncStamp::cFileName = ".MusicSyncState";
+
+namespace
+{
+
+// Increment when the fingerprint changes so old stamps never match.
+const char* const cHeader = "#MusicSync state 1";
+
+} // namespace
+
+void SyncStamp::add(const std::string& value)
+{
+	// The length keeps consecutive values from running together.
+	add(static_cast<std::uint64_t>(value.size()));
+	m_data += value;
+}
+
+void SyncStamp::add(std::uint64_t value)
+{
+	m_data += std::to_string(value);
+	m_data.push_back(';');
+}
+
+void SyncStamp::add(const FileSystem::FileInfo& info)
+{
+	add(info.size);
+	add(static_cast<std::uint64_t>(info.modifiedTime));
+}
+
+std::string SyncStamp::get() const
+{
+	return Hash::hashString(m_data, Hash::Algorithm::Md5);
+}
+
+bool SyncStamp::load(std::string& stamp, FileSystem& songDir)
+{
+	FileSystem::FileInfo info;
+	std::string contents;
+	if (!songDir.getFileInfo(info, cFileName) || !songDir.readFile(contents, cFileName))
+		return false;
+
+	std::istringstream stream(contents);
+	std::string line;
+	return Helpers::readLine(line, stream) && line == cHeader &&
+		Helpers::readLine(stamp, stream) && !stamp.empty();
+}
+
+bool SyncStamp::save(FileSystem& songDir, const std::string& stamp)
+{
+	return songDir.replaceFile(cFileName, std::string(cHeader) + '\n' + stamp + '\n');
+}
+
+bool SyncStamp::remove(FileSystem& songDir)
+{
+	FileSystem::FileInfo info;
+	return !songDir.getFileInfo(info, cFileName) || songDir.removeFile(cFileName);
+}
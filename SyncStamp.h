@@ -0,0 +1,53 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "FileSystem.h"
+#include <cstdint>
+#include <string>
+
+// Fingerprint of what a sync depends on, stored in the song output directory after a sync that
+// finished without errors. When the fingerprint still matches, a later sync can tell there's
+// nothing to do with a handful of file system operations rather than reading every playlist and
+// checking every song.
+//
+// Only what's cheap to check is included, such as the options and the size and modified time of
+// the playlists on both sides. Songs that change without their playlists changing aren't noticed,
+// so the stamp is only checked when requested.
+class SyncStamp
+{
+public:
+	// Name of the stamp file relative to the song directory.
+	static const char* const cFileName;
+
+	void add(const std::string& value);
+	void add(std::uint64_t value);
+	void add(const FileSystem::FileInfo& info);
+
+	// Gets the fingerprint of everything added so far.
+	std::string get() const;
+
+	// Returns false if there's no stored stamp.
+	static bool load(std::string& stamp, FileSystem& songDir);
+	static bool save(FileSystem& songDir, const std::string& stamp);
+	// Removes the stored stamp if there is one.
+	static bool remove(FileSystem& songDir);
+
+private:
+	std::string m_data;
+};
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares copying songs with the previous write path (1 MB writes, no preallocation) against
+// preallocating and writing in large aligned chunks. The time includes flushing the destination
+// file system so it measures what reached the device.
+//
+// To test on FAT and exFAT, create and mount loopback images first, for example:
+//   truncate -s 4G fat.img && mkfs.vfat -F 32 fat.img && sudo mount -o loop,uid=$UID fat.img /mnt/fat
+//   truncate -s 4G exfat.img && mkfs.exfat exfat.img && sudo mount -o loop,uid=$UID exfat.img /mnt/exfat
+//
+// Usage: CopyBenchmark <source dir> <destination dir> [runs]
+
+#include "DirectoryCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+
+struct Configuration
+{
+	const char* name;
+	bool preallocate;
+	std::size_t writeSize;
+};
+
+bool copyAll(const std::vector<std::string>& files, const std::string& srcDir,
+	const std::string& dstDir, const Configuration& configuration, double& seconds)
+{
+	DirectoryCache src(srcDir);
+	DirectoryCache dst(dstDir);
+	DirectoryCache::CopyOptions options;
+	options.preallocate = configuration.preallocate;
+	options.writeSize = configuration.writeSize;
+
+	auto start = std::chrono::steady_clock::now();
+	for (const std::string& file : files)
+	{
+		if (!dst.createParentDirectories(file) ||
+			!DirectoryCache::copyFile(src, file, dst, file, options))
+		{
+			std::fprintf(stderr, "Error: Couldn't copy '%s'.\n", file.c_str());
+			return false;
+		}
+	}
+	bool synced = dst.syncFileSystem();
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return synced;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::fprintf(stderr, "Usage: %s <source dir> <destination dir> [runs]\n", argv[0]);
+		return 1;
+	}
+
+	std::string srcDir = argv[1];
+	std::filesystem::path dstRoot = argv[2];
+	unsigned int runs = argc > 3 ? std::atoi(argv[3]) : 3;
+
+	std::vector<std::string> files;
+	double totalMegabytes = 0;
+	for (std::filesystem::recursive_directory_iterator iter(srcDir);
+		iter != std::filesystem::recursive_directory_iterator(); ++iter)
+	{
+		if (!iter->is_regular_file())
+			continue;
+
+		files.push_back(std::filesystem::relative(iter->path(), srcDir).generic_string());
+		totalMegabytes += iter->file_size()/(1024.0*1024.0);
+	}
+
+	std::printf("Copying %zu files, %.1f MB total, %u runs each.\n\n", files.size(),
+		totalMegabytes, runs);
+
+	const Configuration cConfigurations[] =
+	{
+		{"1 MB writes", false, 1024*1024},
+		{"1 MB writes, preallocated", true, 1024*1024},
+		{"4 MB writes, preallocated", true, DirectoryCache::cDefaultWriteSize},
+		{"16 MB writes, preallocated", true, 16*1024*1024}
+	};
+
+	for (const Configuration& configuration : cConfigurations)
+	{
+		double bestSeconds = 0;
+		for (unsigned int i = 0; i < runs; ++i)
+		{
+			std::filesystem::path dstDir = dstRoot/"CopyBenchmark";
+			std::error_code error;
+			std::filesystem::remove_all(dstDir, error);
+			std::filesystem::create_directories(dstDir, error);
+
+			double seconds;
+			if (!copyAll(files, srcDir, dstDir.string(), configuration, seconds))
+				return 1;
+			if (i == 0 || seconds < bestSeconds)
+				bestSeconds = seconds;
+
+			std::filesystem::remove_all(dstDir, error);
+		}
+
+		std::printf("%-28s %8.3f s %10.1f MB/s\n", configuration.name, bestSeconds,
+			totalMegabytes/bestSeconds);
+	}
+
+	return 0;
+}
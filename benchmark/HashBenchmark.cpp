@@ -0,0 +1,147 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the throughput of the hash implementations on a set of temporary files. Files are
+// read once before timing so they're in the page cache and the hashing dominates.
+//
+// Usage: HashBenchmark [file count] [file size in MB]
+
+#include "Hash.h"
+#include "md5.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+std::vector<std::string> createFiles(const std::filesystem::path& directory, unsigned int count,
+	std::size_t size)
+{
+	std::filesystem::create_directories(directory);
+	std::mt19937_64 random(0);
+	std::vector<std::string> paths;
+	std::vector<std::uint64_t> data((size + 7)/8);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		for (std::uint64_t& value : data)
+			value = random();
+
+		// Vary the sizes slightly so the lanes don't all finish at the same time.
+		std::size_t fileSize = size - i*61;
+		std::filesystem::path path = directory/("file" + std::to_string(i));
+		std::ofstream stream(path, std::ios::binary);
+		stream.write(reinterpret_cast<const char*>(data.data()), fileSize);
+		paths.push_back(path.string());
+	}
+	return paths;
+}
+
+std::string legacyMd5(const std::string& path)
+{
+	std::ifstream stream(path, std::ios::binary);
+	std::vector<char> buffer(256*1024);
+	MD5 md5;
+	while (stream)
+	{
+		stream.read(buffer.data(), buffer.size());
+		md5.update(buffer.data(), static_cast<MD5::size_type>(stream.gcount()));
+	}
+	return md5.finalize().hexdigest();
+}
+
+double run(const char* name, double totalMegabytes,
+	const std::function<std::vector<std::string>()>& function, std::vector<std::string>& digests)
+{
+	auto start = std::chrono::steady_clock::now();
+	digests = function();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double throughput = totalMegabytes/seconds;
+	std::printf("%-24s %8.3f s %10.1f MB/s\n", name, seconds, throughput);
+	return throughput;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	unsigned int fileCount = argc > 1 ? std::atoi(argv[1]) : 16;
+	std::size_t megabytes = argc > 2 ? std::atoi(argv[2]) : 16;
+	if (fileCount == 0 || megabytes == 0)
+	{
+		std::fprintf(stderr, "Usage: %s [file count] [file size in MB]\n", argv[0]);
+		return 1;
+	}
+
+	std::filesystem::path directory = std::filesystem::temp_directory_path()/"HashBenchmark";
+	std::vector<std::string> paths = createFiles(directory, fileCount, megabytes*1024*1024);
+	double totalMegabytes = 0;
+	for (const std::string& path : paths)
+		totalMegabytes += std::filesystem::file_size(path)/(1024.0*1024.0);
+
+	std::printf("Hashing %u files, %.1f MB total. MD5 implementation for multiple files: %s\n\n",
+		fileCount, totalMegabytes, Hash::getMd5Implementation());
+
+	std::vector<std::string> legacy, scalar, multiBuffer, xxh64;
+	// Warm up the page cache.
+	Hash::hashFiles(paths, Hash::Algorithm::XXH64);
+	double legacyThroughput = run("MD5 class (md5.cpp)", totalMegabytes, [&paths]()
+		{
+			std::vector<std::string> digests;
+			for (const std::string& path : paths)
+				digests.push_back(legacyMd5(path));
+			return digests;
+		}, legacy);
+	double scalarThroughput = run("MD5 streaming", totalMegabytes, [&paths]()
+		{
+			std::vector<std::string> digests(paths.size());
+			for (std::size_t i = 0; i < paths.size(); ++i)
+				Hash::hashFile(digests[i], paths[i], Hash::Algorithm::Md5);
+			return digests;
+		}, scalar);
+	double multiBufferThroughput = run("MD5 multiple files", totalMegabytes, [&paths]()
+		{
+			return Hash::hashFiles(paths, Hash::Algorithm::Md5);
+		}, multiBuffer);
+	double xxh64Throughput = run("XXH64 streaming", totalMegabytes, [&paths]()
+		{
+			std::vector<std::string> digests(paths.size());
+			for (std::size_t i = 0; i < paths.size(); ++i)
+				Hash::hashFile(digests[i], paths[i], Hash::Algorithm::XXH64);
+			return digests;
+		}, xxh64);
+
+	std::printf("\nSpeedup over the MD5 class: streaming %.2fx, multiple files %.2fx, XXH64 "
+		"%.2fx\n", scalarThroughput/legacyThroughput, multiBufferThroughput/legacyThroughput,
+		xxh64Throughput/legacyThroughput);
+
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+
+	if (scalar != legacy || multiBuffer != legacy)
+	{
+		std::fprintf(stderr, "Error: MD5 digests don't match.\n");
+		return 1;
+	}
+	return 0;
+}
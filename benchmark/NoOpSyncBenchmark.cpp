@@ -0,0 +1,205 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Measures a sync that has nothing to do, which is the common case when a sync runs every time a
+// device is plugged in. A library of songs in memory is copied once, then synchronized again in a
+// new session each time like a new process would: once checking every song, then with
+// Options::skipUnchanged so the stamp on the device is checked instead. The operations on the
+// library and the device are counted, and the checks that skip the sync are also timed on a
+// simulated USB 2.0 flash drive.
+//
+// The sync prints its progress to stdout, so redirect it to only see the results on stderr.
+//
+// Usage: NoOpSyncBenchmark [song count] [runs]
+
+#include "MemoryFileSystem.h"
+#include "Options.h"
+#include "SimulatedFileSystem.h"
+#include "SyncSession.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const char* const cLibraryDir = "/library";
+const char* const cDeviceDir = "/device";
+const unsigned int cSongsPerAlbum = 10;
+const unsigned int cPlaylistCount = 8;
+const std::size_t cSongSize = 1024;
+
+void createLibrary(MemoryFileSystem::Device& library, unsigned int songCount)
+{
+	const std::int64_t cModifiedTime = 1640995200LL*1000000000LL;
+	std::string playlists[cPlaylistCount];
+	for (std::string& playlist : playlists)
+		playlist = "#EXTM3U\n";
+
+	for (unsigned int i = 0; i < songCount; ++i)
+	{
+		std::string path = std::string(cLibraryDir) + "/music/Artist " +
+			std::to_string(i/(cSongsPerAlbum*4)) + "/Album " + std::to_string(i/cSongsPerAlbum) +
+			"/Track " + std::to_string(i % cSongsPerAlbum) + ".mp3";
+		library.addFile(path, std::string(cSongSize, char(i)), cModifiedTime);
+
+		std::string entry = "#EXTINF:180,Artist - Track " + std::to_string(i) + "\n" + path +
+			"\n";
+		playlists[i % cPlaylistCount] += entry;
+	}
+
+	for (unsigned int i = 0; i < cPlaylistCount; ++i)
+	{
+		library.addFile(std::string(cLibraryDir) + "/playlists/Playlist " + std::to_string(i) +
+			".m3u", std::move(playlists[i]), cModifiedTime);
+	}
+}
+
+// Opens the library and the device through simulated devices to count their operations.
+FileSystem::Opener getOpener(const FileSystem::Opener& openLibrary,
+	const std::shared_ptr<SimulatedFileSystem::Device>& library,
+	const FileSystem::Opener& openDevice,
+	const std::shared_ptr<SimulatedFileSystem::Device>& device)
+{
+	FileSystem::Opener simulatedLibrary = SimulatedFileSystem::wrapOpener(openLibrary, library);
+	FileSystem::Opener simulatedDevice = SimulatedFileSystem::wrapOpener(openDevice, device);
+	return [simulatedLibrary, simulatedDevice](const std::string& root, bool create)
+		{
+			if (root.compare(0, std::strlen(cDeviceDir), cDeviceDir) == 0)
+				return simulatedDevice(root, create);
+			return simulatedLibrary(root, create);
+		};
+}
+
+bool runSync(double& seconds, std::uint64_t& libraryOperations, std::uint64_t& deviceOperations,
+	const FileSystem::Opener& openFileSystem, SimulatedFileSystem::Device& library,
+	SimulatedFileSystem::Device& device, const Options& options)
+{
+	std::uint64_t startLibraryOperations = library.getStatistics().operations;
+	std::uint64_t startDeviceOperations = device.getStatistics().operations;
+	auto start = std::chrono::steady_clock::now();
+	SyncSession session(openFileSystem);
+	bool success = session.sync(options);
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	libraryOperations = library.getStatistics().operations - startLibraryOperations;
+	deviceOperations = device.getStatistics().operations - startDeviceOperations;
+	return success;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	unsigned int songCount = argc > 1 ? std::atoi(argv[1]) : 50000;
+	unsigned int runCount = argc > 2 ? std::atoi(argv[2]) : 10;
+	if (songCount == 0 || runCount == 0)
+	{
+		std::fprintf(stderr, "Usage: %s [song count] [runs]\n", argv[0]);
+		return 1;
+	}
+
+	auto libraryContents = std::make_shared<MemoryFileSystem::Device>();
+	createLibrary(*libraryContents, songCount);
+	FileSystem::Opener openLibrary = MemoryFileSystem::getOpener(libraryContents);
+	FileSystem::Opener openDevice =
+		MemoryFileSystem::getOpener(std::make_shared<MemoryFileSystem::Device>());
+
+	Options options;
+	options.playlistInput = std::string(cLibraryDir) + "/playlists";
+	options.playlistOutput = std::string(cDeviceDir) + "/Playlists";
+	options.songOutput = std::string(cDeviceDir) + "/Music";
+	options.pathTrims.push_back(std::string(cLibraryDir) + "/music");
+	options.compareMode = Options::CompareMode::Fingerprint;
+	options.removeSongs = true;
+
+	// Only the operations are counted when checking every song, since that would take minutes on
+	// a simulated flash drive.
+	auto library = std::make_shared<SimulatedFileSystem::Device>(
+		SimulatedFileSystem::Settings());
+	auto counter = std::make_shared<SimulatedFileSystem::Device>(
+		SimulatedFileSystem::Settings());
+	auto usbDevice = std::make_shared<SimulatedFileSystem::Device>(
+		SimulatedFileSystem::getUsb2Settings());
+	FileSystem::Opener openCounted = getOpener(openLibrary, library, openDevice, counter);
+	FileSystem::Opener openUsb = getOpener(openLibrary, library, openDevice, usbDevice);
+
+	std::fprintf(stderr, "Synchronizing %u songs with nothing to do.\n", songCount);
+	double seconds;
+	std::uint64_t libraryOperations, deviceOperations;
+	if (!runSync(seconds, libraryOperations, deviceOperations, openCounted, *library, *counter,
+			options) ||
+		!runSync(seconds, libraryOperations, deviceOperations, openCounted, *library, *counter,
+			options))
+	{
+		std::fprintf(stderr, "Error: Couldn't synchronize.\n");
+		return 1;
+	}
+
+	std::fprintf(stderr, "%-20s %8.3f ms (%llu library operations, %llu device operations)\n",
+		"check every song:", seconds*1000.0, static_cast<unsigned long long>(libraryOperations),
+		static_cast<unsigned long long>(deviceOperations));
+
+	// The first sync with the option checks every song and writes the stamp.
+	options.skipUnchanged = true;
+	if (!runSync(seconds, libraryOperations, deviceOperations, openCounted, *library, *counter,
+			options))
+	{
+		std::fprintf(stderr, "Error: Couldn't synchronize.\n");
+		return 1;
+	}
+
+	struct Target
+	{
+		const char* name;
+		const FileSystem::Opener* openFileSystem;
+		SimulatedFileSystem::Device* device;
+	};
+	const Target targets[] =
+	{
+		{"skip unchanged:", &openCounted, counter.get()},
+		{"skip unchanged, USB:", &openUsb, usbDevice.get()}
+	};
+	for (const Target& target : targets)
+	{
+		std::vector<double> times;
+		for (unsigned int i = 0; i < runCount; ++i)
+		{
+			if (!runSync(seconds, libraryOperations, deviceOperations, *target.openFileSystem,
+					*library, *target.device, options))
+			{
+				std::fprintf(stderr, "Error: Couldn't synchronize.\n");
+				return 1;
+			}
+			times.push_back(seconds);
+		}
+
+		std::sort(times.begin(), times.end());
+		std::fprintf(stderr, "%-20s %8.3f ms median, %8.3f ms min (%llu library operations, "
+			"%llu device operations)\n", target.name, times[times.size()/2]*1000.0,
+			times.front()*1000.0, static_cast<unsigned long long>(libraryOperations),
+			static_cast<unsigned long long>(deviceOperations));
+	}
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Runs the full sync from a library in memory to a simulated USB 2.0 flash drive with different
+// read and write limits. Since the device is simulated, the results only depend on how the
+// operations are scheduled and are the same on any machine. Each configuration is synchronized
+// to an empty device, then again to measure checking songs that are already up to date: once with
+// a new session, and once with the session that copied the songs and still has its caches.
+//
+// The sync prints its progress to stdout, so redirect it to only see the results on stderr.
+//
+// Usage: SimulatedSyncBenchmark [song count] [song size in KB]
+
+#include "MemoryFileSystem.h"
+#include "Options.h"
+#include "SimulatedFileSystem.h"
+#include "SyncSession.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace
+{
+
+const char* const cLibraryDir = "/library";
+const char* const cDeviceDir = "/device";
+const unsigned int cSongsPerAlbum = 10;
+const unsigned int cPlaylistCount = 8;
+
+struct Configuration
+{
+	const char* name;
+	unsigned int readLimit;
+	unsigned int writeLimit;
+};
+
+void createLibrary(MemoryFileSystem::Device& library, unsigned int songCount,
+	std::size_t songSize)
+{
+	const std::int64_t cModifiedTime = 1640995200LL*1000000000LL;
+	std::string playlists[cPlaylistCount];
+	for (std::string& playlist : playlists)
+		playlist = "#EXTM3U\n";
+
+	for (unsigned int i = 0; i < songCount; ++i)
+	{
+		std::string path = std::string(cLibraryDir) + "/music/Artist " +
+			std::to_string(i/(cSongsPerAlbum*4)) + "/Album " + std::to_string(i/cSongsPerAlbum) +
+			"/Track " + std::to_string(i % cSongsPerAlbum) + ".mp3";
+		library.addFile(path, std::string(songSize, char(i)), cModifiedTime);
+
+		// Each song is in two playlists so some playlists share songs.
+		std::string entry = "#EXTINF:180,Artist - Track " + std::to_string(i) + "\n" + path +
+			"\n";
+		playlists[i % cPlaylistCount] += entry;
+		playlists[(i/cSongsPerAlbum) % cPlaylistCount] += entry;
+	}
+
+	for (unsigned int i = 0; i < cPlaylistCount; ++i)
+	{
+		library.addFile(std::string(cLibraryDir) + "/playlists/Playlist " + std::to_string(i) +
+			".m3u", std::move(playlists[i]), cModifiedTime);
+	}
+}
+
+bool runSync(double& seconds, SyncSession& session, const Options& options)
+{
+	auto start = std::chrono::steady_clock::now();
+	bool success = session.sync(options);
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return success;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	unsigned int songCount = argc > 1 ? std::atoi(argv[1]) : 200;
+	std::size_t songSize = (argc > 2 ? std::atoi(argv[2]) : 256)*1024;
+	if (songCount == 0 || songSize == 0)
+	{
+		std::fprintf(stderr, "Usage: %s [song count] [song size in KB]\n", argv[0]);
+		return 1;
+	}
+
+	auto library = std::make_shared<MemoryFileSystem::Device>();
+	createLibrary(*library, songCount, songSize);
+	FileSystem::Opener openLibrary = MemoryFileSystem::getOpener(library);
+
+	Options options;
+	options.playlistInput = std::string(cLibraryDir) + "/playlists";
+	options.playlistOutput = std::string(cDeviceDir) + "/Playlists";
+	options.songOutput = std::string(cDeviceDir) + "/Music";
+	options.pathTrims.push_back(std::string(cLibraryDir) + "/music");
+	options.compareMode = Options::CompareMode::Fingerprint;
+
+	const Configuration configurations[] =
+	{
+		{"1 read, 1 write", 1, 1},
+		{"2 reads, 2 writes", 2, 2},
+		{"4 reads, 4 writes", 4, 4},
+		{"auto", Options::cAutoLimit, Options::cAutoLimit}
+	};
+
+	SimulatedFileSystem::Settings settings = SimulatedFileSystem::getUsb2Settings();
+	std::fprintf(stderr, "Synchronizing %u songs of %u KB to a simulated USB 2.0 drive.\n",
+		songCount, static_cast<unsigned int>(songSize/1024));
+	const double cMegabyte = 1024.0*1024.0;
+	for (const Configuration& configuration : configurations)
+	{
+		// Start from an empty device each time.
+		auto device = std::make_shared<SimulatedFileSystem::Device>(settings);
+		FileSystem::Opener openDevice = SimulatedFileSystem::wrapOpener(
+			MemoryFileSystem::getOpener(std::make_shared<MemoryFileSystem::Device>()), device);
+		auto openFileSystem = [&openLibrary, &openDevice](const std::string& root, bool create)
+		{
+			if (root.compare(0, std::strlen(cDeviceDir), cDeviceDir) == 0)
+				return openDevice(root, create);
+			return openLibrary(root, create);
+		};
+
+		options.readLimit = configuration.readLimit;
+		options.writeLimit = configuration.writeLimit;
+		SyncSession session(openFileSystem);
+		double copySeconds, checkSeconds, warmSeconds;
+		if (!runSync(copySeconds, session, options))
+		{
+			std::fprintf(stderr, "Error: Couldn't synchronize with %s.\n", configuration.name);
+			return 1;
+		}
+
+		SimulatedFileSystem::Statistics copyStatistics = device->getStatistics();
+		SyncSession coldSession(openFileSystem);
+		if (!runSync(checkSeconds, coldSession, options))
+		{
+			std::fprintf(stderr, "Error: Couldn't synchronize with %s.\n", configuration.name);
+			return 1;
+		}
+
+		SimulatedFileSystem::Statistics checkStatistics = device->getStatistics();
+		if (!runSync(warmSeconds, session, options))
+		{
+			std::fprintf(stderr, "Error: Couldn't synchronize with %s.\n", configuration.name);
+			return 1;
+		}
+
+		SimulatedFileSystem::Statistics warmStatistics = device->getStatistics();
+		std::fprintf(stderr, "%-20s copy: %7.2f s (%5.1f MB/s, %llu operations), "
+			"up to date: %6.3f s (%llu operations), warm: %6.3f s (%llu operations)\n",
+			configuration.name, copySeconds, copyStatistics.bytesWritten/cMegabyte/copySeconds,
+			static_cast<unsigned long long>(copyStatistics.operations), checkSeconds,
+			static_cast<unsigned long long>(checkStatistics.operations -
+				copyStatistics.operations), warmSeconds,
+			static_cast<unsigned long long>(warmStatistics.operations -
+				checkStatistics.operations));
+	}
+
+	return 0;
+}
@@ -14,13 +14,51 @@
  * limitations under the License.
  */
 
+#include "Log.h"
+#include "Metrics.h"
 #include "Options.h"
-#include "Logic.h"
+#include "SyncSession.h"
+#include <csignal>
+
+static SyncSession* gSession;
+
+static void handleInterrupt(int)
+{
+	// Stop cleanly on the first interrupt, leaving the device in a consistent state. A second
+	// interrupt exits immediately.
+	std::signal(SIGINT, SIG_DFL);
+	gSession->cancel();
+}
 
 int main(int argc, const char* const* argv)
 {
 	Options options;
 	if (!options.getFromCommandLine(argc, argv))
 		return -1;
-	return !Logic::syncMusic(options);
+
+	// Messages are written on a separate thread so a slow terminal doesn't hold up copying.
+	Log::setLevel(options.verbosity);
+	Log::start(options.verbosity != Log::Level::Error);
+
+	if (!options.metricsFile.empty())
+		Metrics::start(options.metricsFile, std::chrono::seconds(options.metricsInterval));
+
+	SyncSession session;
+	session.setProgressFunction([](const SyncSession::Progress& progress)
+		{
+			Log::Progress logProgress;
+			logProgress.filesDone = progress.songsSynced;
+			logProgress.filesTotal = progress.songsFound;
+			logProgress.totalKnown = progress.playlistsDone;
+			logProgress.bytesCopied = progress.bytesCopied;
+			Log::setProgress(logProgress);
+		});
+
+	gSession = &session;
+	std::signal(SIGINT, &handleInterrupt);
+	bool success = session.sync(options);
+	std::signal(SIGINT, SIG_DFL);
+	Metrics::stop();
+	Log::stop();
+	return !success;
 }
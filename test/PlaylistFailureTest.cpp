@@ -0,0 +1,113 @@
+/*
+ * Copyright 2022 Aaron Barany
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+// Checks which playlists are written when some of their songs can't be synchronized. Songs that
+// don't exist in the library are left out of their playlists, while playlists with songs that
+// exist but couldn't be copied are left as they were on the device until the songs are copied.
+//
+// Returns 0 if all checks pass.
+
+#include "MemoryFileSystem.h"
+#include "Options.h"
+#include "SyncSession.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+namespace
+{
+
+const char* const cLibraryDir = "/library";
+const char* const cDeviceDir = "/device";
+const std::int64_t cModifiedTime = 1640995200LL*1000000000LL;
+
+bool readPlaylist(std::string& contents, const FileSystem::Opener& openFileSystem,
+	const std::string& fileName)
+{
+	std::unique_ptr<FileSystem> playlistDir =
+		openFileSystem(std::string(cDeviceDir) + "/Playlists", false);
+	FileSystem::FileInfo info;
+	return playlistDir && playlistDir->getFileInfo(info, fileName) &&
+		playlistDir->readFile(contents, fileName);
+}
+
+bool check(bool condition, const char* description)
+{
+	if (!condition)
+		std::fprintf(stderr, "Failed: %s\n", description);
+	return condition;
+}
+
+} // namespace
+
+int main()
+{
+	auto library = std::make_shared<MemoryFileSystem::Device>();
+	std::string musicDir = std::string(cLibraryDir) + "/music/";
+	library->addFile(musicDir + "a.mp3", "song a", cModifiedTime);
+	library->addFile(musicDir + "b.mp3", "song b", cModifiedTime);
+	library->addFile(std::string(cLibraryDir) + "/playlists/Missing.m3u",
+		musicDir + "a.mp3\n" + musicDir + "deleted.mp3\n", cModifiedTime);
+	library->addFile(std::string(cLibraryDir) + "/playlists/Failed.m3u",
+		musicDir + "a.mp3\n" + musicDir + "b.mp3\n", cModifiedTime);
+
+	// A directory in place of a song keeps it from being copied.
+	auto device = std::make_shared<MemoryFileSystem::Device>();
+	device->addDirectory(std::string(cDeviceDir) + "/Music/b.mp3");
+
+	FileSystem::Opener openLibrary = MemoryFileSystem::getOpener(library);
+	FileSystem::Opener openDevice = MemoryFileSystem::getOpener(device);
+	FileSystem::Opener openFileSystem = [openLibrary, openDevice](const std::string& root,
+		bool create)
+		{
+			if (root.compare(0, std::string(cDeviceDir).size(), cDeviceDir) == 0)
+				return openDevice(root, create);
+			return openLibrary(root, create);
+		};
+
+	Options options;
+	options.playlistInput = std::string(cLibraryDir) + "/playlists";
+	options.playlistOutput = std::string(cDeviceDir) + "/Playlists";
+	options.songOutput = std::string(cDeviceDir) + "/Music";
+	options.pathTrims.push_back(musicDir);
+
+	bool success = true;
+	SyncSession(openFileSystem).sync(options);
+
+	std::string contents;
+	success &= check(readPlaylist(contents, openFileSystem, "Missing.m3u"),
+		"a playlist with a song missing from the library is written");
+	success &= check(contents.find("a.mp3") != std::string::npos &&
+		contents.find("deleted.mp3") == std::string::npos,
+		"the missing song is left out of the playlist");
+	success &= check(!readPlaylist(contents, openFileSystem, "Failed.m3u"),
+		"a playlist with a song that couldn't be copied isn't written");
+
+	// Once the song can be copied, the playlist is written by the next sync.
+	std::unique_ptr<FileSystem> songDir = openFileSystem(options.songOutput, false);
+	success &= check(songDir && songDir->removeDirectory("b.mp3"),
+		"the directory blocking the song is removed");
+	SyncSession(openFileSystem).sync(options);
+	success &= check(readPlaylist(contents, openFileSystem, "Failed.m3u") &&
+		contents.find("b.mp3") != std::string::npos,
+		"the playlist is written once the song is copied");
+
+	return success ? 0 : 1;
+}